@@ -1,10 +1,19 @@
+#pragma once
+
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdalign.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#include "arena_budget.h"
+
 // Align up the given integer to the given alignment.
 #define ALIGN_TO(_value, _alignment)                                           \
   ((_value) + ((_alignment) - 1) & -(_alignment))
@@ -16,11 +25,28 @@ typedef struct arena_block {
   uint8_t buffer[];
 } arena_block_t;
 
+// An allocation too big for a block gets its own mapping. The list node lives
+// in a regular block, the mapping is only the user data.
+typedef struct arena_large {
+  struct arena_large *next;
+  void *ptr;
+  size_t size;
+} arena_large_t;
+
 typedef struct arena {
   arena_block_t *blocks;
+  // blocks kept by `arena_reset`, reused before mapping new ones
+  arena_block_t *free_blocks;
+  arena_large_t *large;
+  // charged for what is mapped, see `arena_budget.h`
+  arena_budget_t *budget;
 } arena_t;
 
 #define ARENA_BLOCK_SIZE 4096
+#define ARENA_PAGE_SIZE 4096
+
+// Largest allocation (plus alignment padding) that fits in a single block.
+#define ARENA_MAX_BLOCK_ALLOC (ARENA_BLOCK_SIZE - sizeof(arena_block_t))
 
 static inline void arena_block_init(arena_block_t *b, arena_block_t *next) {
   b->next = next;
@@ -42,10 +68,20 @@ static void *arena_block_alloc(arena_block_t *b, size_t size, size_t align) {
 }
 
 static arena_block_t *arena_new_block(arena_t *a) {
-  arena_block_t *blk = mmap(NULL, ARENA_BLOCK_SIZE, PROT_READ | PROT_WRITE,
-                            MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
-  if (blk == MAP_FAILED)
-    return NULL;
+  arena_block_t *blk = a->free_blocks;
+  if (blk) {
+    a->free_blocks = blk->next;
+  } else {
+    if (!arena_budget_charge(a->budget, ARENA_BLOCK_SIZE))
+      return NULL;
+
+    blk = (arena_block_t *)mmap(NULL, ARENA_BLOCK_SIZE, PROT_READ | PROT_WRITE,
+                                MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (blk == MAP_FAILED) {
+      arena_budget_uncharge(a->budget, ARENA_BLOCK_SIZE);
+      return NULL;
+    }
+  }
 
   // initialize the block and prepend to the linked list
   arena_block_init(blk, a->blocks);
@@ -62,7 +98,42 @@ static arena_block_t *arena_get_block(arena_t *a) {
   return arena_new_block(a);
 }
 
+static void *arena_alloc(arena_t *a, size_t size, size_t align);
+
+static void *arena_alloc_large(arena_t *a, size_t size, size_t align) {
+  assert(align <= ARENA_PAGE_SIZE);
+
+  // rounding up to whole pages would wrap
+  if (size > SIZE_MAX - (ARENA_PAGE_SIZE - 1))
+    return NULL;
+
+  arena_large_t *l =
+      (arena_large_t *)arena_alloc(a, sizeof(*l), alignof(arena_large_t));
+  if (!l)
+    return NULL;
+
+  size = ALIGN_TO(size, ARENA_PAGE_SIZE);
+  if (!arena_budget_charge(a->budget, size))
+    return NULL;
+
+  void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  if (ptr == MAP_FAILED) {
+    arena_budget_uncharge(a->budget, size);
+    return NULL;
+  }
+
+  *l = (arena_large_t){.next = a->large, .ptr = ptr, .size = size};
+  a->large = l;
+
+  return ptr;
+}
+
 static void *arena_alloc(arena_t *a, size_t size, size_t align) {
+  // not `size + align`, that wraps for huge sizes
+  if (align > ARENA_MAX_BLOCK_ALLOC || size > ARENA_MAX_BLOCK_ALLOC - align)
+    return arena_alloc_large(a, size, align);
+
   arena_block_t *blk = arena_get_block(a);
   if (!blk)
     return NULL;
@@ -72,16 +143,161 @@ static void *arena_alloc(arena_t *a, size_t size, size_t align) {
     return buf;
 
   blk = arena_new_block(a);
+  if (!blk)
+    return NULL;
+
   return arena_block_alloc(blk, size, align);
 }
 
-static void arena_clear(arena_t *a) {
+// Map the file at `path` and keep it until the arena is reset or cleared, as
+// if it were a large allocation. The contents are not copied, and all of the
+// file is one contiguous buffer no matter its size. With `writable` the
+// mapping is private, writes go to our own copy of the page and never to the
+// file.
+//
+// Returns NULL with `errno` set on failure, `EINVAL` for anything but a
+// regular file. An empty file gets a (non NULL) empty buffer.
+static inline void *arena_map_file(arena_t *a, const char *path,
+                                   bool writable, size_t *size) {
+  // don't block on a FIFO, it is rejected below anyway
+  int fd = open(path, O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+  if (fd < 0)
+    return NULL;
+
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return NULL;
+  }
+
+  // FIFOs and devices have no size to map
+  if (!S_ISREG(st.st_mode)) {
+    close(fd);
+    errno = EINVAL;
+    return NULL;
+  }
+
+  *size = (size_t)st.st_size;
+  if (*size == 0) {
+    // /proc and friends are regular files that say 0 but have contents
+    char c;
+    ssize_t n = read(fd, &c, 1);
+    close(fd);
+    if (n != 0) {
+      if (n > 0)
+        errno = EINVAL;
+      return NULL;
+    }
+
+    return arena_alloc(a, 1, 1);
+  }
+
+  arena_large_t *l =
+      (arena_large_t *)arena_alloc(a, sizeof(*l), alignof(arena_large_t));
+  if (!l) {
+    close(fd);
+    return NULL;
+  }
+
+  if (!arena_budget_charge(a->budget, *size)) {
+    close(fd);
+    return NULL;
+  }
+
+  int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+  void *ptr = mmap(NULL, *size, prot, MAP_PRIVATE, fd, 0);
+  if (ptr == MAP_FAILED) {
+    arena_budget_uncharge(a->budget, *size);
+    close(fd);
+    return NULL;
+  }
+
+  // the mapping keeps its own reference to the file
+  close(fd);
+
+  *l = (arena_large_t){.next = a->large, .ptr = ptr, .size = *size};
+  a->large = l;
+
+  return ptr;
+}
+
+static void arena_free_large(arena_t *a) {
+  size_t size = 0;
+  for (arena_large_t *l = a->large; l; l = l->next) {
+    munmap(l->ptr, l->size);
+    size += l->size;
+  }
+
+  arena_budget_uncharge(a->budget, size);
+
+  a->large = NULL;
+}
+
+// Free all allocations, but keep the blocks around for reuse. Only the large
+// allocations are given back to the kernel, blocks wait for `arena_clear`.
+static void arena_reset(arena_t *a) {
+  arena_free_large(a);
+
   arena_block_t *b = a->blocks;
   while (b) {
     arena_block_t *next = b->next;
-    munmap(b, ARENA_BLOCK_SIZE);
+    b->next = a->free_blocks;
+    a->free_blocks = b;
     b = next;
   }
 
   a->blocks = NULL;
 }
+
+// A point in the arena to go back to with `arena_rewind`.
+typedef struct arena_mark {
+  arena_block_t *block;
+  uint8_t *head;
+  arena_large_t *large;
+} arena_mark_t;
+
+static inline arena_mark_t arena_mark(arena_t *a) {
+  return (arena_mark_t){
+      .block = a->blocks,
+      .head = a->blocks ? a->blocks->head : NULL,
+      .large = a->large,
+  };
+}
+
+// Free everything allocated since `m` was taken, marks taken after it are no
+// longer valid. Like `arena_reset`, the blocks are kept for reuse.
+static inline void arena_rewind(arena_t *a, arena_mark_t m) {
+  // the list nodes are in the blocks, unmap before giving those back
+  while (a->large != m.large) {
+    arena_large_t *l = a->large;
+    a->large = l->next;
+    munmap(l->ptr, l->size);
+    arena_budget_uncharge(a->budget, l->size);
+  }
+
+  while (a->blocks != m.block) {
+    arena_block_t *b = a->blocks;
+    a->blocks = b->next;
+    b->next = a->free_blocks;
+    a->free_blocks = b;
+  }
+
+  if (a->blocks)
+    a->blocks->head = m.head;
+}
+
+static void arena_clear(arena_t *a) {
+  arena_reset(a);
+
+  size_t count = 0;
+  arena_block_t *b = a->free_blocks;
+  while (b) {
+    arena_block_t *next = b->next;
+    munmap(b, ARENA_BLOCK_SIZE);
+    b = next;
+    count++;
+  }
+
+  a->free_blocks = NULL;
+  arena_budget_uncharge(a->budget, count * ARENA_BLOCK_SIZE);
+}
@@ -0,0 +1,190 @@
+#include "arena.h"
+#include "arena_define.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Memory budgets for arenas:
+//
+// - cost: small allocations with and without a budget. The budget is only
+//   looked at when a block is mapped, so the difference should be noise.
+// - tenants: each tenant keeps one arena that is reset between its requests
+//   (the blocks stay mapped and charged) and has a cap, all of them share a
+//   global one. Tenant 3 also fills a cache that is never reset. A request of
+//   tenant 0 runs away and hits its tenant's cap, a big request of tenant 1
+//   fits its own cap but not what the cache left of the global one.
+// - soft limit: a callback that lets allocations over the limit through and
+//   counts them.
+
+ARENA_DEFINE(node_arena, 64 << 10, 8, ARENA_GROW_DOUBLE, arena_src_mmap)
+
+#define NODES 1000000
+#define ROUNDS 20
+
+#define TENANTS 4
+#define REQUESTS 2000
+#define TENANT_LIMIT ((size_t)16 << 20)
+#define GLOBAL_LIMIT ((size_t)24 << 20)
+
+typedef struct node {
+  struct node *next;
+  uint64_t key;
+} node_t;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double bench_arena(arena_t *a, uint64_t *check) {
+  double start = now();
+  for (int r = 0; r < ROUNDS; r++) {
+    node_t *head = NULL;
+    for (size_t i = 0; i < NODES; i++) {
+      node_t *n = arena_alloc(a, sizeof(node_t), alignof(node_t));
+      *n = (node_t){.next = head, .key = i};
+      head = n;
+    }
+    *check += head->key;
+    arena_reset(a);
+  }
+
+  return now() - start;
+}
+
+static double bench_node_arena(node_arena_t *a, uint64_t *check) {
+  double start = now();
+  for (int r = 0; r < ROUNDS; r++) {
+    node_t *head = NULL;
+    for (size_t i = 0; i < NODES; i++) {
+      node_t *n = ARENA_NEW(node_arena, a, node_t);
+      *n = (node_t){.next = head, .key = i};
+      head = n;
+    }
+    *check += head->key;
+    node_arena_reset(a);
+  }
+
+  return now() - start;
+}
+
+static void cost(void) {
+  arena_budget_t global = {.limit = (size_t)1 << 30};
+  arena_budget_t tenant = {.parent = &global, .limit = (size_t)512 << 20};
+  uint64_t check = 0;
+
+  arena_t plain = {};
+  arena_t budgeted = {.budget = &tenant};
+  double plain_time = bench_arena(&plain, &check);
+  double budget_time = bench_arena(&budgeted, &check);
+  arena_clear(&plain);
+  arena_clear(&budgeted);
+
+  node_arena_t plain_nodes = {};
+  node_arena_t budget_nodes = {.budget = &tenant};
+  double plain_nodes_time = bench_node_arena(&plain_nodes, &check);
+  double budget_nodes_time = bench_node_arena(&budget_nodes, &check);
+  node_arena_clear(&plain_nodes);
+  node_arena_clear(&budget_nodes);
+
+  printf("cost (%d x %d nodes, check %lu):\n", ROUNDS, NODES,
+         (unsigned long)check);
+  printf("  arena_t:     %6.1f ms, with a budget %6.1f ms\n", plain_time * 1e3,
+         budget_time * 1e3);
+  printf("  node_arena:  %6.1f ms, with a budget %6.1f ms\n",
+         plain_nodes_time * 1e3, budget_nodes_time * 1e3);
+  printf("  peak %.1f MiB, %.1f MiB still charged after clearing\n",
+         atomic_load(&tenant.peak) / 1048576.0,
+         atomic_load(&tenant.used) / 1048576.0);
+}
+
+static void tenants(void) {
+  arena_budget_t global = {.limit = GLOBAL_LIMIT};
+  arena_budget_t budgets[TENANTS];
+  arena_t arenas[TENANTS];
+  for (int t = 0; t < TENANTS; t++) {
+    budgets[t] = (arena_budget_t){.parent = &global, .limit = TENANT_LIMIT};
+    arenas[t] = (arena_t){.budget = &budgets[t]};
+  }
+
+  arena_t cache = {.budget = &budgets[TENANTS - 1]};
+  size_t cached = 0;
+
+  size_t failed[TENANTS] = {};
+  for (int i = 0; i < REQUESTS; i++) {
+    int t = i % TENANTS;
+    arena_t *a = &arenas[t];
+
+    // a few small allocations and a buffer, tenant 0 wants a gigabyte once
+    // and tenant 1 twelve megabytes near the end
+    bool ok = true;
+    for (int j = 0; j < 64 && ok; j++)
+      ok = arena_alloc(a, 200, 8) != NULL;
+    size_t buffer = 64 << 10;
+    if (i == REQUESTS / 2)
+      buffer = (size_t)1 << 30;
+    else if (i == REQUESTS - 3)
+      buffer = (size_t)12 << 20;
+    ok = ok && arena_alloc(a, buffer, 16) != NULL;
+
+    // the cache stops growing at its tenant's cap
+    if (t == TENANTS - 1)
+      for (int j = 0; j < 8; j++)
+        cached += arena_alloc(&cache, 4000, 8) ? 4000 : 0;
+
+    failed[t] += !ok;
+    arena_reset(a);
+  }
+
+  printf("tenants (%d requests, %zu MiB each, %zu MiB shared):\n", REQUESTS,
+         TENANT_LIMIT >> 20, GLOBAL_LIMIT >> 20);
+  for (int t = 0; t < TENANTS; t++) {
+    printf("  tenant %d: %zu failed requests, %zu over budget, "
+           "%.1f MiB charged, peak %.1f MiB\n",
+           t, failed[t], atomic_load(&budgets[t].failures),
+           atomic_load(&budgets[t].used) / 1048576.0,
+           atomic_load(&budgets[t].peak) / 1048576.0);
+  }
+  printf("  cache of tenant %d: %.1f MiB\n", TENANTS - 1, cached / 1048576.0);
+
+  for (int t = 0; t < TENANTS; t++)
+    arena_clear(&arenas[t]);
+  arena_clear(&cache);
+  printf("  global: peak %.1f MiB, %zu bytes left after clearing\n",
+         atomic_load(&global.peak) / 1048576.0, atomic_load(&global.used));
+}
+
+static bool allow_and_count(arena_budget_t *b, size_t size, void *user) {
+  (void)b;
+  *(size_t *)user += size;
+  return true;
+}
+
+static void soft_limit(void) {
+  size_t over = 0;
+  arena_budget_t soft = {
+      .limit = (size_t)1 << 20, .over = allow_and_count, .user = &over};
+  arena_t a = {.budget = &soft};
+
+  for (int i = 0; i < 1000; i++) {
+    if (!arena_alloc(&a, 2048, 8)) {
+      fprintf(stderr, "soft limit failed an allocation\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  printf("soft limit of 1 MiB: %.1f MiB mapped, %.1f MiB of it let through "
+         "over the limit\n",
+         atomic_load(&soft.used) / 1048576.0, over / 1048576.0);
+  arena_clear(&a);
+}
+
+int main(void) {
+  cost();
+  tenants();
+  soft_limit();
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Also included from C++ through `arena.h`, where `_Atomic` doesn't exist.
+// The atomic functions are found by argument lookup on `std::atomic`.
+#ifdef __cplusplus
+#include <atomic>
+typedef std::atomic<size_t> arena_budget_counter_t;
+#define ARENA_BUDGET_RELAXED std::memory_order_relaxed
+#else
+#include <stdatomic.h>
+typedef _Atomic size_t arena_budget_counter_t;
+#define ARENA_BUDGET_RELAXED memory_order_relaxed
+#endif
+
+// A cap on how much memory a group of arenas may map.
+//
+// An arena with a budget charges it for every block and large allocation it
+// gets from the kernel, and gives the charge back when it unmaps them. Blocks
+// kept for reuse by `arena_reset` stay charged, a budget counts what is
+// mapped, not what is in use. All of this is on the slow path: the bump
+// allocation in a block never looks at the budget.
+//
+// Budgets form a tree through `parent`, a charge has to fit in every budget up
+// to the root. That way each tenant can have its own cap and all of them a
+// shared one. The counters are atomic, so arenas on different threads can
+// share a budget.
+//
+// When a charge doesn't fit, `over` decides what happens: return true to let
+// it through anyway (a soft limit), false to fail the allocation. Without a
+// callback the allocation fails. `arena_budget_abort` is there for hard caps
+// where running out is a bug.
+
+typedef struct arena_budget arena_budget_t;
+
+typedef bool (*arena_budget_fn)(arena_budget_t *b, size_t size, void *user);
+
+struct arena_budget {
+  arena_budget_t *parent;
+  // 0 for no limit
+  size_t limit;
+  arena_budget_fn over;
+  void *user;
+
+  arena_budget_counter_t used;
+  arena_budget_counter_t peak;
+  arena_budget_counter_t failures;
+};
+
+static inline void arena_budget_uncharge(arena_budget_t *b, size_t size) {
+  for (; b; b = b->parent)
+    atomic_fetch_sub_explicit(&b->used, size, ARENA_BUDGET_RELAXED);
+}
+
+static inline void arena_budget_update_peak(arena_budget_t *b, size_t used) {
+  size_t peak = atomic_load_explicit(&b->peak, ARENA_BUDGET_RELAXED);
+  while (used > peak && !atomic_compare_exchange_weak_explicit(
+                            &b->peak, &peak, used, ARENA_BUDGET_RELAXED,
+                            ARENA_BUDGET_RELAXED))
+    ;
+}
+
+// Charge `size` bytes to `b` and its parents. On failure nothing is charged.
+static inline bool arena_budget_charge(arena_budget_t *b, size_t size) {
+  for (arena_budget_t *c = b; c; c = c->parent) {
+    size_t used =
+        atomic_fetch_add_explicit(&c->used, size, ARENA_BUDGET_RELAXED) + size;
+
+    bool over = c->limit && used > c->limit;
+    if (over && !(c->over && c->over(c, size, c->user))) {
+      atomic_fetch_add_explicit(&c->failures, 1, ARENA_BUDGET_RELAXED);
+
+      // undo up to and including `c`
+      for (arena_budget_t *u = b; u != c->parent; u = u->parent)
+        atomic_fetch_sub_explicit(&u->used, size, ARENA_BUDGET_RELAXED);
+      return false;
+    }
+  }
+
+  // only once it is sure, a failed charge is not a peak
+  for (arena_budget_t *c = b; c; c = c->parent)
+    arena_budget_update_peak(
+        c, atomic_load_explicit(&c->used, ARENA_BUDGET_RELAXED));
+
+  return true;
+}
+
+// Move a charge between budgets, when memory changes hands. This can't fail,
+// the memory is already there, but it can leave `to` over its limit.
+static inline void arena_budget_move(arena_budget_t *from,
+                                     arena_budget_t *to, size_t size) {
+  if (from == to || size == 0)
+    return;
+
+  arena_budget_uncharge(from, size);
+  for (; to; to = to->parent) {
+    size_t used =
+        atomic_fetch_add_explicit(&to->used, size, ARENA_BUDGET_RELAXED) + size;
+    arena_budget_update_peak(to, used);
+  }
+}
+
+// An `over` callback for hard caps.
+static inline bool arena_budget_abort(arena_budget_t *b, size_t size,
+                                      void *user) {
+  (void)size, (void)user;
+  fprintf(stderr, "arena budget exceeded: %zu bytes with a limit of %zu\n",
+          atomic_load_explicit(&b->used, ARENA_BUDGET_RELAXED), b->limit);
+  abort();
+}
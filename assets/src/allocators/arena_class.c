@@ -0,0 +1,104 @@
+#include "arena_class.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Requests on a few routes, each using about the same memory every time.
+// Every request gets a fresh arena, once empty and once sized by the pool,
+// and we count how many mappings they needed. The sized arenas are charged to
+// a budget without a limit, to see what the prefill maps at most.
+
+#define REQUESTS 200000
+
+typedef struct route {
+  const char *name;
+  // bytes used by most requests, and by the rest
+  size_t usual;
+  size_t sometimes;
+  unsigned sometimes_percent;
+} route_t;
+
+static const route_t routes[] = {
+    {"/", 2 << 10, 2 << 10, 0},
+    {"/search", 36 << 10, 44 << 10, 30},
+    {"/report", 20 << 10, 120 << 10, 10},
+};
+
+#define ROUTES (sizeof(routes) / sizeof(routes[0]))
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t rng = 88172645463325252ull;
+
+static uint64_t next_random(void) {
+  rng ^= rng << 13, rng ^= rng >> 7, rng ^= rng << 17;
+  return rng;
+}
+
+// Fill the arena with small allocations until `target` bytes.
+static void handle(arena_t *a, size_t target) {
+  for (size_t used = 0; used < target;) {
+    size_t size = 16 + next_random() % 496;
+    uint8_t *p = arena_alloc(a, size, 8);
+    p[0] = p[size - 1] = 1;
+    used += size;
+  }
+}
+
+static size_t request_target(const route_t *r) {
+  return next_random() % 100 < r->sometimes_percent ? r->sometimes : r->usual;
+}
+
+int main(void) {
+  arena_budget_t budget = {};
+  static arena_class_pool_t pool;
+  pool.budget = &budget;
+  size_t maps[2][ROUTES] = {}, counts[ROUTES] = {};
+  double elapsed[2];
+
+  for (int adaptive = 0; adaptive < 2; adaptive++) {
+    rng = 88172645463325252ull;
+    memset(counts, 0, sizeof(counts));
+
+    double start = now();
+    for (size_t i = 0; i < REQUESTS; i++) {
+      unsigned cls = next_random() % ROUTES;
+      class_arena_t ca = {.cls = cls};
+      if (adaptive)
+        arena_class_acquire(&pool, cls, &ca);
+
+      handle(&ca.arena, request_target(&routes[cls]));
+
+      // one mapping for the prefilled blocks, one per block after those
+      size_t prefilled = ca.prefill_size / ARENA_BLOCK_SIZE;
+      size_t used = arena_block_count(&ca.arena);
+      maps[adaptive][cls] +=
+          used > prefilled ? used - prefilled + !!prefilled : 1;
+      counts[cls]++;
+
+      if (adaptive)
+        arena_class_release(&pool, &ca);
+      else
+        arena_clear(&ca.arena);
+    }
+    elapsed[adaptive] = now() - start;
+  }
+
+  for (size_t i = 0; i < ROUTES; i++) {
+    printf("%-8s mmaps per request: empty %5.2f, sized %5.2f (%u blocks)\n",
+           routes[i].name, (double)maps[0][i] / counts[i],
+           (double)maps[1][i] / counts[i], pool.classes[i].blocks);
+  }
+  printf("%d requests: empty %.1f ms, sized %.1f ms\n", REQUESTS,
+         elapsed[0] * 1e3, elapsed[1] * 1e3);
+  printf("sized arenas: peak %zu KiB mapped, %zu bytes left after release\n",
+         atomic_load(&budget.peak) >> 10, atomic_load(&budget.used));
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include "arena.h"
+
+// Arenas sized up front from what requests of the same class used before.
+//
+// A request arena starts empty and maps a block at a time as it grows, so a
+// request that needs 40 KiB pays for ten `mmap` calls. Requests of the same
+// kind (a route, a message type) use about the same memory, so the pool keeps
+// per class a histogram of how many blocks each arena ended up with, decayed
+// so that old requests count less and less. A new arena gets enough blocks
+// to cover the chosen percentile of that, carved from a single mapping and
+// put in its `free_blocks`, where `arena_alloc` looks before mapping.
+//
+// Blocks that were never used cost address space only, the kernel backs the
+// pages when they are touched. They are still charged to the pool's `budget`
+// (if set) from `arena_class_acquire` to `arena_class_release`, like the
+// blocks the arena maps itself: a budget counts what is mapped.
+//
+// Not thread safe, use a pool per thread.
+
+#define ARENA_CLASS_MAX 32
+// Histogram buckets, one per block count. Bigger arenas land in the last.
+#define ARENA_CLASS_BUCKETS 64
+
+#ifndef ARENA_CLASS_DECAY
+#define ARENA_CLASS_DECAY 0.98f
+#endif
+
+#ifndef ARENA_CLASS_PERCENTILE
+#define ARENA_CLASS_PERCENTILE 0.9f
+#endif
+
+typedef struct arena_class_stats {
+  float hist[ARENA_CLASS_BUCKETS];
+  float total;
+  // blocks to map up front, from the histogram at the last release
+  unsigned blocks;
+} arena_class_stats_t;
+
+typedef struct arena_class_pool {
+  arena_class_stats_t classes[ARENA_CLASS_MAX];
+  // for the arenas handed out and their prefill, or NULL
+  arena_budget_t *budget;
+} arena_class_pool_t;
+
+// An arena handed out by the pool, with the mapping its blocks were carved
+// from.
+typedef struct class_arena {
+  arena_t arena;
+  unsigned cls;
+  uint8_t *prefill;
+  size_t prefill_size;
+} class_arena_t;
+
+static inline size_t arena_block_count(arena_t *a) {
+  size_t count = 0;
+  for (arena_block_t *b = a->blocks; b; b = b->next)
+    count++;
+
+  return count;
+}
+
+// An empty arena for a request of class `cls` (below `ARENA_CLASS_MAX`), with
+// the blocks those usually need. If the budget has no room for them the arena
+// starts empty and grows a block at a time, each one charged on its own.
+static void arena_class_acquire(arena_class_pool_t *p, unsigned cls,
+                                class_arena_t *ca) {
+  assert(cls < ARENA_CLASS_MAX);
+  *ca = (class_arena_t){.arena = {.budget = p->budget}, .cls = cls};
+
+  unsigned blocks = p->classes[cls].blocks;
+  if (blocks <= 1)
+    return;
+
+  size_t size = (size_t)blocks * ARENA_BLOCK_SIZE;
+  if (!arena_budget_charge(p->budget, size))
+    return;
+
+  uint8_t *mem = (uint8_t *)mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                 MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  if (mem == MAP_FAILED) {
+    arena_budget_uncharge(p->budget, size);
+    return;
+  }
+
+  // in reverse, so the blocks are used in address order
+  for (unsigned i = blocks; i-- > 0;) {
+    arena_block_t *b = (arena_block_t *)(mem + (size_t)i * ARENA_BLOCK_SIZE);
+    b->next = ca->arena.free_blocks;
+    ca->arena.free_blocks = b;
+  }
+
+  ca->prefill = mem;
+  ca->prefill_size = size;
+}
+
+// Record how much the arena used and free it.
+static void arena_class_release(arena_class_pool_t *p, class_arena_t *ca) {
+  arena_class_stats_t *s = &p->classes[ca->cls];
+  arena_t *a = &ca->arena;
+
+  size_t used = arena_block_count(a);
+  if (used >= ARENA_CLASS_BUCKETS)
+    used = ARENA_CLASS_BUCKETS - 1;
+
+  for (size_t i = 0; i < ARENA_CLASS_BUCKETS; i++)
+    s->hist[i] *= ARENA_CLASS_DECAY;
+  s->hist[used] += 1;
+  s->total = s->total * ARENA_CLASS_DECAY + 1;
+
+  float target = s->total * ARENA_CLASS_PERCENTILE;
+  float seen = 0;
+  unsigned blocks = 0;
+  while (blocks < ARENA_CLASS_BUCKETS - 1 && (seen += s->hist[blocks]) < target)
+    blocks++;
+  s->blocks = blocks;
+
+  // unmap the prefilled blocks all at once, splitting the mapping one block
+  // at a time costs more than mapping them did
+  arena_reset(a);
+  arena_block_t **link = &a->free_blocks;
+  while (*link) {
+    uint8_t *b = (uint8_t *)*link;
+    if (b >= ca->prefill && b < ca->prefill + ca->prefill_size)
+      *link = (*link)->next;
+    else
+      link = &(*link)->next;
+  }
+  if (ca->prefill) {
+    munmap(ca->prefill, ca->prefill_size);
+    arena_budget_uncharge(p->budget, ca->prefill_size);
+  }
+
+  arena_clear(a);
+  *ca = (class_arena_t){};
+}
@@ -0,0 +1,173 @@
+#include "arena_compact.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// A key-value tree that lives in one arena for a long time. Updates write a
+// new value string, and sometimes a new copy of the node too, so the arena
+// fills with dead versions and the live nodes spread over more and more
+// blocks. Compacting it packs the live ones, and we walk the tree before and
+// after.
+
+#define KEYS 200000
+#define UPDATES 2000000
+#define WALKS 20
+
+typedef struct kv {
+  struct kv *left;
+  struct kv *right;
+  uint64_t key;
+  char *value;
+  size_t value_len;
+} kv_t;
+
+static void kv_trace(arena_compact_t *c, void *obj) {
+  kv_t *n = obj;
+  arena_compact_bytes(c, (void **)&n->value, n->value_len + 1, 1);
+}
+
+static const arena_type_t kv_type;
+static const arena_field_t kv_fields[] = {
+    {offsetof(kv_t, left), &kv_type},
+    {offsetof(kv_t, right), &kv_type},
+};
+static const arena_type_t kv_type = {
+    .size = sizeof(kv_t),
+    .align = alignof(kv_t),
+    .fields = kv_fields,
+    .field_count = 2,
+    .trace = kv_trace,
+};
+
+static uint64_t rng;
+
+static uint64_t next_random(void) {
+  rng ^= rng << 13, rng ^= rng >> 7, rng ^= rng << 17;
+  return rng;
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static char *new_value(arena_t *a, uint64_t key, size_t *len) {
+  *len = 8 + next_random() % 32;
+  char *v = arena_alloc(a, *len + 1, 1);
+  memset(v, 'a' + key % 26, *len);
+  v[*len] = 0;
+  return v;
+}
+
+static kv_t **kv_find(kv_t **link, uint64_t key) {
+  while (*link && (*link)->key != key)
+    link = key < (*link)->key ? &(*link)->left : &(*link)->right;
+
+  return link;
+}
+
+static kv_t *build(arena_t *a) {
+  kv_t *root = NULL;
+
+  rng = 88172645463325252ull;
+  for (size_t i = 0; i < KEYS; i++) {
+    uint64_t key = next_random() % (KEYS * 4);
+    kv_t **link = kv_find(&root, key);
+    if (*link)
+      continue;
+
+    kv_t *n = arena_alloc(a, sizeof(kv_t), alignof(kv_t));
+    *n = (kv_t){.key = key};
+    n->value = new_value(a, key, &n->value_len);
+    *link = n;
+  }
+
+  for (size_t i = 0; i < UPDATES; i++) {
+    kv_t **link = kv_find(&root, next_random() % (KEYS * 4));
+    if (!*link)
+      continue;
+
+    // a new version of the node a quarter of the time
+    if (next_random() % 4 == 0) {
+      kv_t *n = arena_alloc(a, sizeof(kv_t), alignof(kv_t));
+      *n = **link;
+      *link = n;
+    }
+    (*link)->value = new_value(a, (*link)->key, &(*link)->value_len);
+  }
+
+  return root;
+}
+
+static uint64_t walk(kv_t *n) {
+  uint64_t sum = 0;
+  while (n) {
+    sum += walk(n->left) + n->key + (uint8_t)n->value[n->value_len - 1];
+    n = n->right;
+  }
+
+  return sum;
+}
+
+static size_t arena_size(arena_t *a) {
+  size_t size = 0;
+  for (arena_block_t *b = a->blocks; b; b = b->next)
+    size += ARENA_BLOCK_SIZE;
+
+  return size;
+}
+
+static double time_walks(kv_t *root, uint64_t *sum) {
+  double start = now();
+  for (size_t i = 0; i < WALKS; i++)
+    *sum = walk(root);
+
+  return (now() - start) / WALKS;
+}
+
+int main(void) {
+  static const char *order_names[] = {"bfs", "dfs"};
+
+  for (int order = ARENA_COMPACT_BFS; order <= ARENA_COMPACT_DFS; order++) {
+    arena_t a = {};
+    kv_t *root = build(&a);
+
+    uint64_t before, after;
+    double walk_before = time_walks(root, &before);
+    size_t size_before = arena_size(&a);
+
+    arena_t to = {};
+    arena_compact_t c;
+    arena_compact_init(&c, &to, order);
+    arena_compact_ptr(&c, (void **)&root, &kv_type);
+
+    double start = now();
+    if (!arena_compact_run(&c)) {
+      fprintf(stderr, "out of memory\n");
+      return EXIT_FAILURE;
+    }
+    arena_compact_finish(&c, &a);
+    double compact = now() - start;
+    size_t live = c.copied;
+    arena_compact_deinit(&c);
+
+    double walk_after = time_walks(root, &after);
+    if (before != after) {
+      fprintf(stderr, "the tree changed\n");
+      return EXIT_FAILURE;
+    }
+
+    printf("%s: %6.1f MiB -> %5.1f MiB (%.1f MiB live) in %5.1f ms, "
+           "walk %5.2f ms -> %5.2f ms\n",
+           order_names[order], size_before / 1048576.0,
+           arena_size(&a) / 1048576.0, live / 1048576.0, compact * 1e3,
+           walk_before * 1e3, walk_after * 1e3);
+
+    arena_clear(&a);
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,269 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "arena_simd.h"
+
+// Copying compaction of an object graph in an arena.
+//
+// An arena that lives for long (a cache, a document being edited) fills up
+// with objects nobody points to anymore, and the live ones end up scattered
+// between them. Like a semi-space collector, we copy everything reachable
+// from a set of roots to a fresh arena, rewrite every pointer to the copies,
+// and clear the old one. The copies come out packed, in breadth first or
+// depth first order.
+//
+// The graph is described with types: a size, an alignment, the offsets of
+// the pointer fields with the type they point to, and an optional trace
+// function for anything the offsets can't say (arrays, strings, unions).
+// Objects carry no header: a table from old to new addresses makes sure
+// shared objects are copied once and cycles end.
+//
+// Every pointer handed to the compactor must be `NULL` or point to the start
+// of an object in the old arena.
+
+typedef struct arena_compact arena_compact_t;
+typedef struct arena_type arena_type_t;
+
+typedef struct arena_field {
+  size_t offset;
+  const arena_type_t *type;
+} arena_field_t;
+
+// Called on the new copy of an object, calls `arena_compact_ptr` or
+// `arena_compact_bytes` on the slots the fields don't cover.
+typedef void (*arena_trace_fn)(arena_compact_t *c, void *obj);
+
+struct arena_type {
+  size_t size;
+  size_t align;
+  const arena_field_t *fields;
+  size_t field_count;
+  arena_trace_fn trace;
+};
+
+typedef enum arena_compact_order {
+  // siblings next to each other, good for walking level by level
+  ARENA_COMPACT_BFS,
+  // every object followed by its first child, good for walking down
+  ARENA_COMPACT_DFS,
+} arena_compact_order_t;
+
+// A slot that still points to the old arena. Byte blobs have no type.
+typedef struct arena_compact_item {
+  void **slot;
+  const arena_type_t *type;
+  size_t size;
+  size_t align;
+} arena_compact_item_t;
+
+typedef struct arena_forward {
+  void *from;
+  void *to;
+} arena_forward_t;
+
+struct arena_compact {
+  arena_t *to;
+  arena_compact_order_t order;
+
+  // pending slots, taken from the front (BFS) or the back (DFS)
+  arena_compact_item_t *items;
+  size_t items_head;
+  size_t items_tail;
+  size_t items_cap;
+
+  // open addressing, a power of two, at most half full
+  arena_forward_t *forward;
+  size_t forward_count;
+  size_t forward_cap;
+
+  size_t copied;
+  bool failed;
+};
+
+static void arena_compact_init(arena_compact_t *c, arena_t *to,
+                               arena_compact_order_t order) {
+  *c = (arena_compact_t){.to = to, .order = order};
+}
+
+static void arena_compact_deinit(arena_compact_t *c) {
+  free(c->items);
+  free(c->forward);
+  *c = (arena_compact_t){};
+}
+
+static inline size_t arena_forward_hash(const void *p) {
+  uint64_t h = (uintptr_t)p * 0x9e3779b97f4a7c15ull;
+  return (size_t)(h >> 32);
+}
+
+// The slot for `from`, either holding it or empty.
+static arena_forward_t *arena_forward_find(arena_compact_t *c,
+                                           const void *from) {
+  size_t mask = c->forward_cap - 1;
+  size_t i = arena_forward_hash(from) & mask;
+  while (c->forward[i].from && c->forward[i].from != from)
+    i = (i + 1) & mask;
+
+  return &c->forward[i];
+}
+
+static bool arena_forward_grow(arena_compact_t *c) {
+  size_t old_cap = c->forward_cap;
+  arena_forward_t *old = c->forward;
+
+  size_t cap = old_cap ? old_cap * 2 : 1024;
+  arena_forward_t *forward =
+      (arena_forward_t *)calloc(cap, sizeof(arena_forward_t));
+  if (!forward)
+    return false;
+
+  c->forward = forward;
+  c->forward_cap = cap;
+  for (size_t i = 0; i < old_cap; i++) {
+    if (old[i].from)
+      *arena_forward_find(c, old[i].from) = old[i];
+  }
+
+  free(old);
+  return true;
+}
+
+static void arena_compact_push(arena_compact_t *c, arena_compact_item_t item) {
+  if (!*item.slot)
+    return;
+
+  if (c->items_tail == c->items_cap) {
+    // reclaim what BFS already consumed before growing
+    if (c->items_head > 0) {
+      memmove(c->items, c->items + c->items_head,
+              (c->items_tail - c->items_head) * sizeof(*c->items));
+      c->items_tail -= c->items_head;
+      c->items_head = 0;
+    }
+  }
+
+  if (c->items_tail == c->items_cap) {
+    size_t cap = c->items_cap ? c->items_cap * 2 : 256;
+    arena_compact_item_t *items = (arena_compact_item_t *)realloc(
+        c->items, cap * sizeof(arena_compact_item_t));
+    if (!items) {
+      c->failed = true;
+      return;
+    }
+
+    c->items = items;
+    c->items_cap = cap;
+  }
+
+  c->items[c->items_tail++] = item;
+}
+
+// Copy the object `*slot` points to (and everything it reaches) and point
+// `slot` to the copy. Used for the roots and from trace functions. The copy
+// may happen later, `slot` must stay valid until `arena_compact_run` is done.
+static inline void arena_compact_ptr(arena_compact_t *c, void **slot,
+                                     const arena_type_t *type) {
+  arena_compact_push(c, (arena_compact_item_t){
+                            .slot = slot,
+                            .type = type,
+                            .size = type->size,
+                            .align = type->align,
+                        });
+}
+
+// Same, for `size` bytes without pointers inside.
+static inline void arena_compact_bytes(arena_compact_t *c, void **slot,
+                                       size_t size, size_t align) {
+  arena_compact_push(c, (arena_compact_item_t){
+                            .slot = slot,
+                            .size = size,
+                            .align = align,
+                        });
+}
+
+static void arena_compact_scan(arena_compact_t *c, void *obj,
+                               const arena_type_t *type) {
+  size_t first = c->items_tail;
+
+  for (size_t i = 0; i < type->field_count; i++) {
+    const arena_field_t *f = &type->fields[i];
+    arena_compact_ptr(c, (void **)((uint8_t *)obj + f->offset), f->type);
+  }
+  if (type->trace)
+    type->trace(c, obj);
+
+  // popped from the back, reverse them to visit in field order
+  if (c->order == ARENA_COMPACT_DFS && !c->failed) {
+    for (size_t i = first, j = c->items_tail; i + 1 < j; i++, j--) {
+      arena_compact_item_t tmp = c->items[i];
+      c->items[i] = c->items[j - 1];
+      c->items[j - 1] = tmp;
+    }
+  }
+}
+
+// Copy everything reachable from the slots given so far. Returns false if
+// memory ran out, the new arena is then only partly filled and the old one
+// must be kept.
+static bool arena_compact_run(arena_compact_t *c) {
+  while (!c->failed && c->items_head < c->items_tail) {
+    arena_compact_item_t item = c->order == ARENA_COMPACT_BFS
+                                    ? c->items[c->items_head++]
+                                    : c->items[--c->items_tail];
+
+    if (c->forward_count * 2 >= c->forward_cap && !arena_forward_grow(c)) {
+      c->failed = true;
+      break;
+    }
+
+    arena_forward_t *f = arena_forward_find(c, *item.slot);
+    if (f->from) {
+      *item.slot = f->to;
+      continue;
+    }
+
+    void *copy = arena_memdup(c->to, *item.slot, item.size, item.align);
+    if (!copy) {
+      c->failed = true;
+      break;
+    }
+
+    *f = (arena_forward_t){.from = *item.slot, .to = copy};
+    c->forward_count++;
+    c->copied += item.size;
+    *item.slot = copy;
+
+    if (item.type)
+      arena_compact_scan(c, copy, item.type);
+  }
+
+  return !c->failed;
+}
+
+// Replace the contents of `from` with the compacted copy, so pointers to
+// `from` itself stay valid. `from` keeps its budget, and the copy's memory is
+// charged to it from then on.
+static void arena_compact_finish(arena_compact_t *c, arena_t *from) {
+  arena_t *to = c->to;
+  size_t size = 0;
+  for (arena_block_t *b = to->blocks; b; b = b->next)
+    size += ARENA_BLOCK_SIZE;
+  for (arena_block_t *b = to->free_blocks; b; b = b->next)
+    size += ARENA_BLOCK_SIZE;
+  for (arena_large_t *l = to->large; l; l = l->next)
+    size += l->size;
+  arena_budget_move(to->budget, from->budget, size);
+
+  arena_clear(from);
+  *from = (arena_t){.blocks = to->blocks,
+                    .free_blocks = to->free_blocks,
+                    .large = to->large,
+                    .budget = from->budget};
+  *to = (arena_t){.budget = to->budget};
+}
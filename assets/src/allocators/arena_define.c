@@ -0,0 +1,131 @@
+#include "arena.h"
+#include "arena_define.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// The same workloads with `arena_t` and with arenas generated for them:
+//
+// - nodes: small structs with the same alignment, a graph built and thrown
+//   away over and over
+// - strings: byte aligned, many sizes, backed by malloc and growing
+
+// same block size as `arena_t`, only the specialization differs
+ARENA_DEFINE(node_arena, ARENA_BLOCK_SIZE, 8, ARENA_GROW_FIXED, arena_src_mmap)
+// tuned for it: bigger blocks that grow
+ARENA_DEFINE(tree_arena, 64 << 10, 8, ARENA_GROW_DOUBLE, arena_src_mmap)
+ARENA_DEFINE(str_arena, 1024, 1, ARENA_GROW_DOUBLE, arena_src_heap)
+
+#define NODES 1000000
+#define ROUNDS 20
+#define STRINGS 4000000
+
+typedef struct node {
+  struct node *left;
+  struct node *right;
+  uint64_t key;
+} node_t;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Link nodes with pseudo random keys, each to the last two. `alloc` is the
+// node allocation for each arena.
+#define BUILD_GRAPH(_alloc)                                                     \
+  do {                                                                         \
+    node_t *root = NULL;                                                       \
+    uint64_t x = 88172645463325252ull;                                         \
+    for (size_t i = 0; i < NODES; i++) {                                       \
+      x ^= x << 13, x ^= x >> 7, x ^= x << 17;                                 \
+      node_t *n = (_alloc);                                                    \
+      *n = (node_t){.key = x};                                                 \
+      n->left = root;                                                          \
+      n->right = root ? root->left : NULL;                                     \
+      root = n;                                                                \
+    }                                                                          \
+    check += root->key;                                                        \
+  } while (0)
+
+#define BUILD_STRINGS(_alloc)                                                  \
+  do {                                                                         \
+    for (size_t i = 0; i < STRINGS; i++) {                                     \
+      size_t len = 1 + (i * 7) % 23;                                           \
+      char *s = (_alloc);                                                      \
+      memset(s, 'a' + i % 26, len);                                            \
+      check += s[len - 1];                                                     \
+    }                                                                          \
+  } while (0)
+
+int main(void) {
+  uint64_t check = 0;
+  double start;
+
+  arena_t arena = {};
+  start = now();
+  for (size_t r = 0; r < ROUNDS; r++) {
+    BUILD_GRAPH((node_t *)arena_alloc(&arena, sizeof(node_t), alignof(node_t)));
+    arena_reset(&arena);
+  }
+  double generic = now() - start;
+  arena_clear(&arena);
+
+  node_arena_t nodes = {};
+  start = now();
+  for (size_t r = 0; r < ROUNDS; r++) {
+    BUILD_GRAPH(ARENA_NEW(node_arena, &nodes, node_t));
+    node_arena_reset(&nodes);
+  }
+  double special = now() - start;
+  node_arena_clear(&nodes);
+
+  tree_arena_t tree = {};
+  start = now();
+  for (size_t r = 0; r < ROUNDS; r++) {
+    BUILD_GRAPH(ARENA_NEW(tree_arena, &tree, node_t));
+    tree_arena_reset(&tree);
+  }
+  double tuned = now() - start;
+  tree_arena_clear(&tree);
+
+  printf("nodes:   arena_t %6.1f ms, node_arena %6.1f ms, "
+         "tree_arena %6.1f ms\n",
+         generic * 1e3, special * 1e3, tuned * 1e3);
+
+  start = now();
+  for (size_t r = 0; r < ROUNDS / 4; r++) {
+    BUILD_STRINGS((char *)arena_alloc(&arena, len, 1));
+    arena_reset(&arena);
+  }
+  generic = now() - start;
+  arena_clear(&arena);
+
+  str_arena_t strings = {};
+  start = now();
+  for (size_t r = 0; r < ROUNDS / 4; r++) {
+    BUILD_STRINGS((char *)str_arena_alloc(&strings, len));
+    str_arena_reset(&strings);
+  }
+  special = now() - start;
+  str_arena_clear(&strings);
+
+  printf("strings: arena_t %6.1f ms, str_arena  %6.1f ms\n", generic * 1e3,
+         special * 1e3);
+
+  // an alignment above the default goes through the aligned path
+  str_arena_t s = {};
+  str_arena_alloc(&s, 3);
+  void *p = str_arena_alloc_aligned(&s, 100, 64);
+  void *big = str_arena_alloc(&s, 1 << 20);
+  if ((uintptr_t)p % 64 != 0 || !big) {
+    fprintf(stderr, "bad allocation\n");
+    return EXIT_FAILURE;
+  }
+  str_arena_clear(&s);
+
+  return check ? EXIT_SUCCESS : EXIT_FAILURE;
+}
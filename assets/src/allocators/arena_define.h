@@ -0,0 +1,228 @@
+#pragma once
+
+#include <assert.h>
+#include <stdalign.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "arena_budget.h"
+
+// Align up the given integer to the given alignment.
+#define ALIGN_TO(_value, _alignment)                                           \
+  ((_value) + ((_alignment) - 1) & -(_alignment))
+
+// Arenas specialized at compile time.
+//
+// `arena_t` takes its block size from `ARENA_BLOCK_SIZE` and aligns the head
+// on every call with whatever alignment it is given. `ARENA_DEFINE` generates
+// an arena type with everything fixed in the definition instead:
+//
+//   ARENA_DEFINE(name, block_size, align, growth, source)
+//
+// - `block_size`: size of the first block, header included.
+// - `align`: the default alignment. Sizes are rounded up to it, so the head
+//   is always aligned and `name_alloc` never has to align it. The rounding is
+//   a constant mask.
+// - `growth`: `ARENA_GROW_FIXED` or `ARENA_GROW_DOUBLE`, where every new
+//   block is twice the last one, up to `ARENA_DEFINE_MAX_BLOCK`.
+// - `source`: a prefix `P` with `P_map(size, align)` and `P_unmap(ptr, size)`
+//   where the blocks come from. `arena_src_mmap` and `arena_src_heap` are
+//   below.
+//
+// The result is a type `name_t` (zero initialized is empty), with:
+//
+//   void *name_alloc(name_t *a, size_t size);
+//   void *name_alloc_aligned(name_t *a, size_t size, size_t align);
+//   void  name_reset(name_t *a);
+//   void  name_clear(name_t *a);
+//
+// and `ARENA_NEW(name, a, T)` for a single `T`. The fast path is a compare
+// and an add, everything else is out of line. Zero bytes from an arena that
+// has no block yet are `NULL`. Set `budget` to charge the blocks taken from
+// the source to an `arena_budget_t`.
+
+#define ARENA_GROW_FIXED 0
+#define ARENA_GROW_DOUBLE 1
+
+#ifndef ARENA_DEFINE_MAX_BLOCK
+#define ARENA_DEFINE_MAX_BLOCK ((size_t)16 << 20)
+#endif
+
+// --- Sources:
+
+#define ARENA_SRC_PAGE_SIZE 4096
+
+static inline void *arena_src_mmap_map(size_t size, size_t align) {
+  assert(align <= ARENA_SRC_PAGE_SIZE);
+  (void)align;
+
+  void *ptr = mmap(NULL, ALIGN_TO(size, ARENA_SRC_PAGE_SIZE),
+                   PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+static inline void arena_src_mmap_unmap(void *ptr, size_t size) {
+  munmap(ptr, ALIGN_TO(size, ARENA_SRC_PAGE_SIZE));
+}
+
+// From malloc, for small arenas that would waste most of a page.
+static inline void *arena_src_heap_map(size_t size, size_t align) {
+  if (align < alignof(max_align_t))
+    align = alignof(max_align_t);
+
+  return aligned_alloc(align, ALIGN_TO(size, align));
+}
+
+static inline void arena_src_heap_unmap(void *ptr, size_t size) {
+  (void)size;
+  free(ptr);
+}
+
+// --- The generator:
+
+#define ARENA_DEFINE(_name, _block_size, _align, _growth, _source)             \
+  static_assert(((_align) & ((_align) - 1)) == 0,                              \
+                #_name ": alignment must be a power of two");                  \
+  static_assert((_block_size) % (_align) == 0,                                 \
+                #_name ": block size must be a multiple of the alignment");    \
+                                                                               \
+  typedef struct _name##_block {                                               \
+    struct _name##_block *next;                                                \
+    size_t size;                                                               \
+  } _name##_block_t;                                                           \
+                                                                               \
+  enum {                                                                       \
+    _name##_header_size = ALIGN_TO(sizeof(_name##_block_t), (_align)),         \
+  };                                                                           \
+                                                                               \
+  static_assert((_block_size) > _name##_header_size,                           \
+                #_name ": block size too small for the header");               \
+                                                                               \
+  typedef struct _name {                                                       \
+    /* the free space of the current block, a multiple of `_align` */          \
+    uint8_t *head;                                                             \
+    uint8_t *end;                                                              \
+    _name##_block_t *blocks;                                                   \
+    /* blocks kept by `_name_reset` */                                         \
+    _name##_block_t *free_blocks;                                              \
+    /* size of the next block, 0 for `_block_size` */                          \
+    size_t next_size;                                                          \
+    arena_budget_t *budget;                                                    \
+  } _name##_t;                                                                 \
+                                                                               \
+  /* Get a block with at least `size` usable bytes, from the free list or */   \
+  /* the source. An oversized block becomes the current one too, what is  */   \
+  /* left of the old block is lost, like in `arena_t`.                    */   \
+  static _name##_block_t *_name##_grow(_name##_t *a, size_t size) {            \
+    size_t standard = a->next_size ? a->next_size : (_block_size);             \
+    size_t total = standard;                                                   \
+    if (size > total - _name##_header_size) {                                  \
+      if (size > SIZE_MAX - _name##_header_size - (_block_size))               \
+        return NULL;                                                           \
+      total = (size + _name##_header_size + (_block_size) - 1) /               \
+              (_block_size) * (_block_size);                                   \
+    }                                                                          \
+                                                                               \
+    _name##_block_t *b = a->free_blocks;                                       \
+    if (b && b->size >= total) {                                               \
+      a->free_blocks = b->next;                                                \
+    } else {                                                                   \
+      if (!arena_budget_charge(a->budget, total))                              \
+        return NULL;                                                           \
+      b = (_name##_block_t *)_source##_map(total, (_align));                   \
+      if (!b) {                                                                \
+        arena_budget_uncharge(a->budget, total);                               \
+        return NULL;                                                           \
+      }                                                                        \
+      b->size = total;                                                         \
+    }                                                                          \
+                                                                               \
+    if ((_growth) == ARENA_GROW_DOUBLE && standard < ARENA_DEFINE_MAX_BLOCK)   \
+      a->next_size = standard * 2;                                             \
+                                                                               \
+    b->next = a->blocks;                                                       \
+    a->blocks = b;                                                             \
+    a->head = (uint8_t *)b + _name##_header_size;                              \
+    a->end = (uint8_t *)b + b->size;                                           \
+    return b;                                                                  \
+  }                                                                            \
+                                                                               \
+  __attribute__((noinline)) static void *_name##_alloc_slow(                   \
+      _name##_t *a, size_t size, size_t align) {                               \
+    if (align < (_align))                                                      \
+      align = (_align);                                                        \
+    if (size > SIZE_MAX - align || !_name##_grow(a, size + align - (_align)))  \
+      return NULL;                                                             \
+                                                                               \
+    uint8_t *ptr = (uint8_t *)ALIGN_TO((uintptr_t)a->head, align);             \
+    a->head = ptr + ALIGN_TO(size, (_align));                                  \
+    return ptr;                                                                \
+  }                                                                            \
+                                                                               \
+  static inline void *_name##_alloc(_name##_t *a, size_t size) {               \
+    /* the room left is a multiple of `_align`, so if `size` fits, so does */  \
+    /* `size` rounded up                                                   */  \
+    uint8_t *ptr = a->head;                                                    \
+    if (__builtin_expect(size <= (size_t)(a->end - ptr), 1)) {                 \
+      a->head = ptr + ALIGN_TO(size, (_align));                                \
+      return ptr;                                                              \
+    }                                                                          \
+                                                                               \
+    return _name##_alloc_slow(a, size, (_align));                              \
+  }                                                                            \
+                                                                               \
+  /* With a constant `align`, at most the default, this is `_name_alloc`. */   \
+  static inline void *_name##_alloc_aligned(_name##_t *a, size_t size,         \
+                                            size_t align) {                    \
+    if (align <= (_align))                                                     \
+      return _name##_alloc(a, size);                                           \
+                                                                               \
+    uint8_t *ptr = (uint8_t *)ALIGN_TO((uintptr_t)a->head, align);             \
+    if (ptr <= a->end && size <= (size_t)(a->end - ptr)) {                     \
+      a->head = ptr + ALIGN_TO(size, (_align));                                \
+      return ptr;                                                              \
+    }                                                                          \
+                                                                               \
+    return _name##_alloc_slow(a, size, align);                                 \
+  }                                                                            \
+                                                                               \
+  /* Keep the blocks for reuse, the biggest end up in front. Growth starts */  \
+  /* over, so the next round takes the big blocks first and still fits   */    \
+  /* the smaller ones as the sizes double again.                          */   \
+  static void _name##_reset(_name##_t *a) {                                    \
+    _name##_block_t *b = a->blocks;                                            \
+    while (b) {                                                                \
+      _name##_block_t *next = b->next;                                         \
+      _name##_block_t **link = &a->free_blocks;                                \
+      while (*link && (*link)->size > b->size)                                 \
+        link = &(*link)->next;                                                 \
+      b->next = *link;                                                         \
+      *link = b;                                                               \
+      b = next;                                                                \
+    }                                                                          \
+                                                                               \
+    a->blocks = NULL;                                                          \
+    a->head = a->end = NULL;                                                   \
+    a->next_size = 0;                                                          \
+  }                                                                            \
+                                                                               \
+  static void _name##_clear(_name##_t *a) {                                    \
+    _name##_reset(a);                                                          \
+                                                                               \
+    size_t size = 0;                                                           \
+    _name##_block_t *b = a->free_blocks;                                       \
+    while (b) {                                                                \
+      _name##_block_t *next = b->next;                                         \
+      size += b->size;                                                         \
+      _source##_unmap(b, b->size);                                             \
+      b = next;                                                                \
+    }                                                                          \
+                                                                               \
+    arena_budget_uncharge(a->budget, size);                                    \
+    *a = (_name##_t){.budget = a->budget};                                     \
+  }
+
+#define ARENA_NEW(_name, _a, _T)                                               \
+  ((_T *)_name##_alloc_aligned((_a), sizeof(_T), alignof(_T)))
@@ -0,0 +1,164 @@
+#define _GNU_SOURCE
+
+#include "arena.h"
+#include "json.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// Loading config files into an arena and parsing them. Reading copies every
+// byte into arena memory, mapping with `arena_map_file` gives the parser the
+// page cache directly. Either way the file goes away with the arena.
+//
+// The files are written to /tmp first, so they are in the page cache and we
+// measure the copies and not the disk.
+
+#define SMALL_RECORDS 8
+#define LARGE_RECORDS 40000
+#define SMALL_ROUNDS 20000
+#define LARGE_ROUNDS 20
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// The old way: the whole file in arena memory, with `read`.
+static void *arena_read_file(arena_t *a, const char *path, size_t *size) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return NULL;
+
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return NULL;
+  }
+
+  *size = (size_t)st.st_size;
+  uint8_t *buf = (uint8_t *)arena_alloc(a, *size, 1);
+  if (!buf) {
+    close(fd);
+    return NULL;
+  }
+
+  for (size_t done = 0; done < *size;) {
+    ssize_t n = read(fd, buf + done, *size - done);
+    if (n <= 0) {
+      close(fd);
+      return NULL;
+    }
+    done += n;
+  }
+
+  close(fd);
+  return buf;
+}
+
+static bool write_config(const char *path, int records) {
+  FILE *f = fopen(path, "w");
+  if (!f)
+    return false;
+
+  fprintf(f, "{\"routes\": [");
+  for (int i = 0; i < records; i++)
+    fprintf(f,
+            "%s\n  {\"path\": \"/api/v1/resource%d\", \"handler\": "
+            "\"handler_%d\", \"methods\": [\"GET\", \"POST\"], "
+            "\"timeout_ms\": %d, \"cache\": %s}",
+            i ? "," : "", i, i, 100 + i % 900, i % 3 ? "true" : "false");
+  fprintf(f, "\n]}\n");
+
+  return fclose(f) == 0;
+}
+
+typedef void *(*load_fn)(arena_t *a, const char *path, size_t *size);
+
+static void *map_file(arena_t *a, const char *path, size_t *size) {
+  return arena_map_file(a, path, false, size);
+}
+
+static void bench(const char *name, const char *path, int records, int rounds,
+                  load_fn load, fba_t *scratch) {
+  arena_t arena = {};
+  double load_time = 0, parse_time = 0;
+  size_t size = 0;
+
+  for (int i = 0; i < rounds; i++) {
+    double start = now();
+    char const *text = load(&arena, path, &size);
+    if (!text) {
+      perror(path);
+      exit(EXIT_FAILURE);
+    }
+    double loaded = now();
+
+    json_value_t *v = json_parse(&arena, scratch, text, size);
+    if (!v || v->object.count != 1 ||
+        v->object.members[0].value.array.count != (size_t)records) {
+      fprintf(stderr, "%s: bad config\n", path);
+      exit(EXIT_FAILURE);
+    }
+    parse_time += now() - loaded;
+    load_time += loaded - start;
+
+    arena_reset(&arena);
+  }
+
+  arena_clear(&arena);
+  printf("%-5s %8zu bytes: load %8.2f us, parse %8.2f us\n", name, size,
+         load_time * 1e6 / rounds, parse_time * 1e6 / rounds);
+}
+
+int main(void) {
+  const char *small = "/tmp/arena_file_small.json";
+  const char *large = "/tmp/arena_file_large.json";
+  if (!write_config(small, SMALL_RECORDS) ||
+      !write_config(large, LARGE_RECORDS)) {
+    perror("write_config");
+    return EXIT_FAILURE;
+  }
+
+  // the structural index needs 4 bytes per input byte
+  size_t scratch_size = 64 << 20;
+  uint8_t *scratch_buffer = malloc(scratch_size);
+  fba_t scratch;
+  fba_init(&scratch, scratch_buffer, scratch_size);
+
+  bench("read", small, SMALL_RECORDS, SMALL_ROUNDS, arena_read_file,
+        &scratch);
+  bench("mmap", small, SMALL_RECORDS, SMALL_ROUNDS, map_file, &scratch);
+  bench("read", large, LARGE_RECORDS, LARGE_ROUNDS, arena_read_file,
+        &scratch);
+  bench("mmap", large, LARGE_RECORDS, LARGE_ROUNDS, map_file, &scratch);
+
+  // a private writable mapping can be edited in place, the file stays as is
+  arena_t arena = {};
+  size_t size;
+  char *text = arena_map_file(&arena, small, true, &size);
+  if (!text) {
+    perror(small);
+    return EXIT_FAILURE;
+  }
+  text[0] = '[';
+  arena_clear(&arena);
+
+  text = arena_map_file(&arena, small, false, &size);
+  printf("after a private write the file still starts with '%c'\n", text[0]);
+  arena_clear(&arena);
+
+  if (arena_map_file(&arena, "/tmp/arena_file_missing.json", false, &size) ||
+      errno != ENOENT) {
+    fprintf(stderr, "mapped a missing file\n");
+    return EXIT_FAILURE;
+  }
+  arena_clear(&arena);
+
+  free(scratch_buffer);
+  unlink(small);
+  unlink(large);
+  return EXIT_SUCCESS;
+}
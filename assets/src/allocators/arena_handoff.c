@@ -0,0 +1,252 @@
+#define _GNU_SOURCE
+
+#include "arena_handoff.h"
+#include "mpmc_queue.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// A request pipeline: parse, handle, then serialize and log, each stage on
+// its own thread. The stages talk through rings of parcels.
+//
+// With copies every stage copies the request it gets into an arena of its
+// own and releases the one it got. With handoff the same arena goes through
+// the whole pipeline, each stage adding to it, and the handle stage gives
+// one reference to each of the last two.
+
+#define REQUESTS 200000
+#define HEADERS 16
+#define BODY_SIZE 1024
+#define RESPONSE_SIZE 2048
+#define RING_CELLS 256
+
+typedef struct header {
+  char *name;
+  char *value;
+} header_t;
+
+typedef struct request {
+  char *method;
+  char *path;
+  header_t headers[HEADERS];
+  char *body;
+  char *response;
+} request_t;
+
+typedef enum { MODE_COPY, MODE_HANDOFF } pipeline_mode_t;
+
+typedef struct pipeline {
+  pipeline_mode_t mode;
+  mpmc_ring_t to_handle;
+  mpmc_ring_t to_serialize;
+  mpmc_ring_t to_log;
+  mpmc_cell_t cells[3][RING_CELLS];
+  uint64_t serialized;
+  uint64_t logged;
+} pipeline_t;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void send(mpmc_ring_t *r, arena_parcel_t *p) {
+  while (!mpmc_ring_push(r, p))
+    sched_yield();
+}
+
+static arena_parcel_t *receive(mpmc_ring_t *r) {
+  void *p;
+  while (!mpmc_ring_pop(r, &p))
+    sched_yield();
+
+  return p;
+}
+
+static char *dup_string(arena_t *a, const char *s) {
+  size_t len = strlen(s) + 1;
+  char *d = arena_alloc(a, len, 1);
+  memcpy(d, s, len);
+  return d;
+}
+
+// What a stage without handoff has to do with everything it inherits.
+static request_t *copy_request(arena_t *a, const request_t *r) {
+  request_t *c = arena_alloc(a, sizeof(request_t), alignof(request_t));
+  c->method = dup_string(a, r->method);
+  c->path = dup_string(a, r->path);
+  for (size_t i = 0; i < HEADERS; i++) {
+    c->headers[i].name = dup_string(a, r->headers[i].name);
+    c->headers[i].value = dup_string(a, r->headers[i].value);
+  }
+  c->body = arena_alloc(a, BODY_SIZE, 1);
+  memcpy(c->body, r->body, BODY_SIZE);
+  c->response = NULL;
+  if (r->response) {
+    c->response = arena_alloc(a, RESPONSE_SIZE, 1);
+    memcpy(c->response, r->response, RESPONSE_SIZE);
+  }
+
+  return c;
+}
+
+static arena_parcel_t *parse(size_t i) {
+  arena_t a = {};
+  request_t *r = arena_alloc(&a, sizeof(request_t), alignof(request_t));
+
+  char buf[64];
+  r->method = dup_string(&a, "GET");
+  snprintf(buf, sizeof(buf), "/items/%zu", i);
+  r->path = dup_string(&a, buf);
+  for (size_t h = 0; h < HEADERS; h++) {
+    snprintf(buf, sizeof(buf), "X-Header-%zu", h);
+    r->headers[h].name = dup_string(&a, buf);
+    snprintf(buf, sizeof(buf), "value %zu of request %zu", h, i);
+    r->headers[h].value = dup_string(&a, buf);
+  }
+  r->body = arena_alloc(&a, BODY_SIZE, 1);
+  memset(r->body, 'a' + i % 26, BODY_SIZE);
+  r->response = NULL;
+
+  return arena_detach(&a, r, 1);
+}
+
+static void *handle_stage(void *arg) {
+  pipeline_t *p = arg;
+
+  for (size_t i = 0; i < REQUESTS; i++) {
+    arena_parcel_t *in = receive(&p->to_handle);
+    arena_parcel_t *out = in;
+    request_t *r = in->data;
+
+    if (p->mode == MODE_COPY) {
+      arena_t a = {};
+      r = copy_request(&a, r);
+      arena_parcel_release(in);
+      out = arena_detach(&a, r, 1);
+    }
+
+    // the response goes in the same arena as the request
+    r->response = arena_alloc(&out->arena, RESPONSE_SIZE, 1);
+    int len = snprintf(r->response, RESPONSE_SIZE, "200 OK %s %s\r\n",
+                       r->method, r->path);
+    memset(r->response + len, r->body[0], RESPONSE_SIZE - len);
+
+    if (p->mode == MODE_HANDOFF) {
+      arena_parcel_retain(out);
+      send(&p->to_serialize, out);
+      send(&p->to_log, out);
+    } else {
+      // and the logger gets its own copy
+      arena_t a = {};
+      request_t *l = copy_request(&a, r);
+      send(&p->to_serialize, out);
+      send(&p->to_log, arena_detach(&a, l, 1));
+    }
+  }
+
+  return NULL;
+}
+
+static void *serialize_stage(void *arg) {
+  pipeline_t *p = arg;
+
+  for (size_t i = 0; i < REQUESTS; i++) {
+    arena_parcel_t *in = receive(&p->to_serialize);
+    request_t *r = in->data;
+
+    if (p->mode == MODE_COPY) {
+      arena_t a = {};
+      r = copy_request(&a, r);
+      arena_parcel_release(in);
+      in = arena_detach(&a, r, 1);
+    }
+
+    uint64_t sum = 0;
+    for (size_t j = 0; j < RESPONSE_SIZE; j += 64)
+      sum += (uint8_t)r->response[j];
+    for (size_t h = 0; h < HEADERS; h++)
+      sum += strlen(r->headers[h].value);
+    p->serialized += sum;
+
+    arena_parcel_release(in);
+  }
+
+  return NULL;
+}
+
+static void *log_stage(void *arg) {
+  pipeline_t *p = arg;
+
+  for (size_t i = 0; i < REQUESTS; i++) {
+    arena_parcel_t *in = receive(&p->to_log);
+    request_t *r = in->data;
+    p->logged += strlen(r->method) + strlen(r->path) + (uint8_t)r->body[0];
+    arena_parcel_release(in);
+  }
+
+  return NULL;
+}
+
+static double run(pipeline_t *p, pipeline_mode_t mode) {
+  p->mode = mode;
+  p->serialized = p->logged = 0;
+  mpmc_ring_init(&p->to_handle, (uint8_t *)p->cells[0], sizeof(p->cells[0]));
+  mpmc_ring_init(&p->to_serialize, (uint8_t *)p->cells[1],
+                 sizeof(p->cells[1]));
+  mpmc_ring_init(&p->to_log, (uint8_t *)p->cells[2], sizeof(p->cells[2]));
+
+  pthread_t threads[3];
+  double start = now();
+  pthread_create(&threads[0], NULL, handle_stage, p);
+  pthread_create(&threads[1], NULL, serialize_stage, p);
+  pthread_create(&threads[2], NULL, log_stage, p);
+
+  for (size_t i = 0; i < REQUESTS; i++)
+    send(&p->to_handle, parse(i));
+
+  for (size_t i = 0; i < 3; i++)
+    pthread_join(threads[i], NULL);
+
+  return now() - start;
+}
+
+int main(void) {
+  static pipeline_t p;
+
+  double copy = run(&p, MODE_COPY);
+  uint64_t serialized = p.serialized, logged = p.logged;
+  double handoff = run(&p, MODE_HANDOFF);
+  if (p.serialized != serialized || p.logged != logged) {
+    fprintf(stderr, "the stages saw different data\n");
+    return EXIT_FAILURE;
+  }
+
+  printf("%d requests: copy %.1f ms (%.2f us each), handoff %.1f ms "
+         "(%.2f us each)\n",
+         REQUESTS, copy * 1e3, copy * 1e6 / REQUESTS, handoff * 1e3,
+         handoff * 1e6 / REQUESTS);
+
+  // one slot instead of a ring
+  _Atomic(arena_parcel_t *) slot = NULL;
+  arena_parcel_t *parcel = parse(0);
+  arena_parcel_publish(&slot, parcel);
+  parcel = arena_parcel_take(&slot);
+
+  // and taken over by a long lived arena
+  arena_t a = {};
+  arena_alloc(&a, 16, 8);
+  request_t *r = parcel->data;
+  arena_adopt(&a, parcel);
+  if (strcmp(r->method, "GET") != 0 || arena_parcel_take(&slot)) {
+    fprintf(stderr, "bad handoff\n");
+    return EXIT_FAILURE;
+  }
+  arena_clear(&a);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+// Handing an arena over to another thread.
+//
+// An `arena_t` has a single owner, so stages of a pipeline on different
+// threads usually copy what they get into memory of their own. Nothing in the
+// arena is tied to a thread though, only to whoever is allowed to touch it.
+// `arena_detach` moves everything allocated so far into a parcel, which can
+// be passed on as one pointer. The parcel itself lives in the first of its
+// blocks, so detaching doesn't allocate anywhere else.
+//
+// The thread that holds the parcel may keep allocating from `p->arena`, and
+// then pass it on again. The pointer must get to the next thread through
+// something that orders memory (a queue, a mutex, `arena_parcel_publish`),
+// so that everything written to the arena is visible on the other side.
+//
+// With more than one reference, like a stage that feeds two others, the data
+// must only be read, and the last `arena_parcel_release` clears the arena.
+
+typedef struct arena_parcel {
+  arena_t arena;
+  _Atomic uint32_t refs;
+  // whatever the receiver should start from
+  void *data;
+} arena_parcel_t;
+
+// Move what was allocated in `a` to a new parcel with `refs` references. `a`
+// keeps its free blocks and starts over empty. Returns `NULL` if the parcel
+// itself could not be allocated, `a` is then untouched.
+static arena_parcel_t *arena_detach(arena_t *a, void *data, uint32_t refs) {
+  arena_parcel_t *p = (arena_parcel_t *)arena_alloc(a, sizeof(arena_parcel_t),
+                                                    alignof(arena_parcel_t));
+  if (!p)
+    return NULL;
+
+  // the parcel stays charged to our budget until someone adopts it
+  p->arena = (arena_t){
+      .blocks = a->blocks, .large = a->large, .budget = a->budget};
+  atomic_init(&p->refs, refs);
+  p->data = data;
+
+  a->blocks = NULL;
+  a->large = NULL;
+  return p;
+}
+
+// Take over the contents of `p` into `a`, which then owns them until it is
+// reset. New allocations keep going to the current block of `a`.
+static void arena_adopt(arena_t *a, arena_parcel_t *p) {
+  // copy first, `p` is in one of the blocks we are moving
+  arena_t from = p->arena;
+  size_t size = 0;
+
+  if (from.blocks) {
+    arena_block_t *last = from.blocks;
+    for (size += ARENA_BLOCK_SIZE; last->next; size += ARENA_BLOCK_SIZE)
+      last = last->next;
+
+    if (a->blocks) {
+      last->next = a->blocks->next;
+      a->blocks->next = from.blocks;
+    } else {
+      a->blocks = from.blocks;
+    }
+  }
+
+  if (from.large) {
+    arena_large_t *last = from.large;
+    for (size += last->size; last->next; size += last->size)
+      last = last->next;
+
+    last->next = a->large;
+    a->large = from.large;
+  }
+
+  arena_block_t *b = from.free_blocks;
+  while (b) {
+    arena_block_t *next = b->next;
+    b->next = a->free_blocks;
+    a->free_blocks = b;
+    b = next;
+    size += ARENA_BLOCK_SIZE;
+  }
+
+  arena_budget_move(from.budget, a->budget, size);
+}
+
+static inline void arena_parcel_retain(arena_parcel_t *p) {
+  atomic_fetch_add_explicit(&p->refs, 1, memory_order_relaxed);
+}
+
+static inline void arena_parcel_release(arena_parcel_t *p) {
+  // acquire too, the last one must see every other holder's reads done
+  if (atomic_fetch_sub_explicit(&p->refs, 1, memory_order_acq_rel) != 1)
+    return;
+
+  // `p` goes away with its blocks, clear a copy
+  arena_t a = p->arena;
+  arena_clear(&a);
+}
+
+// A single slot to hand a parcel over without a queue.
+static inline void arena_parcel_publish(_Atomic(arena_parcel_t *) *slot,
+                                        arena_parcel_t *p) {
+  atomic_store_explicit(slot, p, memory_order_release);
+}
+
+static inline arena_parcel_t *
+arena_parcel_take(_Atomic(arena_parcel_t *) *slot) {
+  return atomic_exchange_explicit(slot, NULL, memory_order_acquire);
+}
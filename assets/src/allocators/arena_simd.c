@@ -0,0 +1,140 @@
+#define _GNU_SOURCE
+
+#include "arena_simd.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Duplicate and zero-fill at the sizes our arenas see, with the kernels from
+// `arena_simd.h` against `arena_alloc` followed by libc `memcpy`/`memset`.
+// Blocks are retained with `arena_reset` between rounds, like the request
+// arenas in the server, so they come back dirty.
+
+#define SOURCE_SIZE ((size_t)16 << 20)
+#define BYTES_PER_SIZE ((size_t)64 << 20)
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15;
+
+static uint64_t rng(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return rng_state;
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static volatile uint8_t sink;
+
+typedef enum { OP_DUP, OP_LIBC_DUP, OP_ZERO, OP_LIBC_ZERO } op_t;
+
+// ns per operation of `op` at `len` bytes
+static double bench(arena_t *a, const uint8_t *src, op_t op, size_t len) {
+  size_t ops = BYTES_PER_SIZE / (len + 64);
+  if (ops > 1 << 20)
+    ops = 1 << 20;
+  size_t per_round = 4096 / (len + 64) + 1;
+
+  double start = now();
+  for (size_t i = 0; i < ops; i++) {
+    const uint8_t *s = src + (i * 7) % (SOURCE_SIZE - len);
+    uint8_t *p = NULL;
+
+    switch (op) {
+    case OP_DUP:
+      p = arena_memdup(a, s, len, 1);
+      break;
+    case OP_LIBC_DUP:
+      p = arena_alloc(a, len, 1);
+      memcpy(p, s, len);
+      break;
+    case OP_ZERO:
+      p = arena_alloc_zeroed(a, 1, len, 8);
+      break;
+    case OP_LIBC_ZERO:
+      p = arena_alloc(a, len, 8);
+      memset(p, 0, len);
+      break;
+    }
+    sink = p[len - 1];
+
+    if (i % per_round == per_round - 1)
+      arena_reset(a);
+  }
+  double elapsed = now() - start;
+
+  arena_reset(a);
+  return elapsed / ops * 1e9;
+}
+
+static void check(arena_t *a, const uint8_t *src) {
+  for (size_t len = 0; len < 5000; len += len < 300 ? 1 : 97) {
+    for (size_t off = 0; off < 64; off += 13) {
+      uint8_t *p = arena_memdup(a, src + off, len, 1);
+      if (len && memcmp(p, src + off, len) != 0) {
+        fprintf(stderr, "memdup of %zu bytes is wrong\n", len);
+        exit(EXIT_FAILURE);
+      }
+    }
+
+    // dirty the blocks so the zeroing has something to do
+    arena_reset(a);
+    for (size_t i = 0; i < 16; i++)
+      memset(arena_alloc(a, 2000, 1), 0xff, 2000);
+    arena_reset(a);
+
+    uint8_t *z = arena_alloc_zeroed(a, len, 1, 8);
+    for (size_t i = 0; i < len; i++) {
+      if (z[i]) {
+        fprintf(stderr, "zeroed array of %zu bytes is not zero\n", len);
+        exit(EXIT_FAILURE);
+      }
+    }
+    arena_reset(a);
+  }
+
+  const char *str = "GET /index.html HTTP/1.1";
+  char *d = arena_strdup(a, str);
+  char *n = arena_strndup(a, str, 3);
+  if (strcmp(d, str) != 0 || strcmp(n, "GET") != 0) {
+    fprintf(stderr, "strdup is wrong\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (arena_alloc_zeroed(a, SIZE_MAX / 2, 4, 1)) {
+    fprintf(stderr, "zeroed array size overflow not caught\n");
+    exit(EXIT_FAILURE);
+  }
+  arena_reset(a);
+}
+
+int main(void) {
+  uint8_t *src = malloc(SOURCE_SIZE);
+  for (size_t i = 0; i < SOURCE_SIZE; i++)
+    src[i] = (uint8_t)rng();
+
+  arena_t a = {};
+  check(&a, src);
+
+  printf("kernels: %s\n", arena_simd()->name);
+  printf("%8s %10s %10s %10s %10s   (ns/op)\n", "size", "memdup", "+memcpy",
+         "zeroed", "+memset");
+
+  // mostly small fragments, the big ones get their own mapping
+  size_t sizes[] = {8, 24, 64, 200, 1000, 3000, 64 << 10, 1 << 20, 8 << 20};
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    size_t len = sizes[i];
+    printf("%8zu %10.1f %10.1f %10.1f %10.1f\n", len,
+           bench(&a, src, OP_DUP, len), bench(&a, src, OP_LIBC_DUP, len),
+           bench(&a, src, OP_ZERO, len), bench(&a, src, OP_LIBC_ZERO, len));
+  }
+
+  arena_clear(&a);
+  free(src);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,295 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "arena.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// Copy, duplicate and zero helpers for arenas, with SIMD kernels picked at
+// runtime from what the CPU supports (cpuid, through
+// `__builtin_cpu_supports`).
+//
+// Two things we know that `memcpy`/`memset` don't:
+//
+// - The destination was just bumped off the current block, so everything
+//   from it up to the end of the block is ours to scribble on. Zeroing can
+//   round up to whole vectors and never needs a tail loop.
+// - Allocations that don't fit in a block get a fresh mapping, which the
+//   kernel already zeroed. Those are not filled at all.
+//
+// Copies bigger than `ARENA_SIMD_STREAM_MIN` (which are always in their own
+// mapping) use non-temporal stores so that a big duplicate doesn't push the
+// working set out of cache. The copy itself is not faster for it, most of the
+// time goes to faulting in the fresh pages, so it is only worth it past the
+// size of the caches.
+
+#ifndef ARENA_SIMD_STREAM_MIN
+#define ARENA_SIMD_STREAM_MIN ((size_t)4 << 20)
+#endif
+
+typedef void (*arena_copy_fn)(uint8_t *dst, const uint8_t *src, size_t len);
+// `room` is how many bytes after `dst` may be written, at least `len`.
+typedef void (*arena_zero_fn)(uint8_t *dst, size_t len, size_t room);
+
+typedef struct arena_simd {
+  arena_copy_fn copy;
+  arena_zero_fn zero;
+  const char *name;
+} arena_simd_t;
+
+static inline void arena_copy_scalar(uint8_t *dst, const uint8_t *src,
+                                     size_t len) {
+  memcpy(dst, src, len);
+}
+
+static inline void arena_zero_scalar(uint8_t *dst, size_t len, size_t room) {
+  (void)room;
+  memset(dst, 0, len);
+}
+
+#if defined(__x86_64__)
+
+// Up to 32 bytes with two overlapping loads and stores of the biggest size
+// that fits, no loop and no branch per byte.
+static inline void arena_copy_small(uint8_t *dst, const uint8_t *src,
+                                    size_t len) {
+  if (len >= 16) {
+    __m128i a = _mm_loadu_si128((const __m128i *)src);
+    __m128i b = _mm_loadu_si128((const __m128i *)(src + len - 16));
+    _mm_storeu_si128((__m128i *)dst, a);
+    _mm_storeu_si128((__m128i *)(dst + len - 16), b);
+  } else if (len >= 8) {
+    uint64_t a, b;
+    memcpy(&a, src, 8);
+    memcpy(&b, src + len - 8, 8);
+    memcpy(dst, &a, 8);
+    memcpy(dst + len - 8, &b, 8);
+  } else if (len >= 4) {
+    uint32_t a, b;
+    memcpy(&a, src, 4);
+    memcpy(&b, src + len - 4, 4);
+    memcpy(dst, &a, 4);
+    memcpy(dst + len - 4, &b, 4);
+  } else if (len) {
+    dst[0] = src[0];
+    dst[len / 2] = src[len / 2];
+    dst[len - 1] = src[len - 1];
+  }
+}
+
+__attribute__((target("avx2"))) static inline void
+arena_copy_stream_avx2(uint8_t *dst, const uint8_t *src, size_t len) {
+  // align the destination, streaming stores must be aligned
+  size_t head = -(uintptr_t)dst & 31;
+  arena_copy_small(dst, src, head);
+
+  size_t i = head;
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+    _mm256_stream_si256((__m256i *)(dst + i), v);
+  }
+  _mm_sfence();
+
+  if (i < len)
+    arena_copy_small(dst + i, src + i, len - i);
+}
+
+__attribute__((target("avx2"))) static inline void
+arena_copy_avx2(uint8_t *dst, const uint8_t *src, size_t len) {
+  if (len <= 32) {
+    arena_copy_small(dst, src, len);
+    return;
+  }
+  if (len >= ARENA_SIMD_STREAM_MIN) {
+    arena_copy_stream_avx2(dst, src, len);
+    return;
+  }
+
+  // whole vectors, then one more that overlaps the last one
+  size_t i = 0;
+  for (; i + 32 < len; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+    _mm256_storeu_si256((__m256i *)(dst + i), v);
+  }
+
+  __m256i last = _mm256_loadu_si256((const __m256i *)(src + len - 32));
+  _mm256_storeu_si256((__m256i *)(dst + len - 32), last);
+}
+
+__attribute__((target("avx2"))) static inline void
+arena_zero_avx2(uint8_t *dst, size_t len, size_t room) {
+  __m256i zero = _mm256_setzero_si256();
+
+  // round up to whole vectors when the block has room for them
+  size_t end = (len + 31) & ~(size_t)31;
+  if (end > room) {
+    memset(dst, 0, len);
+    return;
+  }
+
+  for (size_t i = 0; i < end; i += 32)
+    _mm256_storeu_si256((__m256i *)(dst + i), zero);
+}
+
+// Masked loads and stores don't touch bytes outside the mask, so the tail
+// (or a whole small copy) is one instruction.
+__attribute__((target("avx512f,avx512bw,bmi2"))) static inline void
+arena_copy_avx512(uint8_t *dst, const uint8_t *src, size_t len) {
+  if (len >= ARENA_SIMD_STREAM_MIN) {
+    arena_copy_stream_avx2(dst, src, len);
+    return;
+  }
+
+  // four vectors at a time, all loads before the stores
+  size_t i = 0;
+  for (; i + 256 <= len; i += 256) {
+    __m512i a = _mm512_loadu_si512((const void *)(src + i));
+    __m512i b = _mm512_loadu_si512((const void *)(src + i + 64));
+    __m512i c = _mm512_loadu_si512((const void *)(src + i + 128));
+    __m512i d = _mm512_loadu_si512((const void *)(src + i + 192));
+    _mm512_storeu_si512((void *)(dst + i), a);
+    _mm512_storeu_si512((void *)(dst + i + 64), b);
+    _mm512_storeu_si512((void *)(dst + i + 128), c);
+    _mm512_storeu_si512((void *)(dst + i + 192), d);
+  }
+  for (; i + 64 <= len; i += 64) {
+    __m512i v = _mm512_loadu_si512((const void *)(src + i));
+    _mm512_storeu_si512((void *)(dst + i), v);
+  }
+
+  if (i < len) {
+    __mmask64 m = _bzhi_u64(~0ull, (unsigned)(len - i));
+    __m512i v = _mm512_maskz_loadu_epi8(m, src + i);
+    _mm512_mask_storeu_epi8(dst + i, m, v);
+  }
+}
+
+__attribute__((target("avx512f,avx512bw,bmi2"))) static inline void
+arena_zero_avx512(uint8_t *dst, size_t len, size_t room) {
+  __m512i zero = _mm512_setzero_si512();
+
+  size_t end = (len + 63) & ~(size_t)63;
+  if (end > room) {
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64)
+      _mm512_storeu_si512((void *)(dst + i), zero);
+    if (i < len)
+      _mm512_mask_storeu_epi8(dst + i, _bzhi_u64(~0ull, (unsigned)(len - i)),
+                              zero);
+    return;
+  }
+
+  for (size_t i = 0; i < end; i += 64)
+    _mm512_storeu_si512((void *)(dst + i), zero);
+}
+
+#endif
+
+// Pick the kernels once. Threads racing on the first call all pick the same
+// table, the pointer to it is published with release and read with acquire.
+static inline const arena_simd_t *arena_simd(void) {
+  static _Atomic(const arena_simd_t *) selected;
+  const arena_simd_t *simd =
+      atomic_load_explicit(&selected, memory_order_acquire);
+  if (__builtin_expect(simd != NULL, 1))
+    return simd;
+
+  static const arena_simd_t scalar = {arena_copy_scalar, arena_zero_scalar,
+                                      "scalar"};
+  simd = &scalar;
+
+#if defined(__x86_64__)
+  static const arena_simd_t avx2 = {arena_copy_avx2, arena_zero_avx2, "avx2"};
+  static const arena_simd_t avx512 = {arena_copy_avx512, arena_zero_avx512,
+                                      "avx512"};
+
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") &&
+      __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("bmi2")) {
+    simd = &avx512;
+  } else if (__builtin_cpu_supports("avx2")) {
+    simd = &avx2;
+  }
+#endif
+
+  atomic_store_explicit(&selected, simd, memory_order_release);
+  return simd;
+}
+
+// Small sizes are the common case, they are done inline instead of through
+// the function pointer.
+static inline void arena_copy(uint8_t *dst, const uint8_t *src, size_t len) {
+#if defined(__x86_64__)
+  if (len <= 32) {
+    arena_copy_small(dst, src, len);
+    return;
+  }
+#endif
+
+  arena_simd()->copy(dst, src, len);
+}
+
+static inline void arena_zero(uint8_t *dst, size_t len, size_t room) {
+#if defined(__x86_64__)
+  if (len <= 64 && room >= 64) {
+    __m128i zero = _mm_setzero_si128();
+    _mm_storeu_si128((__m128i *)dst, zero);
+    _mm_storeu_si128((__m128i *)(dst + 16), zero);
+    _mm_storeu_si128((__m128i *)(dst + 32), zero);
+    _mm_storeu_si128((__m128i *)(dst + 48), zero);
+    return;
+  }
+#endif
+
+  arena_simd()->zero(dst, len, room);
+}
+
+static inline void *arena_memdup(arena_t *a, const void *src, size_t len,
+                                 size_t align) {
+  uint8_t *dst = (uint8_t *)arena_alloc(a, len, align);
+  if (dst)
+    arena_copy(dst, (const uint8_t *)src, len);
+
+  return dst;
+}
+
+static inline char *arena_strndup(arena_t *a, const char *s, size_t n) {
+  size_t len = strnlen(s, n);
+  char *dst = (char *)arena_alloc(a, len + 1, 1);
+  if (!dst)
+    return NULL;
+
+  arena_copy((uint8_t *)dst, (const uint8_t *)s, len);
+  dst[len] = 0;
+  return dst;
+}
+
+static inline char *arena_strdup(arena_t *a, const char *s) {
+  return arena_strndup(a, s, SIZE_MAX);
+}
+
+// Zeroed memory for `count` items of `size` bytes, `NULL` on overflow.
+static inline void *arena_alloc_zeroed(arena_t *a, size_t count, size_t size,
+                                       size_t align) {
+  size_t len;
+  if (__builtin_mul_overflow(count, size, &len))
+    return NULL;
+
+  uint8_t *dst = (uint8_t *)arena_alloc(a, len, align);
+  if (!dst)
+    return NULL;
+
+  // a fresh mapping, already zero
+  if (len + align > ARENA_MAX_BLOCK_ALLOC)
+    return dst;
+
+  // everything up to the end of the current block is free space
+  arena_zero(dst, len, a->blocks->buffer_end - dst);
+  return dst;
+}
@@ -1,3 +1,5 @@
+#pragma once
+
 #include <assert.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -13,8 +15,8 @@ typedef struct block_allocator {
   block_allocator_block_t *blocks;
 } block_allocator_t;
 
-static void ba_init(block_allocator_t *ba, uint8_t *buffer, size_t buffer_size,
-                    size_t item_size) {
+static inline void ba_init(block_allocator_t *ba, uint8_t *buffer,
+                           size_t buffer_size, size_t item_size) {
   assert(item_size >= sizeof(block_allocator_block_t));
   size_t item_count = buffer_size / item_size;
 
@@ -33,7 +35,7 @@ static void ba_init(block_allocator_t *ba, uint8_t *buffer, size_t buffer_size,
   ba->blocks = prev;
 }
 
-static void *ba_alloc(block_allocator_t *ba) {
+static inline void *ba_alloc(block_allocator_t *ba) {
   if (!ba->blocks)
     return NULL;
 
@@ -45,14 +47,14 @@ static void *ba_alloc(block_allocator_t *ba) {
   return blk;
 }
 
-static void ba_free(block_allocator_t *ba, void *ptr) {
-  uint8_t *p = ptr;
+static inline void ba_free(block_allocator_t *ba, void *ptr) {
+  uint8_t *p = (uint8_t *)ptr;
 
   // don't put in our list pointers that are not in our buffer
   if (p < ba->buffer || p > ba->buffer_end)
     return;
 
-  block_allocator_block_t *blk = ptr;
+  block_allocator_block_t *blk = (block_allocator_block_t *)ptr;
   *blk = (block_allocator_block_t){.next = ba->blocks};
   ba->blocks = blk;
 }
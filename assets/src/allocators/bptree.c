@@ -0,0 +1,268 @@
+#include "bptree.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// A per-session index: built, queried and then thrown away. The arena backed
+// B+tree against a red-black tree with a malloc per node.
+//
+// The SIMD node search is picked at runtime, `-mavx2` only skips the check.
+
+#define COUNT 1000000
+#define LOOKUPS 2000000
+#define RANGES 20000
+#define RANGE_LEN 100
+
+// --- A plain red-black tree, nodes from malloc:
+
+typedef struct rb_node {
+  struct rb_node *left;
+  struct rb_node *right;
+  struct rb_node *parent;
+  bool red;
+  uint64_t key;
+  uint64_t value;
+} rb_node_t;
+
+typedef struct rb_tree {
+  rb_node_t *root;
+} rb_tree_t;
+
+static void rb_rotate(rb_tree_t *t, rb_node_t *x, bool left) {
+  rb_node_t *y = left ? x->right : x->left;
+  rb_node_t *inner = left ? y->left : y->right;
+
+  if (left)
+    x->right = inner;
+  else
+    x->left = inner;
+  if (inner)
+    inner->parent = x;
+
+  y->parent = x->parent;
+  if (!x->parent)
+    t->root = y;
+  else if (x == x->parent->left)
+    x->parent->left = y;
+  else
+    x->parent->right = y;
+
+  if (left)
+    y->left = x;
+  else
+    y->right = x;
+  x->parent = y;
+}
+
+static void rb_insert(rb_tree_t *t, uint64_t key, uint64_t value) {
+  rb_node_t *parent = NULL, **link = &t->root;
+  while (*link) {
+    parent = *link;
+    if (key == parent->key) {
+      parent->value = value;
+      return;
+    }
+    link = key < parent->key ? &parent->left : &parent->right;
+  }
+
+  rb_node_t *n = malloc(sizeof(rb_node_t));
+  *n = (rb_node_t){.parent = parent, .red = true, .key = key, .value = value};
+  *link = n;
+
+  while (n->parent && n->parent->red) {
+    rb_node_t *p = n->parent, *g = p->parent;
+    bool p_left = p == g->left;
+    rb_node_t *uncle = p_left ? g->right : g->left;
+
+    if (uncle && uncle->red) {
+      p->red = uncle->red = false;
+      g->red = true;
+      n = g;
+      continue;
+    }
+
+    if (n == (p_left ? p->right : p->left)) {
+      rb_rotate(t, p, p_left);
+      n = p;
+      p = n->parent;
+    }
+    p->red = false;
+    g->red = true;
+    rb_rotate(t, g, !p_left);
+  }
+
+  t->root->red = false;
+}
+
+static rb_node_t *rb_lower_bound(rb_tree_t *t, uint64_t key) {
+  rb_node_t *n = t->root, *best = NULL;
+  while (n) {
+    if (n->key >= key) {
+      best = n;
+      n = n->left;
+    } else {
+      n = n->right;
+    }
+  }
+
+  return best;
+}
+
+static rb_node_t *rb_next(rb_node_t *n) {
+  if (n->right) {
+    n = n->right;
+    while (n->left)
+      n = n->left;
+    return n;
+  }
+
+  while (n->parent && n == n->parent->right)
+    n = n->parent;
+  return n->parent;
+}
+
+static void rb_free(rb_node_t *n) {
+  while (n) {
+    rb_free(n->left);
+    rb_node_t *right = n->right;
+    free(n);
+    n = right;
+  }
+}
+
+// --- The benchmark:
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+int main(void) {
+  static uint64_t keys[COUNT], sorted[COUNT], lookups[LOOKUPS];
+  uint64_t x = 88172645463325252ull;
+  for (size_t i = 0; i < COUNT; i++) {
+    x ^= x << 13, x ^= x >> 7, x ^= x << 17;
+    // unique, and never `UINT64_MAX`
+    keys[i] = (x & ~(uint64_t)0xfffff) | i;
+  }
+  for (size_t i = 0; i < LOOKUPS; i++)
+    lookups[i] = keys[(i * 7919) % COUNT];
+  memcpy(sorted, keys, sizeof(keys));
+  qsort(sorted, COUNT, sizeof(uint64_t), compare_u64);
+
+  printf("%d keys, node search: %s\n", COUNT, bptree_simd_name());
+
+  // red-black tree
+  rb_tree_t rb = {};
+  double start = now();
+  for (size_t i = 0; i < COUNT; i++)
+    rb_insert(&rb, keys[i], i);
+  double rb_build = now() - start;
+
+  uint64_t rb_sum = 0;
+  start = now();
+  for (size_t i = 0; i < LOOKUPS; i++)
+    rb_sum += rb_lower_bound(&rb, lookups[i])->value;
+  double rb_lookup = now() - start;
+
+  start = now();
+  for (size_t i = 0; i < RANGES; i++) {
+    rb_node_t *n = rb_lower_bound(&rb, lookups[i]);
+    for (size_t j = 0; n && j < RANGE_LEN; j++, n = rb_next(n))
+      rb_sum += n->key;
+  }
+  double rb_range = now() - start;
+
+  start = now();
+  rb_free(rb.root);
+  double rb_drop = now() - start;
+
+  // B+tree, inserted one by one and bulk loaded
+  arena_t arena = {};
+  bptree_t bp;
+  bptree_init(&bp, &arena, NULL);
+  start = now();
+  for (size_t i = 0; i < COUNT; i++)
+    bptree_insert(&bp, keys[i], i);
+  double bp_insert = now() - start;
+  size_t insert_nodes = bp.nodes;
+
+  // same values as the inserts, by key
+  uint64_t *values = malloc(COUNT * sizeof(uint64_t));
+  for (size_t i = 0; i < COUNT; i++)
+    bptree_find(&bp, sorted[i], &values[i]);
+  arena_clear(&arena);
+
+  bptree_init(&bp, &arena, NULL);
+  start = now();
+  bptree_bulk_load(&bp, sorted, values, COUNT);
+  double bp_build = now() - start;
+
+  uint64_t bp_sum = 0;
+  start = now();
+  for (size_t i = 0; i < LOOKUPS; i++) {
+    uint64_t value;
+    if (!bptree_find(&bp, lookups[i], &value)) {
+      fprintf(stderr, "missing key\n");
+      return EXIT_FAILURE;
+    }
+    bp_sum += value;
+  }
+  double bp_lookup = now() - start;
+
+  start = now();
+  for (size_t i = 0; i < RANGES; i++) {
+    bptree_iter_t it = bptree_seek(&bp, lookups[i]);
+    uint64_t key, value;
+    for (size_t j = 0; j < RANGE_LEN && bptree_next(&it, &key, &value); j++)
+      bp_sum += key;
+  }
+  double bp_range = now() - start;
+
+  size_t bp_mapped = 0;
+  for (arena_block_t *b = arena.blocks; b; b = b->next)
+    bp_mapped += ARENA_BLOCK_SIZE;
+
+  start = now();
+  arena_clear(&arena);
+  double bp_drop = now() - start;
+
+  if (rb_sum != bp_sum) {
+    fprintf(stderr, "the trees disagree\n");
+    return EXIT_FAILURE;
+  }
+
+  printf("rb-tree: build %6.1f ms, %d lookups %6.1f ms, %d ranges %5.1f ms, "
+         "free %5.1f ms, %5.1f MiB\n",
+         rb_build * 1e3, LOOKUPS, rb_lookup * 1e3, RANGES, rb_range * 1e3,
+         rb_drop * 1e3, COUNT * sizeof(rb_node_t) / 1048576.0);
+  printf("b+tree:  build %6.1f ms, %d lookups %6.1f ms, %d ranges %5.1f ms, "
+         "free %5.1f ms, %5.1f MiB\n",
+         bp_build * 1e3, LOOKUPS, bp_lookup * 1e3, RANGES, bp_range * 1e3,
+         bp_drop * 1e3, bp_mapped / 1048576.0);
+  printf("b+tree inserted one by one: %6.1f ms, %5.1f MiB\n", bp_insert * 1e3,
+         insert_nodes * (double)BPTREE_NODE_SIZE / 1048576.0);
+
+  // the same tree from a pool of nodes
+  size_t pool_size = (bp.nodes + 1) * BPTREE_NODE_SIZE;
+  uint8_t *pool_memory = aligned_alloc(64, pool_size);
+  block_allocator_t pool;
+  ba_init(&pool, pool_memory, pool_size, BPTREE_NODE_SIZE);
+  bptree_init(&bp, NULL, &pool);
+  if (!bptree_bulk_load(&bp, sorted, values, COUNT) ||
+      !bptree_find(&bp, sorted[COUNT / 2], &x) || x != values[COUNT / 2]) {
+    fprintf(stderr, "bad pool tree\n");
+    return EXIT_FAILURE;
+  }
+  free(pool_memory);
+  free(values);
+
+  return EXIT_SUCCESS;
+}
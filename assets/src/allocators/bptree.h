@@ -0,0 +1,461 @@
+#pragma once
+
+#include <assert.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "arena.h"
+#include "block_allocator.h"
+
+// A B+tree of `uint64_t` keys and values, with nodes from an arena.
+//
+// Made for indexes that are built, queried and thrown away all at once: the
+// nodes come from an `arena_t` (or a `block_allocator_t` of 512 byte blocks)
+// and are never freed one by one, dropping the tree is clearing the arena.
+// There is no delete.
+//
+// Every node is 512 bytes, 8 cache lines, with room for 28 keys. Unused key
+// slots hold `UINT64_MAX`, so a search compares all 28 keys without looking
+// at the count, 4 at a time with AVX2 when the CPU has it (checked once at
+// runtime, or not at all when built with `-mavx2`). `UINT64_MAX` can't be used
+// as a key.
+//
+// Values are only in the leaves, which are linked left to right for range
+// scans. Separators in inner nodes are the smallest key of the child to their
+// right.
+
+#define BPTREE_KEYS 28
+#define BPTREE_NODE_SIZE 512
+
+typedef struct bptree_node {
+  uint32_t count;
+  bool leaf;
+  uint64_t keys[BPTREE_KEYS];
+  union {
+    struct {
+      uint64_t values[BPTREE_KEYS];
+      struct bptree_node *next;
+    };
+    struct bptree_node *children[BPTREE_KEYS + 1];
+  };
+} bptree_node_t;
+
+static_assert(sizeof(bptree_node_t) <= BPTREE_NODE_SIZE,
+              "bptree node too big");
+
+typedef struct bptree {
+  bptree_node_t *root;
+  size_t count;
+  size_t nodes;
+  // levels, 0 when empty
+  size_t height;
+
+  // nodes taken ahead of time by `bptree_insert`, linked through `next`
+  bptree_node_t *spare;
+  size_t spare_count;
+
+  // where nodes come from, the pool if set
+  arena_t *arena;
+  block_allocator_t *pool;
+} bptree_t;
+
+typedef struct bptree_iter {
+  bptree_node_t *leaf;
+  uint32_t index;
+} bptree_iter_t;
+
+static inline void bptree_init(bptree_t *t, arena_t *arena,
+                               block_allocator_t *pool) {
+  *t = (bptree_t){.arena = arena, .pool = pool};
+}
+
+static inline bptree_node_t *bptree_alloc_node(bptree_t *t) {
+  return t->pool
+             ? (bptree_node_t *)ba_alloc(t->pool)
+             : (bptree_node_t *)arena_alloc(t->arena, BPTREE_NODE_SIZE, 64);
+}
+
+static inline bptree_node_t *bptree_new_node(bptree_t *t, bool leaf) {
+  bptree_node_t *n = t->spare;
+  if (n) {
+    t->spare = n->next;
+    t->spare_count--;
+  } else if (!(n = bptree_alloc_node(t))) {
+    return NULL;
+  }
+
+  n->count = 0;
+  n->leaf = leaf;
+  memset(n->keys, 0xff, sizeof(n->keys));
+  if (leaf)
+    n->next = NULL;
+
+  t->nodes++;
+  return n;
+}
+
+// --- Searching a node:
+
+static inline uint32_t bptree_count_less_scalar(const bptree_node_t *n,
+                                                uint64_t key) {
+  uint32_t count = 0;
+  for (size_t i = 0; i < BPTREE_KEYS; i++)
+    count += n->keys[i] < key;
+
+  return count;
+}
+
+static inline uint32_t bptree_count_less_equal_scalar(const bptree_node_t *n,
+                                                      uint64_t key) {
+  uint32_t count = 0;
+  for (size_t i = 0; i < BPTREE_KEYS; i++)
+    count += n->keys[i] <= key;
+
+  return count;
+}
+
+#if defined(__x86_64__)
+
+// Unsigned compares, with the sign bit flipped for the signed instruction.
+__attribute__((target("avx2"))) static inline __m256i bptree_flip(__m256i v) {
+  return _mm256_xor_si256(v, _mm256_set1_epi64x((int64_t)0x8000000000000000));
+}
+
+// How many keys are less than `key`.
+__attribute__((target("avx2"))) static inline uint32_t
+bptree_count_less_avx2(const bptree_node_t *n, uint64_t key) {
+  __m256i k = bptree_flip(_mm256_set1_epi64x((int64_t)key));
+  uint32_t count = 0;
+  for (size_t i = 0; i < BPTREE_KEYS; i += 4) {
+    __m256i v =
+        bptree_flip(_mm256_loadu_si256((const __m256i *)(n->keys + i)));
+    __m256i less = _mm256_cmpgt_epi64(k, v);
+    count += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(less)));
+  }
+
+  return count;
+}
+
+// How many keys are less than or equal to `key`.
+__attribute__((target("avx2"))) static inline uint32_t
+bptree_count_less_equal_avx2(const bptree_node_t *n, uint64_t key) {
+  __m256i k = bptree_flip(_mm256_set1_epi64x((int64_t)key));
+  uint32_t greater = 0;
+  for (size_t i = 0; i < BPTREE_KEYS; i += 4) {
+    __m256i v =
+        bptree_flip(_mm256_loadu_si256((const __m256i *)(n->keys + i)));
+    __m256i more = _mm256_cmpgt_epi64(v, k);
+    greater +=
+        __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(more)));
+  }
+
+  return BPTREE_KEYS - greater;
+}
+
+#endif
+
+// Whether to use the AVX2 search, like `arena_simd` asks the CPU once. Built
+// with AVX2 this is a constant and the check goes away.
+static inline bool bptree_avx2(void) {
+#if defined(__AVX2__)
+  return true;
+#elif defined(__x86_64__)
+  // -1 until checked, threads racing on the first call store the same answer
+  static atomic_int avx2 = -1;
+  int supported = atomic_load_explicit(&avx2, memory_order_acquire);
+  if (__builtin_expect(supported < 0, 0)) {
+    __builtin_cpu_init();
+    supported = __builtin_cpu_supports("avx2") != 0;
+    atomic_store_explicit(&avx2, supported, memory_order_release);
+  }
+  return supported;
+#else
+  return false;
+#endif
+}
+
+static inline const char *bptree_simd_name(void) {
+  return bptree_avx2() ? "avx2" : "scalar";
+}
+
+static inline uint32_t bptree_count_less(const bptree_node_t *n,
+                                         uint64_t key) {
+#if defined(__x86_64__)
+  if (bptree_avx2())
+    return bptree_count_less_avx2(n, key);
+#endif
+  return bptree_count_less_scalar(n, key);
+}
+
+static inline uint32_t bptree_count_less_equal(const bptree_node_t *n,
+                                               uint64_t key) {
+#if defined(__x86_64__)
+  if (bptree_avx2())
+    return bptree_count_less_equal_avx2(n, key);
+#endif
+  return bptree_count_less_equal_scalar(n, key);
+}
+
+static inline bptree_node_t *bptree_find_leaf(const bptree_t *t,
+                                              uint64_t key) {
+  bptree_node_t *n = t->root;
+  while (n && !n->leaf)
+    n = n->children[bptree_count_less_equal(n, key)];
+
+  return n;
+}
+
+static inline bool bptree_find(const bptree_t *t, uint64_t key,
+                               uint64_t *value) {
+  bptree_node_t *n = bptree_find_leaf(t, key);
+  if (!n)
+    return false;
+
+  uint32_t i = bptree_count_less(n, key);
+  if (i == n->count || n->keys[i] != key)
+    return false;
+
+  *value = n->values[i];
+  return true;
+}
+
+// --- Range iteration:
+
+// An iterator at the first key not less than `key`.
+static inline bptree_iter_t bptree_seek(const bptree_t *t, uint64_t key) {
+  bptree_node_t *n = bptree_find_leaf(t, key);
+  bptree_iter_t it = {n, n ? bptree_count_less(n, key) : 0};
+  return it;
+}
+
+static inline bool bptree_next(bptree_iter_t *it, uint64_t *key,
+                               uint64_t *value) {
+  while (it->leaf && it->index == it->leaf->count) {
+    it->leaf = it->leaf->next;
+    it->index = 0;
+  }
+  if (!it->leaf)
+    return false;
+
+  *key = it->leaf->keys[it->index];
+  *value = it->leaf->values[it->index];
+  it->index++;
+  return true;
+}
+
+// --- Building:
+
+// Build from `count` keys in strictly increasing order, into an empty tree.
+// Leaves and inner nodes are filled up completely, later inserts will split
+// them.
+static inline bool bptree_bulk_load(bptree_t *t, const uint64_t *keys,
+                                    const uint64_t *values, size_t count) {
+  if (!count)
+    return true;
+
+  // one level at a time, each node with the smallest key under it
+  size_t level_count = (count + BPTREE_KEYS - 1) / BPTREE_KEYS;
+  bptree_node_t **level =
+      (bptree_node_t **)malloc(level_count * sizeof(bptree_node_t *));
+  uint64_t *mins = (uint64_t *)malloc(level_count * sizeof(uint64_t));
+  bool ok = level && mins;
+
+  size_t height = 1;
+  bptree_node_t *prev = NULL;
+  for (size_t i = 0; ok && i < level_count; i++) {
+    bptree_node_t *n = bptree_new_node(t, true);
+    ok = n != NULL;
+    if (!ok)
+      break;
+
+    size_t start = i * BPTREE_KEYS;
+    n->count = count - start < BPTREE_KEYS ? count - start : BPTREE_KEYS;
+    memcpy(n->keys, keys + start, n->count * sizeof(uint64_t));
+    memcpy(n->values, values + start, n->count * sizeof(uint64_t));
+    if (prev)
+      prev->next = n;
+    prev = n;
+
+    level[i] = n;
+    mins[i] = keys[start];
+  }
+
+  while (ok && level_count > 1) {
+    size_t parents = (level_count + BPTREE_KEYS) / (BPTREE_KEYS + 1);
+    for (size_t i = 0; i < parents; i++) {
+      bptree_node_t *n = bptree_new_node(t, false);
+      ok = n != NULL;
+      if (!ok)
+        break;
+
+      size_t start = i * (BPTREE_KEYS + 1);
+      size_t end = start + BPTREE_KEYS + 1;
+      if (end > level_count)
+        end = level_count;
+
+      n->children[0] = level[start];
+      for (size_t j = start + 1; j < end; j++) {
+        n->keys[n->count] = mins[j];
+        n->children[++n->count] = level[j];
+      }
+
+      // in place, the parents are written behind what we read
+      uint64_t min = mins[start];
+      level[i] = n;
+      mins[i] = min;
+    }
+
+    level_count = parents;
+    height++;
+  }
+
+  if (ok) {
+    t->root = level[0];
+    t->count = count;
+    t->height = height;
+  }
+
+  free(level);
+  free(mins);
+  return ok;
+}
+
+// Insert into `n`, and if it had to split, return the new right half and the
+// key that separates it in `split_key`. The nodes for the splits are already
+// in `t->spare`.
+static inline bptree_node_t *bptree_insert_into(bptree_t *t, bptree_node_t *n,
+                                                uint64_t key, uint64_t value,
+                                                uint64_t *split_key) {
+  uint32_t i;
+  bptree_node_t *child = NULL;
+
+  if (n->leaf) {
+    i = bptree_count_less(n, key);
+    if (i < n->count && n->keys[i] == key) {
+      n->values[i] = value;
+      return NULL;
+    }
+  } else {
+    // a split below gives us a separator and a child to its right
+    i = bptree_count_less_equal(n, key);
+    child = bptree_insert_into(t, n->children[i], key, value, &key);
+    if (!child)
+      return NULL;
+  }
+
+  bptree_node_t *half = NULL;
+  if (n->count == BPTREE_KEYS) {
+    half = bptree_new_node(t, n->leaf);
+    assert(half);
+  }
+  if (n->leaf)
+    t->count++;
+
+  if (!half) {
+    memmove(n->keys + i + 1, n->keys + i, (n->count - i) * sizeof(uint64_t));
+    n->keys[i] = key;
+    if (n->leaf) {
+      memmove(n->values + i + 1, n->values + i,
+              (n->count - i) * sizeof(uint64_t));
+      n->values[i] = value;
+    } else {
+      memmove(n->children + i + 2, n->children + i + 1,
+              (n->count - i) * sizeof(bptree_node_t *));
+      n->children[i + 1] = child;
+    }
+    n->count++;
+    return NULL;
+  }
+
+  // full, lay out everything with the new entry in place and deal it out
+  // between the two halves
+  uint64_t keys[BPTREE_KEYS + 1];
+  memcpy(keys, n->keys, i * sizeof(uint64_t));
+  keys[i] = key;
+  memcpy(keys + i + 1, n->keys + i, (BPTREE_KEYS - i) * sizeof(uint64_t));
+  memset(n->keys, 0xff, sizeof(n->keys));
+
+  if (n->leaf) {
+    uint64_t values[BPTREE_KEYS + 1];
+    memcpy(values, n->values, i * sizeof(uint64_t));
+    values[i] = value;
+    memcpy(values + i + 1, n->values + i,
+           (BPTREE_KEYS - i) * sizeof(uint64_t));
+
+    uint32_t left = (BPTREE_KEYS + 1) / 2;
+    n->count = left;
+    half->count = BPTREE_KEYS + 1 - left;
+    memcpy(n->keys, keys, left * sizeof(uint64_t));
+    memcpy(n->values, values, left * sizeof(uint64_t));
+    memcpy(half->keys, keys + left, half->count * sizeof(uint64_t));
+    memcpy(half->values, values + left, half->count * sizeof(uint64_t));
+
+    half->next = n->next;
+    n->next = half;
+    *split_key = half->keys[0];
+    return half;
+  }
+
+  bptree_node_t *children[BPTREE_KEYS + 2];
+  memcpy(children, n->children, (i + 1) * sizeof(bptree_node_t *));
+  children[i + 1] = child;
+  memcpy(children + i + 2, n->children + i + 1,
+         (BPTREE_KEYS - i) * sizeof(bptree_node_t *));
+
+  // the middle key moves up instead of staying in either half
+  uint32_t left = (BPTREE_KEYS + 1) / 2;
+  n->count = left;
+  half->count = BPTREE_KEYS - left;
+  memcpy(n->keys, keys, left * sizeof(uint64_t));
+  memcpy(n->children, children, (left + 1) * sizeof(bptree_node_t *));
+  memcpy(half->keys, keys + left + 1, half->count * sizeof(uint64_t));
+  memcpy(half->children, children + left + 1,
+         (half->count + 1) * sizeof(bptree_node_t *));
+
+  *split_key = keys[left];
+  return half;
+}
+
+// Insert or replace. Returns false if out of memory, the tree is then left as
+// it was.
+static inline bool bptree_insert(bptree_t *t, uint64_t key, uint64_t value) {
+  // a split can go all the way up and add a root, one node per level and one
+  // more: get them before changing anything
+  while (t->spare_count < t->height + 1) {
+    bptree_node_t *n = bptree_alloc_node(t);
+    if (!n)
+      return false;
+
+    n->next = t->spare;
+    t->spare = n;
+    t->spare_count++;
+  }
+
+  if (!t->root) {
+    t->root = bptree_new_node(t, true);
+    t->height = 1;
+  }
+
+  uint64_t split_key;
+  bptree_node_t *right = bptree_insert_into(t, t->root, key, value, &split_key);
+  if (!right)
+    return true;
+
+  bptree_node_t *root = bptree_new_node(t, false);
+  root->count = 1;
+  root->keys[0] = split_key;
+  root->children[0] = t->root;
+  root->children[1] = right;
+  t->root = root;
+  t->height++;
+  return true;
+}
@@ -0,0 +1,113 @@
+#include "buddy.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Medium sized buffers (1 KiB to 1 MiB) with random lifetimes, from the buddy
+// allocator and from malloc.
+
+#define LIVE_SLOTS 256
+#define ITERATIONS 2000000
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Sizes spread evenly over the orders, like our buffers.
+static size_t random_size(void) {
+  unsigned order = 10 + rand() % 11;
+  return (1ull << order) - rand() % (1ull << (order - 1));
+}
+
+int main(void) {
+  static uint8_t buffer[1 << 16];
+
+  buddy_t b;
+  buddy_init(&b, buffer, sizeof(buffer), 10);
+
+  void *a0 = buddy_alloc(&b, 1000);
+  void *a1 = buddy_alloc(&b, 1000);
+  void *a2 = buddy_alloc(&b, 5000);
+  printf("buffer=%p, a0=+%td, a1=+%td, a2=+%td\n", buffer,
+         (uint8_t *)a0 - buffer, (uint8_t *)a1 - buffer,
+         (uint8_t *)a2 - buffer);
+
+  // the first block holds the bookkeeping. a1 merges back with its free
+  // buddy, so a 2 KiB block fits where it was
+  buddy_free(&b, a0);
+  buddy_free(&b, a1);
+  void *a3 = buddy_alloc(&b, 2048);
+  printf("a3=+%td\n", (uint8_t *)a3 - buffer);
+  buddy_free(&b, a2);
+  buddy_free(&b, a3);
+
+  buddy_t big;
+  if (!buddy_init_mmap(&big, 30, 10)) {
+    perror("buddy_init_mmap");
+    return EXIT_FAILURE;
+  }
+
+  static void *slots[LIVE_SLOTS];
+  static size_t sizes[LIVE_SLOTS];
+
+  srand(1);
+  double start = now();
+  for (size_t i = 0; i < ITERATIONS; i++) {
+    size_t s = rand() % LIVE_SLOTS;
+    if (slots[s]) {
+      buddy_free(&big, slots[s]);
+      slots[s] = NULL;
+    } else {
+      sizes[s] = random_size();
+      slots[s] = buddy_alloc(&big, sizes[s]);
+      if (!slots[s]) {
+        fprintf(stderr, "out of memory\n");
+        return EXIT_FAILURE;
+      }
+      // touch the ends, the blocks must not overlap
+      ((uint8_t *)slots[s])[0] = (uint8_t)s;
+      ((uint8_t *)slots[s])[sizes[s] - 1] = (uint8_t)s;
+    }
+  }
+  printf("buddy:  %6.1f ns/op\n", (now() - start) * 1e9 / ITERATIONS);
+
+  for (size_t s = 0; s < LIVE_SLOTS; s++) {
+    if (slots[s] && (((uint8_t *)slots[s])[0] != (uint8_t)s ||
+                     ((uint8_t *)slots[s])[sizes[s] - 1] != (uint8_t)s)) {
+      fprintf(stderr, "corrupted block %zu\n", s);
+      return EXIT_FAILURE;
+    }
+    buddy_free(&big, slots[s]);
+    slots[s] = NULL;
+  }
+
+  // everything merged back, so the biggest free block is half the region
+  void *half = buddy_alloc(&big, 1ull << 29);
+  printf("half of the region after freeing everything: %s\n",
+         half ? "ok" : "fragmented");
+  buddy_deinit(&big);
+
+  srand(1);
+  start = now();
+  for (size_t i = 0; i < ITERATIONS; i++) {
+    size_t s = rand() % LIVE_SLOTS;
+    if (slots[s]) {
+      free(slots[s]);
+      slots[s] = NULL;
+    } else {
+      sizes[s] = random_size();
+      slots[s] = malloc(sizes[s]);
+      ((uint8_t *)slots[s])[0] = (uint8_t)s;
+      ((uint8_t *)slots[s])[sizes[s] - 1] = (uint8_t)s;
+    }
+  }
+  printf("malloc: %6.1f ns/op\n", (now() - start) * 1e9 / ITERATIONS);
+
+  for (size_t s = 0; s < LIVE_SLOTS; s++)
+    free(slots[s]);
+
+  return EXIT_SUCCESS;
+}
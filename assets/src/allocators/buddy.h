@@ -0,0 +1,216 @@
+#pragma once
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// Align up the given integer to the given alignment.
+#define ALIGN_TO(_value, _alignment)                                           \
+  ((_value) + ((_alignment) - 1) & -(_alignment))
+
+// A buddy allocator.
+//
+// Manages a power of two region, handing out blocks of power of two sizes.
+// When a block is too big it is split in half (the two halves are "buddies"),
+// and when a block is freed it merges with its buddy if that one is free too.
+// Both take at most one step per order, so O(log n).
+//
+// Each order has a doubly linked free list (stored in the free blocks
+// themselves) and a bitmap saying which blocks of that order are in it. A mask
+// of non-empty lists finds the smallest usable order with a single bit scan.
+//
+// All of the bookkeeping lives at the start of the region, which is marked as
+// allocated on init.
+
+#define BUDDY_MAX_ORDERS 48
+
+typedef struct buddy_block {
+  struct buddy_block *next;
+  struct buddy_block *prev;
+} buddy_block_t;
+
+typedef struct buddy {
+  uint8_t *buffer;
+  uint8_t *buffer_end;
+  unsigned min_order;
+  unsigned max_order;
+  bool mapped;
+
+  // bit `k - min_order` is set when `free_lists[k - min_order]` is not empty
+  uint64_t nonempty;
+  buddy_block_t *free_lists[BUDDY_MAX_ORDERS];
+  uint64_t *free_bits[BUDDY_MAX_ORDERS];
+
+  // order of every allocation, indexed by the min sized block it starts at
+  uint8_t *orders;
+} buddy_t;
+
+static inline unsigned buddy_log2_ceil(size_t size) {
+  return size <= 1 ? 0 : 64 - __builtin_clzll(size - 1);
+}
+
+static inline size_t buddy_index(buddy_t *b, uint8_t *ptr, unsigned order) {
+  return (size_t)(ptr - b->buffer) >> order;
+}
+
+static inline bool buddy_bit(buddy_t *b, unsigned order, size_t i) {
+  return b->free_bits[order - b->min_order][i / 64] >> (i % 64) & 1;
+}
+
+static inline void buddy_push(buddy_t *b, uint8_t *ptr, unsigned order) {
+  unsigned k = order - b->min_order;
+  size_t i = buddy_index(b, ptr, order);
+
+  buddy_block_t *blk = (buddy_block_t *)ptr;
+  *blk = (buddy_block_t){.next = b->free_lists[k], .prev = NULL};
+  if (blk->next)
+    blk->next->prev = blk;
+
+  b->free_lists[k] = blk;
+  b->free_bits[k][i / 64] |= 1ull << (i % 64);
+  b->nonempty |= 1ull << k;
+}
+
+static inline void buddy_remove(buddy_t *b, uint8_t *ptr, unsigned order) {
+  unsigned k = order - b->min_order;
+  size_t i = buddy_index(b, ptr, order);
+
+  buddy_block_t *blk = (buddy_block_t *)ptr;
+  if (blk->prev)
+    blk->prev->next = blk->next;
+  else
+    b->free_lists[k] = blk->next;
+  if (blk->next)
+    blk->next->prev = blk->prev;
+
+  b->free_bits[k][i / 64] &= ~(1ull << (i % 64));
+  if (!b->free_lists[k])
+    b->nonempty &= ~(1ull << k);
+}
+
+// Set up the allocator in the largest power of two that fits in `buffer`,
+// with blocks of at least `1 << min_order` bytes. Returns false if the buffer
+// is too small to even hold the bookkeeping.
+static bool buddy_init(buddy_t *b, uint8_t *buffer, size_t buffer_size,
+                       unsigned min_order) {
+  assert((1ull << min_order) >= sizeof(buddy_block_t));
+  if (buffer_size < (1ull << min_order))
+    return false;
+
+  unsigned max_order = 63 - __builtin_clzll(buffer_size);
+  if (max_order - min_order >= BUDDY_MAX_ORDERS)
+    return false;
+
+  *b = (buddy_t){
+      .buffer = buffer,
+      .buffer_end = buffer + (1ull << max_order),
+      .min_order = min_order,
+      .max_order = max_order,
+  };
+
+  // the bookkeeping goes at the start of the region
+  size_t min_blocks = 1ull << (max_order - min_order);
+  size_t meta = min_blocks;
+  for (unsigned k = min_order; k <= max_order; k++)
+    meta = ALIGN_TO(meta, 8) + ((min_blocks >> (k - min_order)) + 63) / 64 * 8;
+  meta = ALIGN_TO(meta, 1ull << min_order);
+  if (meta >= (1ull << max_order))
+    return false;
+
+  memset(buffer, 0, meta);
+  b->orders = buffer;
+
+  size_t offset = min_blocks;
+  for (unsigned k = min_order; k <= max_order; k++) {
+    offset = ALIGN_TO(offset, 8);
+    b->free_bits[k - min_order] = (uint64_t *)(buffer + offset);
+    offset += ((min_blocks >> (k - min_order)) + 63) / 64 * 8;
+  }
+
+  // free everything after it, in the largest aligned blocks that fit
+  for (size_t off = meta; off < (1ull << max_order);) {
+    unsigned order = __builtin_ctzll(off);
+    buddy_push(b, buffer + off, order);
+    off += 1ull << order;
+  }
+
+  return true;
+}
+
+// Same as `buddy_init`, but for a fresh `1 << max_order` mapping.
+static bool buddy_init_mmap(buddy_t *b, unsigned max_order,
+                            unsigned min_order) {
+  size_t size = 1ull << max_order;
+  uint8_t *buffer = (uint8_t *)mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                    MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  if (buffer == MAP_FAILED)
+    return false;
+
+  if (!buddy_init(b, buffer, size, min_order)) {
+    munmap(buffer, size);
+    return false;
+  }
+
+  b->mapped = true;
+  return true;
+}
+
+static void buddy_deinit(buddy_t *b) {
+  if (b->mapped)
+    munmap(b->buffer, b->buffer_end - b->buffer);
+
+  *b = (buddy_t){};
+}
+
+static void *buddy_alloc(buddy_t *b, size_t size) {
+  unsigned order = buddy_log2_ceil(size);
+  if (order < b->min_order)
+    order = b->min_order;
+  if (order > b->max_order)
+    return NULL;
+
+  // the smallest non-empty list that is big enough
+  uint64_t usable = b->nonempty >> (order - b->min_order);
+  if (!usable)
+    return NULL;
+
+  unsigned k = order + __builtin_ctzll(usable);
+  uint8_t *ptr = (uint8_t *)b->free_lists[k - b->min_order];
+  buddy_remove(b, ptr, k);
+
+  // split it down, giving the upper halves back
+  while (k > order) {
+    k--;
+    buddy_push(b, ptr + (1ull << k), k);
+  }
+
+  b->orders[buddy_index(b, ptr, b->min_order)] = (uint8_t)order;
+  return ptr;
+}
+
+static void buddy_free(buddy_t *b, void *ptr) {
+  uint8_t *p = (uint8_t *)ptr;
+
+  // don't put in our lists pointers that are not in our buffer
+  if (p < b->buffer || p >= b->buffer_end)
+    return;
+
+  unsigned order = b->orders[buddy_index(b, p, b->min_order)];
+
+  // merge with the buddy for as long as it is free
+  while (order < b->max_order) {
+    uint8_t *buddy = b->buffer + ((size_t)(p - b->buffer) ^ (1ull << order));
+    if (!buddy_bit(b, order, buddy_index(b, buddy, order)))
+      break;
+
+    buddy_remove(b, buddy, order);
+    if (buddy < p)
+      p = buddy;
+    order++;
+  }
+
+  buddy_push(b, p, order);
+}
@@ -0,0 +1,160 @@
+#include "arena.h"
+#include "compact_arena.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// The same binary search tree twice: once with regular pointers in an
+// `arena_t`, once with compressed pointers in a `compact_arena_t`. Lookups of
+// random keys chase one pointer per level, so the smaller nodes mean more of
+// the tree fits in cache.
+
+#define NODES (1 << 20)
+#define LOOKUPS (1 << 20)
+
+typedef struct node {
+  uint32_t key;
+  uint32_t value;
+  struct node *left;
+  struct node *right;
+} node_t;
+
+typedef struct cnode {
+  uint32_t key;
+  uint32_t value;
+  cptr_t left;
+  cptr_t right;
+} cnode_t;
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15;
+
+static uint32_t rng(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return (uint32_t)rng_state;
+}
+
+static node_t *insert(arena_t *a, node_t *root, uint32_t key) {
+  node_t **link = &root;
+  while (*link) {
+    if (key == (*link)->key)
+      return root;
+    link = key < (*link)->key ? &(*link)->left : &(*link)->right;
+  }
+
+  node_t *n = arena_alloc(a, sizeof(*n), _Alignof(node_t));
+  *n = (node_t){.key = key, .value = ~key};
+  *link = n;
+  return root;
+}
+
+static uint32_t lookup(node_t *n, uint32_t key) {
+  while (n) {
+    if (key == n->key)
+      return n->value;
+    n = key < n->key ? n->left : n->right;
+  }
+
+  return 0;
+}
+
+static cptr_t cinsert(compact_arena_t *c, cptr_t root, uint32_t key) {
+  cptr_t *link = &root;
+  while (*link) {
+    cnode_t *n = cptr_decompress_nonnull(c, *link);
+    if (key == n->key)
+      return root;
+    link = key < n->key ? &n->left : &n->right;
+  }
+
+  // the link may be inside a node, compute the new one before storing
+  cptr_t p = compact_arena_alloc_cptr(c, sizeof(cnode_t), _Alignof(cnode_t));
+  cnode_t *n = cptr_decompress_nonnull(c, p);
+  *n = (cnode_t){.key = key, .value = ~key};
+  *link = p;
+  return root;
+}
+
+static uint32_t clookup(compact_arena_t *c, cptr_t p, uint32_t key) {
+  while (p) {
+    cnode_t *n = cptr_decompress_nonnull(c, p);
+    if (key == n->key)
+      return n->value;
+    p = key < n->key ? n->left : n->right;
+  }
+
+  return 0;
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(void) {
+  uint32_t *keys = malloc(sizeof(*keys) * NODES);
+  for (size_t i = 0; i < NODES; i++)
+    keys[i] = rng() | 1;
+
+  // 4 byte granules, a 16 GiB region
+  compact_arena_t c;
+  if (!compact_arena_init(&c, (size_t)16 << 30, 2)) {
+    perror("mmap");
+    return EXIT_FAILURE;
+  }
+
+  arena_t a = {};
+  node_t *root = NULL;
+  cptr_t croot = CPTR_NULL;
+
+  double start = now();
+  for (size_t i = 0; i < NODES; i++)
+    root = insert(&a, root, keys[i]);
+  double build = now() - start;
+
+  start = now();
+  for (size_t i = 0; i < NODES; i++)
+    croot = cinsert(&c, croot, keys[i]);
+  double cbuild = now() - start;
+
+  // the same random keys in both, half of them present
+  uint32_t found = 0;
+  uint64_t saved = rng_state;
+  start = now();
+  for (size_t i = 0; i < LOOKUPS; i++) {
+    uint32_t k = rng() & 1 ? keys[rng() % NODES] : rng() & ~1u;
+    found += lookup(root, k) != 0;
+  }
+  double search = now() - start;
+
+  uint32_t cfound = 0;
+  rng_state = saved;
+  start = now();
+  for (size_t i = 0; i < LOOKUPS; i++) {
+    uint32_t k = rng() & 1 ? keys[rng() % NODES] : rng() & ~1u;
+    cfound += clookup(&c, croot, k) != 0;
+  }
+  double csearch = now() - start;
+
+  if (found != cfound) {
+    fprintf(stderr, "trees disagree: %u vs %u\n", found, cfound);
+    return EXIT_FAILURE;
+  }
+
+  size_t cused = c.head - c.base;
+  printf("pointers:   %2zu byte nodes, build %6.1f ms, %5.1f ns/lookup\n",
+         sizeof(node_t), build * 1e3, search / LOOKUPS * 1e9);
+  printf("compressed: %2zu byte nodes, build %6.1f ms, %5.1f ns/lookup, "
+         "%.1f MiB used\n",
+         sizeof(cnode_t), cbuild * 1e3, csearch / LOOKUPS * 1e9,
+         cused / (1024.0 * 1024.0));
+
+  compact_arena_deinit(&c);
+  arena_clear(&a);
+  free(keys);
+
+  return EXIT_SUCCESS;
+}
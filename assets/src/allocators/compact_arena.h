@@ -0,0 +1,111 @@
+#pragma once
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+// Align up the given integer to the given alignment.
+#define ALIGN_TO(_value, _alignment)                                           \
+  ((_value) + ((_alignment) - 1) & -(_alignment))
+
+// An arena over a single reserved region, so that anything in it can be
+// addressed by a 32 bit offset from the start instead of a 64 bit pointer.
+//
+// The offset counts granules of `1 << shift` bytes: with a shift of 0 the
+// region can be 4 GiB, with a shift of 3 (every allocation aligned to 8) it
+// can be 32 GiB. The whole region is reserved up front with `MAP_NORESERVE`,
+// the kernel only backs the pages we actually touch.
+//
+// Offset 0 is the null pointer, the first granule is never handed out.
+
+// A compressed pointer.
+typedef uint32_t cptr_t;
+
+#define CPTR_NULL ((cptr_t)0)
+#define COMPACT_ARENA_MAX_SHIFT 3
+
+typedef struct compact_arena {
+  uint8_t *base;
+  uint8_t *head;
+  uint8_t *end;
+  unsigned shift;
+} compact_arena_t;
+
+// Reserve `size` bytes (rounded down to what 32 bits of granules can reach)
+// with granules of `1 << shift` bytes.
+static inline bool compact_arena_init(compact_arena_t *c, size_t size,
+                                      unsigned shift) {
+  assert(shift <= COMPACT_ARENA_MAX_SHIFT);
+
+  size_t max_size = (size_t)UINT32_MAX << shift;
+  if (size > max_size)
+    size = max_size;
+
+  uint8_t *base =
+      (uint8_t *)mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+  if (base == MAP_FAILED)
+    return false;
+
+  *c = (compact_arena_t){
+      .base = base,
+      .head = base + ((size_t)1 << shift),
+      .end = base + size,
+      .shift = shift,
+  };
+  return true;
+}
+
+static inline void compact_arena_deinit(compact_arena_t *c) {
+  munmap(c->base, c->end - c->base);
+  *c = (compact_arena_t){};
+}
+
+// Free all allocations. The pages we touched are given back to the kernel,
+// the reservation stays.
+static inline void compact_arena_reset(compact_arena_t *c) {
+  madvise(c->base, c->head - c->base, MADV_DONTNEED);
+  c->head = c->base + ((size_t)1 << c->shift);
+}
+
+// Alignment is at least the granule size, or the offset would not fit.
+static inline void *compact_arena_alloc(compact_arena_t *c, size_t size,
+                                        size_t align) {
+  size_t granule = (size_t)1 << c->shift;
+  if (align < granule)
+    align = granule;
+
+  uint8_t *head = (uint8_t *)ALIGN_TO((uintptr_t)c->head, align);
+  if (head > c->end || size > (size_t)(c->end - head))
+    return NULL;
+
+  c->head = head + ALIGN_TO(size, granule);
+  return head;
+}
+
+static inline cptr_t cptr_compress(compact_arena_t *c, void *ptr) {
+  if (!ptr)
+    return CPTR_NULL;
+
+  return (cptr_t)((size_t)((uint8_t *)ptr - c->base) >> c->shift);
+}
+
+static inline void *cptr_decompress(compact_arena_t *c, cptr_t p) {
+  if (p == CPTR_NULL)
+    return NULL;
+
+  return c->base + ((size_t)p << c->shift);
+}
+
+// When the caller already knows `p` is not null, a single shift and add.
+static inline void *cptr_decompress_nonnull(compact_arena_t *c, cptr_t p) {
+  return c->base + ((size_t)p << c->shift);
+}
+
+// Allocate and return the compressed pointer directly.
+static inline cptr_t compact_arena_alloc_cptr(compact_arena_t *c, size_t size,
+                                              size_t align) {
+  return cptr_compress(c, compact_arena_alloc(c, size, align));
+}
@@ -0,0 +1,119 @@
+#include "compose.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// "pool for 64-byte objects, arena for everything else, mmap above 1 MiB"
+ALLOC_SEGREGATOR(small, 64, pool, arena)
+ALLOC_SEGREGATOR(server, 1 << 20, small, mmap_alloc)
+
+// a fixed buffer on the stack, spilling into an arena
+ALLOC_FALLBACK(scratch, fba, arena)
+
+// size classes of 16, 32, 64 and 128 bytes
+ALLOC_BUCKETIZER(classes, pool, 16, 4)
+
+// every allocation tagged with its size and followed by a canary
+typedef struct tag {
+  size_t size;
+} tag_t;
+
+typedef struct canary {
+  uint32_t value;
+} canary_t;
+
+ALLOC_AFFIX(tagged, arena, tag_t, canary_t)
+
+#define ITERATIONS 10000000
+
+// the same routing as `server`, written by hand
+static void *hand_allocate(server_t *s, size_t size, size_t align) {
+  if (size <= 64)
+    return ba_alloc(&s->small.small.ba);
+
+  if (size <= (1 << 20))
+    return arena_alloc(&s->small.large, size, align);
+
+  return mmap_alloc_allocate(&s->large, size, align);
+}
+
+static void hand_deallocate(server_t *s, void *ptr, size_t size) {
+  if (size <= 64)
+    ba_free(&s->small.small.ba, ptr);
+  else if (size > (1 << 20))
+    mmap_alloc_deallocate(&s->large, ptr, size);
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(void) {
+  static uint8_t pool_buffer[64 * 64];
+
+  server_t server = {};
+  pool_init(&server.small.small, pool_buffer, sizeof(pool_buffer), 64);
+
+  void *a = server_allocate(&server, 48, 8);
+  void *b = server_allocate(&server, 512, 8);
+  void *c = server_allocate(&server, 2 << 20, 8);
+  printf("pool=%p, arena=%p, mmap=%p (mapped=%zu)\n", a, b, c,
+         server.large.mapped);
+
+  server_deallocate(&server, a, 48);
+  server_deallocate(&server, b, 512);
+  server_deallocate(&server, c, 2 << 20);
+  printf("mapped after free=%zu\n", server.large.mapped);
+
+  uint8_t stack_buffer[128];
+  scratch_t scratch = {};
+  fba_init(&scratch.a, stack_buffer, sizeof(stack_buffer));
+
+  void *s0 = scratch_allocate(&scratch, 100, 8);
+  void *s1 = scratch_allocate(&scratch, 100, 8);
+  printf("s0 in fba=%d, s1 in fba=%d\n", fba_owns(&scratch.a, s0),
+         fba_owns(&scratch.a, s1));
+
+  static uint8_t class_buffers[4][1024];
+  classes_t classes;
+  for (size_t i = 0; i < 4; i++) {
+    pool_init(&classes.buckets[i], class_buffers[i], sizeof(class_buffers[i]),
+              classes_bucket_size(i));
+  }
+
+  void *k = classes_allocate(&classes, 40, 8);
+  printf("40 bytes from bucket %d, owned=%d\n", classes_bucket(40),
+         classes_owns(&classes, k));
+  classes_deallocate(&classes, k, 40);
+
+  tagged_t tagged = {};
+  char *t = tagged_allocate(&tagged, 13, 1);
+  tagged_prefix(t)->size = 13;
+  tagged_suffix(t, 13)->value = 0xdeadbeef;
+  printf("size=%zu, canary=%x\n", tagged_prefix(t)->size,
+         tagged_suffix(t, 13)->value);
+
+  // compare the composed allocator against the hand written one
+  double start = now();
+  for (size_t i = 0; i < ITERATIONS; i++) {
+    void *p = server_allocate(&server, 32, 8);
+    server_deallocate(&server, p, 32);
+  }
+  printf("composed:     %.2f ns/op\n", (now() - start) * 1e9 / ITERATIONS);
+
+  start = now();
+  for (size_t i = 0; i < ITERATIONS; i++) {
+    void *p = hand_allocate(&server, 32, 8);
+    hand_deallocate(&server, p, 32);
+  }
+  printf("hand written: %.2f ns/op\n", (now() - start) * 1e9 / ITERATIONS);
+
+  arena_clear(&server.small.large);
+  arena_clear(&scratch.b);
+  arena_clear(&tagged.a);
+
+  return EXIT_SUCCESS;
+}
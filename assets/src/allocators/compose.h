@@ -0,0 +1,287 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "block_allocator.h"
+#include "fba.h"
+
+// Allocator building blocks.
+//
+// Every allocator that can be composed is a type `P_t` with three functions:
+//
+//   void *P_allocate(P_t *a, size_t size, size_t align);
+//   void  P_deallocate(P_t *a, void *ptr, size_t size);
+//   bool  P_owns(P_t *a, void *ptr);
+//
+// Deallocation is sized, the caller always knows how much it asked for. The
+// combinators below take allocator prefixes and generate a new allocator with
+// the same interface, so they can be nested. Everything is `static inline`,
+// there are no function pointers, the compiler sees the whole composition.
+
+// --- Adapters for the base allocators:
+
+// The fixed buffer allocator can only give back the last allocation.
+static inline void *fba_allocate(fba_t *a, size_t size, size_t align) {
+  return fba_alloc_opt(a, size, align);
+}
+
+static inline void fba_deallocate(fba_t *a, void *ptr, size_t size) {
+  if ((uint8_t *)ptr + size == a->head)
+    a->head = (uint8_t *)ptr;
+}
+
+static inline bool fba_owns(fba_t *a, void *ptr) {
+  return (uint8_t *)ptr >= a->buffer && (uint8_t *)ptr < a->buffer_end;
+}
+
+// Arena memory is only freed all at once with `arena_clear`.
+static inline void *arena_allocate(arena_t *a, size_t size, size_t align) {
+  return arena_alloc(a, size, align);
+}
+
+static inline void arena_deallocate(arena_t *a, void *ptr, size_t size) {
+  (void)a, (void)ptr, (void)size;
+}
+
+static inline bool arena_owns(arena_t *a, void *ptr) {
+  for (arena_block_t *b = a->blocks; b; b = b->next) {
+    if ((uint8_t *)ptr >= b->buffer && (uint8_t *)ptr < b->buffer_end)
+      return true;
+  }
+
+  for (arena_large_t *l = a->large; l; l = l->next) {
+    if ((uint8_t *)ptr >= (uint8_t *)l->ptr &&
+        (uint8_t *)ptr < (uint8_t *)l->ptr + l->size)
+      return true;
+  }
+
+  return false;
+}
+
+// A block allocator that remembers its item size, so it can refuse requests
+// that don't fit.
+typedef struct pool {
+  block_allocator_t ba;
+  size_t item_size;
+} pool_t;
+
+static inline void pool_init(pool_t *p, uint8_t *buffer, size_t buffer_size,
+                             size_t item_size) {
+  ba_init(&p->ba, buffer, buffer_size, item_size);
+  p->item_size = item_size;
+}
+
+static inline void *pool_allocate(pool_t *p, size_t size, size_t align) {
+  // blocks are `item_size` apart, so they are only aligned to its low bit
+  if (size > p->item_size || (p->item_size & (align - 1)))
+    return NULL;
+
+  return ba_alloc(&p->ba);
+}
+
+static inline void pool_deallocate(pool_t *p, void *ptr, size_t size) {
+  (void)size;
+  ba_free(&p->ba, ptr);
+}
+
+static inline bool pool_owns(pool_t *p, void *ptr) {
+  return (uint8_t *)ptr >= p->ba.buffer && (uint8_t *)ptr < p->ba.buffer_end;
+}
+
+// Whole pages straight from the kernel, for the really big allocations.
+typedef struct mmap_alloc {
+  size_t mapped;
+} mmap_alloc_t;
+
+#define MMAP_ALLOC_PAGE_SIZE 4096
+
+static inline void *mmap_alloc_allocate(mmap_alloc_t *m, size_t size,
+                                        size_t align) {
+  if (align > MMAP_ALLOC_PAGE_SIZE)
+    return NULL;
+
+  size = ALIGN_TO(size, MMAP_ALLOC_PAGE_SIZE);
+  void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  if (ptr == MAP_FAILED)
+    return NULL;
+
+  m->mapped += size;
+  return ptr;
+}
+
+static inline void mmap_alloc_deallocate(mmap_alloc_t *m, void *ptr,
+                                         size_t size) {
+  size = ALIGN_TO(size, MMAP_ALLOC_PAGE_SIZE);
+  munmap(ptr, size);
+  m->mapped -= size;
+}
+
+// We can't tell our mappings apart from any other memory, so claim everything.
+// Only use it as the last option of a composition.
+static inline bool mmap_alloc_owns(mmap_alloc_t *m, void *ptr) {
+  (void)m, (void)ptr;
+  return true;
+}
+
+// --- Combinators:
+
+// Try `A`, and if it fails, try `B`.
+#define ALLOC_FALLBACK(_name, _A, _B)                                          \
+  typedef struct _name {                                                       \
+    _A##_t a;                                                                  \
+    _B##_t b;                                                                  \
+  } _name##_t;                                                                 \
+                                                                               \
+  static inline void *_name##_allocate(_name##_t *x, size_t size,              \
+                                       size_t align) {                         \
+    void *ptr = _A##_allocate(&x->a, size, align);                             \
+    if (ptr)                                                                   \
+      return ptr;                                                              \
+                                                                               \
+    return _B##_allocate(&x->b, size, align);                                  \
+  }                                                                            \
+                                                                               \
+  static inline void _name##_deallocate(_name##_t *x, void *ptr,               \
+                                        size_t size) {                         \
+    if (_A##_owns(&x->a, ptr))                                                 \
+      _A##_deallocate(&x->a, ptr, size);                                       \
+    else                                                                       \
+      _B##_deallocate(&x->b, ptr, size);                                       \
+  }                                                                            \
+                                                                               \
+  static inline bool _name##_owns(_name##_t *x, void *ptr) {                   \
+    return _A##_owns(&x->a, ptr) || _B##_owns(&x->b, ptr);                     \
+  }
+
+// Allocations of up to `_threshold` bytes go to `Small`, the rest to `Large`.
+#define ALLOC_SEGREGATOR(_name, _threshold, _Small, _Large)                    \
+  typedef struct _name {                                                       \
+    _Small##_t small;                                                          \
+    _Large##_t large;                                                          \
+  } _name##_t;                                                                 \
+                                                                               \
+  static inline void *_name##_allocate(_name##_t *x, size_t size,              \
+                                       size_t align) {                         \
+    if (size <= (_threshold))                                                  \
+      return _Small##_allocate(&x->small, size, align);                        \
+                                                                               \
+    return _Large##_allocate(&x->large, size, align);                          \
+  }                                                                            \
+                                                                               \
+  static inline void _name##_deallocate(_name##_t *x, void *ptr,               \
+                                        size_t size) {                         \
+    if (size <= (_threshold))                                                  \
+      _Small##_deallocate(&x->small, ptr, size);                               \
+    else                                                                       \
+      _Large##_deallocate(&x->large, ptr, size);                               \
+  }                                                                            \
+                                                                               \
+  static inline bool _name##_owns(_name##_t *x, void *ptr) {                   \
+    return _Small##_owns(&x->small, ptr) || _Large##_owns(&x->large, ptr);     \
+  }
+
+// An array of `_count` instances of `A`, bucket `i` serving sizes up to
+// `_min_size << i`. Bigger allocations fail. The buckets are initialized by
+// the user, `_name_bucket_size` gives the size class of each one.
+#define ALLOC_BUCKETIZER(_name, _A, _min_size, _count)                         \
+  typedef struct _name {                                                       \
+    _A##_t buckets[_count];                                                    \
+  } _name##_t;                                                                 \
+                                                                               \
+  static inline size_t _name##_bucket_size(size_t i) {                         \
+    return (size_t)(_min_size) << i;                                           \
+  }                                                                            \
+                                                                               \
+  static inline int _name##_bucket(size_t size) {                              \
+    for (int i = 0; i < (_count); i++) {                                       \
+      if (size <= _name##_bucket_size(i))                                      \
+        return i;                                                              \
+    }                                                                          \
+                                                                               \
+    return -1;                                                                 \
+  }                                                                            \
+                                                                               \
+  static inline void *_name##_allocate(_name##_t *x, size_t size,              \
+                                       size_t align) {                         \
+    int i = _name##_bucket(size);                                              \
+    if (i < 0)                                                                 \
+      return NULL;                                                             \
+                                                                               \
+    return _A##_allocate(&x->buckets[i], size, align);                         \
+  }                                                                            \
+                                                                               \
+  static inline void _name##_deallocate(_name##_t *x, void *ptr,               \
+                                        size_t size) {                         \
+    int i = _name##_bucket(size);                                              \
+    if (i >= 0)                                                                \
+      _A##_deallocate(&x->buckets[i], ptr, size);                              \
+  }                                                                            \
+                                                                               \
+  static inline bool _name##_owns(_name##_t *x, void *ptr) {                   \
+    for (int i = 0; i < (_count); i++) {                                       \
+      if (_A##_owns(&x->buckets[i], ptr))                                      \
+        return true;                                                           \
+    }                                                                          \
+                                                                               \
+    return false;                                                              \
+  }
+
+// Wrap every allocation of `A` with a `Prefix` before and a `Suffix` after the
+// user memory. Use `_name_prefix` and `_name_suffix` to get to them.
+//
+// The prefix takes a fixed `max_align_t` aligned slot, so user alignment is
+// limited to `_Alignof(max_align_t)`.
+#define ALLOC_AFFIX(_name, _A, _Prefix, _Suffix)                               \
+  typedef struct _name {                                                       \
+    _A##_t a;                                                                  \
+  } _name##_t;                                                                 \
+                                                                               \
+  enum {                                                                       \
+    _name##_prefix_size = ALIGN_TO(sizeof(_Prefix), _Alignof(max_align_t)),    \
+  };                                                                           \
+                                                                               \
+  static inline size_t _name##_suffix_offset(size_t size) {                    \
+    return ALIGN_TO(size, _Alignof(_Suffix));                                  \
+  }                                                                            \
+                                                                               \
+  static inline size_t _name##_total_size(size_t size) {                       \
+    return _name##_prefix_size + _name##_suffix_offset(size) +                 \
+           sizeof(_Suffix);                                                    \
+  }                                                                            \
+                                                                               \
+  static inline _Prefix *_name##_prefix(void *ptr) {                           \
+    return (_Prefix *)((uint8_t *)ptr - sizeof(_Prefix));                      \
+  }                                                                            \
+                                                                               \
+  static inline _Suffix *_name##_suffix(void *ptr, size_t size) {              \
+    return (_Suffix *)((uint8_t *)ptr + _name##_suffix_offset(size));          \
+  }                                                                            \
+                                                                               \
+  static inline void *_name##_allocate(_name##_t *x, size_t size,              \
+                                       size_t align) {                         \
+    if (align > _Alignof(max_align_t))                                         \
+      return NULL;                                                             \
+                                                                               \
+    uint8_t *mem = (uint8_t *)_A##_allocate(&x->a, _name##_total_size(size),   \
+                                            _Alignof(max_align_t));            \
+    if (!mem)                                                                  \
+      return NULL;                                                             \
+                                                                               \
+    return mem + _name##_prefix_size;                                          \
+  }                                                                            \
+                                                                               \
+  static inline void _name##_deallocate(_name##_t *x, void *ptr,               \
+                                        size_t size) {                         \
+    _A##_deallocate(&x->a, (uint8_t *)ptr - _name##_prefix_size,               \
+                    _name##_total_size(size));                                 \
+  }                                                                            \
+                                                                               \
+  static inline bool _name##_owns(_name##_t *x, void *ptr) {                   \
+    return _A##_owns(&x->a, (uint8_t *)ptr - _name##_prefix_size);             \
+  }
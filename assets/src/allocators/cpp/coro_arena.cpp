@@ -0,0 +1,81 @@
+#include "coro_arena.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define REQUESTS 200000
+#define CHAIN_DEPTH 16
+
+// A chain of handlers, each one awaiting the next. The scratch buffer lives
+// across the `co_await`, so it ends up in the frame.
+template <typename Frames, typename Alloc>
+static task<int, Frames> handler(Alloc &alloc, int depth) {
+  volatile char scratch[64];
+  scratch[0] = (char)depth;
+
+  int rest = 0;
+  if (depth > 0)
+    rest = co_await handler<Frames>(alloc, depth - 1);
+
+  co_return rest + scratch[0];
+}
+
+template <typename Frames> static task<int, Frames> heap_handler(int depth) {
+  volatile char scratch[64];
+  scratch[0] = (char)depth;
+
+  int rest = 0;
+  if (depth > 0)
+    rest = co_await heap_handler<Frames>(depth - 1);
+
+  co_return rest + scratch[0];
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void report(char const *name, double start, long sum) {
+  double elapsed = now() - start;
+  printf("%-8s %8.1f ns/request, %6.1f ns/frame (sum=%ld)\n", name,
+         elapsed * 1e9 / REQUESTS,
+         elapsed * 1e9 / ((double)REQUESTS * (CHAIN_DEPTH + 1)), sum);
+}
+
+int main(void) {
+  long sum = 0;
+  double start = now();
+  for (int i = 0; i < REQUESTS; i++) {
+    sum += heap_handler<heap_frames>(CHAIN_DEPTH).run();
+  }
+  report("malloc", start, sum);
+
+  // one arena for all requests, the frames of each go away with
+  // `arena_reset` and the block is reused by the next one
+  arena_t arena = {};
+  sum = 0;
+  start = now();
+  for (int i = 0; i < REQUESTS; i++) {
+    sum += handler<arena_frames>(arena, CHAIN_DEPTH).run();
+    arena_reset(&arena);
+  }
+  report("arena", start, sum);
+  arena_clear(&arena);
+
+  // frames are returned to their bucket as each handler finishes
+  alignas(64) static uint8_t buffer[6 * 64 * 1024];
+  frame_pools_t pools;
+  frame_pools_init(&pools, buffer, sizeof(buffer));
+
+  sum = 0;
+  start = now();
+  for (int i = 0; i < REQUESTS; i++) {
+    sum += handler<arena_frames>(pools, CHAIN_DEPTH).run();
+  }
+  report("pools", start, sum);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,186 @@
+#pragma once
+
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <new>
+#include <utility>
+
+#include "arena.h"
+#include "block_allocator.h"
+
+// Size-bucketed pools for coroutine frames.
+//
+// Bucket `i` holds blocks of `FRAME_POOL_MIN_SIZE << i` bytes, all carved out
+// of a single caller provided buffer (just like `ba_init`).
+#define FRAME_POOL_BUCKETS 6
+#define FRAME_POOL_MIN_SIZE 64
+
+typedef struct frame_pools {
+  block_allocator_t buckets[FRAME_POOL_BUCKETS];
+} frame_pools_t;
+
+// Split `buffer` evenly between all of the buckets.
+static inline void frame_pools_init(frame_pools_t *p, uint8_t *buffer,
+                                    size_t buffer_size) {
+  size_t share = buffer_size / FRAME_POOL_BUCKETS;
+  share -= share % (FRAME_POOL_MIN_SIZE << (FRAME_POOL_BUCKETS - 1));
+
+  for (size_t i = 0; i < FRAME_POOL_BUCKETS; i++) {
+    ba_init(&p->buckets[i], buffer + i * share, share,
+            FRAME_POOL_MIN_SIZE << i);
+  }
+}
+
+// Index of the smallest bucket that fits `size`, or -1 if it is too big.
+static inline int frame_pools_bucket(size_t size) {
+  for (int i = 0; i < FRAME_POOL_BUCKETS; i++) {
+    if (size <= ((size_t)FRAME_POOL_MIN_SIZE << i))
+      return i;
+  }
+
+  return -1;
+}
+
+// Every frame is prefixed with this, so that `operator delete` knows where the
+// memory came from. Frames that don't fit their allocator go to the heap.
+enum frame_source : uint32_t {
+  FRAME_SOURCE_HEAP,
+  FRAME_SOURCE_ARENA,
+  FRAME_SOURCE_POOL,
+};
+
+typedef struct alignas(__STDCPP_DEFAULT_NEW_ALIGNMENT__) frame_header {
+  frame_pools_t *pools;
+  frame_source source;
+  uint32_t bucket;
+} frame_header_t;
+
+// Promise mixin that allocates coroutine frames from the allocator passed as
+// the first argument of the coroutine.
+//
+//   task<int> handler(arena_t &arena, ...);       // frame in `arena`
+//   task<int> handler(frame_pools_t &pools, ...); // frame in a pool bucket
+//   task<int> handler(...);                       // frame in the heap
+//
+// Frames in the arena are never freed individually, they all go away with
+// `arena_clear`.
+struct arena_frames {
+  template <typename... Args>
+  static void *operator new(size_t size, arena_t &a, Args const &...) {
+    void *mem = arena_alloc(&a, sizeof(frame_header_t) + size,
+                            alignof(frame_header_t));
+    if (!mem)
+      return operator new(size);
+
+    return frame_init(mem, FRAME_SOURCE_ARENA, NULL, 0);
+  }
+
+  template <typename... Args>
+  static void *operator new(size_t size, frame_pools_t &p, Args const &...) {
+    int bucket = frame_pools_bucket(sizeof(frame_header_t) + size);
+    if (bucket < 0)
+      return operator new(size);
+
+    void *mem = ba_alloc(&p.buckets[bucket]);
+    if (!mem)
+      return operator new(size);
+
+    return frame_init(mem, FRAME_SOURCE_POOL, &p, bucket);
+  }
+
+  static void *operator new(size_t size) {
+    void *mem = ::operator new(sizeof(frame_header_t) + size);
+    return frame_init(mem, FRAME_SOURCE_HEAP, NULL, 0);
+  }
+
+  static void operator delete(void *ptr, size_t) {
+    frame_header_t *h = (frame_header_t *)ptr - 1;
+    switch (h->source) {
+    case FRAME_SOURCE_HEAP:
+      ::operator delete(h);
+      break;
+    case FRAME_SOURCE_ARENA:
+      // freed all at once with the arena
+      break;
+    case FRAME_SOURCE_POOL:
+      ba_free(&h->pools->buckets[h->bucket], h);
+      break;
+    }
+  }
+
+private:
+  static void *frame_init(void *mem, frame_source source, frame_pools_t *pools,
+                          uint32_t bucket) {
+    frame_header_t *h = (frame_header_t *)mem;
+    *h = (frame_header_t){.pools = pools, .source = source, .bucket = bucket};
+    return h + 1;
+  }
+};
+
+// Frames allocated with plain `operator new`, for comparison.
+struct heap_frames {};
+
+// A lazily started coroutine that resumes its awaiter when done. `Frames` is
+// mixed into the promise and decides where the frame lives.
+template <typename T, typename Frames = arena_frames> class task {
+public:
+  struct promise_type : Frames {
+    T value{};
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+    std::exception_ptr error;
+
+    task get_return_object() {
+      return task{std::coroutine_handle<promise_type>::from_promise(*this)};
+    }
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    struct final_awaiter {
+      bool await_ready() noexcept { return false; }
+      std::coroutine_handle<>
+      await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+        return h.promise().continuation;
+      }
+      void await_resume() noexcept {}
+    };
+
+    final_awaiter final_suspend() noexcept { return {}; }
+
+    void return_value(T v) { value = std::move(v); }
+    void unhandled_exception() { error = std::current_exception(); }
+  };
+
+  task(task &&other) noexcept : handle(std::exchange(other.handle, {})) {}
+  task(task const &) = delete;
+  ~task() {
+    if (handle)
+      handle.destroy();
+  }
+
+  bool await_ready() noexcept { return false; }
+
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) {
+    handle.promise().continuation = awaiter;
+    return handle;
+  }
+
+  T await_resume() {
+    if (handle.promise().error)
+      std::rethrow_exception(handle.promise().error);
+
+    return std::move(handle.promise().value);
+  }
+
+  // Run the coroutine to completion from non-coroutine code.
+  T run() {
+    handle.resume();
+    return await_resume();
+  }
+
+private:
+  explicit task(std::coroutine_handle<promise_type> h) : handle(h) {}
+
+  std::coroutine_handle<promise_type> handle;
+};
@@ -0,0 +1,185 @@
+#define _GNU_SOURCE
+
+#include "epoch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+// A routing table that is rebuilt and republished while readers look up
+// routes in it. Each version lives in its own arena, retired when replaced.
+// The same thing is then done with a reader-writer lock for comparison.
+
+#define READERS 3
+#define ROUTES 1024
+#define VERSIONS 200
+
+typedef struct route {
+  uint32_t prefix;
+  uint32_t next_hop;
+  uint64_t version;
+} route_t;
+
+typedef struct table {
+  uint64_t version;
+  size_t count;
+  route_t *routes;
+} table_t;
+
+static epoch_domain_t domain;
+static _Atomic(table_t *) current;
+static atomic_bool done;
+
+// the rwlock version, the old table is cleared as soon as it is replaced
+static pthread_rwlock_t rwlock = PTHREAD_RWLOCK_INITIALIZER;
+static table_t *locked_current;
+static arena_t locked_arenas[2];
+
+static table_t *build_table(arena_t *a, uint64_t version) {
+  table_t *t = arena_alloc(a, sizeof(*t), _Alignof(table_t));
+  t->version = version;
+  t->count = ROUTES;
+  t->routes = arena_alloc(a, sizeof(route_t) * ROUTES, _Alignof(route_t));
+  for (size_t i = 0; i < ROUTES; i++) {
+    t->routes[i] = (route_t){
+        .prefix = (uint32_t)i << 8, .next_hop = (uint32_t)(i + version),
+        .version = version};
+  }
+
+  return t;
+}
+
+// A reader sees either the whole old version or the whole new one.
+static bool lookup(table_t *t, size_t i) {
+  route_t *r = &t->routes[i % t->count];
+  return r->version == t->version && r->next_hop == (i % t->count) + t->version;
+}
+
+static void *epoch_reader(void *arg) {
+  size_t *lookups = arg;
+  epoch_thread_t *self = epoch_register(&domain);
+
+  while (!atomic_load_explicit(&done, memory_order_relaxed)) {
+    epoch_enter(&domain, self);
+    table_t *t = atomic_load_explicit(&current, memory_order_acquire);
+    if (!lookup(t, *lookups)) {
+      fprintf(stderr, "torn read in version %lu\n", t->version);
+      exit(EXIT_FAILURE);
+    }
+    epoch_exit(self);
+
+    (*lookups)++;
+  }
+
+  epoch_unregister(self);
+  return NULL;
+}
+
+static void *locked_reader(void *arg) {
+  size_t *lookups = arg;
+
+  while (!atomic_load_explicit(&done, memory_order_relaxed)) {
+    pthread_rwlock_rdlock(&rwlock);
+    if (!lookup(locked_current, *lookups)) {
+      fprintf(stderr, "torn read in version %lu\n", locked_current->version);
+      exit(EXIT_FAILURE);
+    }
+    pthread_rwlock_unlock(&rwlock);
+
+    (*lookups)++;
+  }
+
+  return NULL;
+}
+
+static size_t join_readers(pthread_t *threads, size_t *lookups) {
+  size_t total = 0;
+  for (size_t i = 0; i < READERS; i++) {
+    pthread_join(threads[i], NULL);
+    total += lookups[i];
+  }
+
+  return total;
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(void) {
+  epoch_init(&domain);
+
+  arena_t *a = epoch_arena_new(&domain);
+  atomic_store(&current, build_table(a, 0));
+
+  static size_t lookups[READERS];
+  pthread_t threads[READERS];
+  for (size_t i = 0; i < READERS; i++)
+    pthread_create(&threads[i], NULL, epoch_reader, &lookups[i]);
+
+  size_t cleared = 0;
+  double start = now();
+  for (uint64_t v = 1; v <= VERSIONS; v++) {
+    arena_t *next = epoch_arena_new(&domain);
+    if (!next) {
+      fprintf(stderr, "too many arenas in limbo\n");
+      return EXIT_FAILURE;
+    }
+
+    // unpublish the old version before retiring its arena
+    atomic_store(&current, build_table(next, v));
+    epoch_retire(&domain, a);
+    a = next;
+
+    cleared += epoch_reclaim(&domain);
+    usleep(1000);
+  }
+
+  atomic_store(&done, true);
+  size_t total = join_readers(threads, lookups);
+  double elapsed = now() - start;
+
+  // no readers left, everything in limbo can go after two advances
+  epoch_retire(&domain, a);
+  for (int i = 0; i < 3; i++)
+    cleared += epoch_reclaim(&domain);
+
+  printf("epoch:  %zu versions, %zu arenas cleared, %.1f M lookups/s\n",
+         (size_t)VERSIONS + 1, cleared, total / elapsed / 1e6);
+
+  // the same with a lock around every lookup
+  locked_current = build_table(&locked_arenas[0], 0);
+
+  atomic_store(&done, false);
+  for (size_t i = 0; i < READERS; i++) {
+    lookups[i] = 0;
+    pthread_create(&threads[i], NULL, locked_reader, &lookups[i]);
+  }
+
+  start = now();
+  for (uint64_t v = 1; v <= VERSIONS; v++) {
+    arena_t *next = &locked_arenas[v % 2];
+    table_t *t = build_table(next, v);
+
+    pthread_rwlock_wrlock(&rwlock);
+    locked_current = t;
+    pthread_rwlock_unlock(&rwlock);
+
+    arena_clear(&locked_arenas[(v + 1) % 2]);
+    usleep(1000);
+  }
+
+  atomic_store(&done, true);
+  total = join_readers(threads, lookups);
+  elapsed = now() - start;
+  printf("rwlock: %zu versions, %.1f M lookups/s\n", (size_t)VERSIONS + 1,
+         total / elapsed / 1e6);
+
+  arena_clear(&locked_arenas[0]);
+  arena_clear(&locked_arenas[1]);
+
+  return EXIT_SUCCESS;
+}
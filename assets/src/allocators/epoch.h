@@ -0,0 +1,160 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "block_allocator.h"
+
+// Epoch based reclamation of whole arenas.
+//
+// Shared read-mostly data (routing tables, config) is built in a fresh arena
+// and published by swapping a pointer. Readers never lock, they only say
+// which epoch they are reading in. The old arena is retired to a limbo list
+// tagged with the current epoch, and cleared once every reader has moved past
+// it: the global epoch only advances when all active readers have seen the
+// current one, so two advances after the retire nobody can hold a pointer to
+// it anymore.
+//
+// No per-object bookkeeping, the arena is the unit of reclamation.
+
+#define EPOCH_MAX_THREADS 64
+#define EPOCH_MAX_ARENAS 64
+
+// Bit 0 says the thread is inside a critical section, the rest is the epoch
+// it saw when it entered.
+typedef struct epoch_thread {
+  _Atomic uint64_t state;
+  atomic_bool in_use;
+} epoch_thread_t;
+
+// Arenas handed out by the domain. The `arena_t` can't live inside its own
+// blocks, so it comes from a pool.
+typedef struct epoch_arena {
+  arena_t arena;
+  uint64_t retired;
+  struct epoch_arena *next;
+} epoch_arena_t;
+
+typedef struct epoch_domain {
+  _Atomic uint64_t epoch;
+  epoch_thread_t threads[EPOCH_MAX_THREADS];
+
+  // writers only, readers never touch any of this
+  pthread_mutex_t lock;
+  block_allocator_t arenas;
+  epoch_arena_t arena_buffer[EPOCH_MAX_ARENAS];
+  epoch_arena_t *limbo;
+} epoch_domain_t;
+
+static inline void epoch_init(epoch_domain_t *d) {
+  atomic_init(&d->epoch, 1);
+  for (size_t i = 0; i < EPOCH_MAX_THREADS; i++) {
+    atomic_init(&d->threads[i].state, 0);
+    atomic_init(&d->threads[i].in_use, false);
+  }
+
+  pthread_mutex_init(&d->lock, NULL);
+  ba_init(&d->arenas, (uint8_t *)d->arena_buffer, sizeof(d->arena_buffer),
+          sizeof(epoch_arena_t));
+  d->limbo = NULL;
+}
+
+// Take a slot for the calling thread, or `NULL` if all are in use.
+static inline epoch_thread_t *epoch_register(epoch_domain_t *d) {
+  for (size_t i = 0; i < EPOCH_MAX_THREADS; i++) {
+    bool expected = false;
+    if (atomic_compare_exchange_strong(&d->threads[i].in_use, &expected, true))
+      return &d->threads[i];
+  }
+
+  return NULL;
+}
+
+static inline void epoch_unregister(epoch_thread_t *t) {
+  atomic_store(&t->state, 0);
+  atomic_store(&t->in_use, false);
+}
+
+// Start reading. Anything loaded after this stays valid until `epoch_exit`.
+static inline void epoch_enter(epoch_domain_t *d, epoch_thread_t *t) {
+  uint64_t e = atomic_load_explicit(&d->epoch, memory_order_relaxed);
+  atomic_store_explicit(&t->state, e << 1 | 1, memory_order_relaxed);
+
+  // the announcement must be visible before we load any shared pointer
+  atomic_thread_fence(memory_order_seq_cst);
+}
+
+static inline void epoch_exit(epoch_thread_t *t) {
+  atomic_store_explicit(&t->state, 0, memory_order_release);
+}
+
+// A fresh arena to build the next version in.
+static inline arena_t *epoch_arena_new(epoch_domain_t *d) {
+  pthread_mutex_lock(&d->lock);
+  epoch_arena_t *ea = (epoch_arena_t *)ba_alloc(&d->arenas);
+  pthread_mutex_unlock(&d->lock);
+
+  if (!ea)
+    return NULL;
+
+  *ea = (epoch_arena_t){};
+  return &ea->arena;
+}
+
+// Advance the global epoch if every active reader has seen it.
+static inline bool epoch_try_advance(epoch_domain_t *d) {
+  atomic_thread_fence(memory_order_seq_cst);
+  uint64_t e = atomic_load(&d->epoch);
+
+  for (size_t i = 0; i < EPOCH_MAX_THREADS; i++) {
+    uint64_t state = atomic_load(&d->threads[i].state);
+    if ((state & 1) && (state >> 1) != e)
+      return false;
+  }
+
+  return atomic_compare_exchange_strong(&d->epoch, &e, e + 1);
+}
+
+// Clear every retired arena that no reader can see anymore. Returns how many
+// were cleared.
+static inline size_t epoch_reclaim(epoch_domain_t *d) {
+  pthread_mutex_lock(&d->lock);
+  epoch_try_advance(d);
+  uint64_t e = atomic_load(&d->epoch);
+
+  size_t cleared = 0;
+  epoch_arena_t **link = &d->limbo;
+  while (*link) {
+    epoch_arena_t *ea = *link;
+    if (ea->retired + 2 > e) {
+      link = &ea->next;
+      continue;
+    }
+
+    *link = ea->next;
+    arena_clear(&ea->arena);
+    ba_free(&d->arenas, ea);
+    cleared++;
+  }
+
+  pthread_mutex_unlock(&d->lock);
+  return cleared;
+}
+
+// Retire an arena that has been unpublished. Readers that are still inside a
+// critical section may keep using it, it is cleared by a later
+// `epoch_reclaim`. `a` must come from `epoch_arena_new`, the bookkeeping lives
+// around it.
+static inline void epoch_retire(epoch_domain_t *d, arena_t *a) {
+  epoch_arena_t *ea = (epoch_arena_t *)a;
+
+  pthread_mutex_lock(&d->lock);
+  ea->retired = atomic_load(&d->epoch);
+  ea->next = d->limbo;
+  d->limbo = ea;
+  pthread_mutex_unlock(&d->lock);
+}
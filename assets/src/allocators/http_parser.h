@@ -0,0 +1,176 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "arena.h"
+
+// A zero-copy HTTP/1.1 request parser.
+//
+// The request is parsed in place, every string is a view into the input
+// buffer, so the buffer (an `fba_t` or an arena block) must outlive the parsed
+// request. The only thing allocated is the header table, in the arena.
+
+typedef struct str {
+  char const *ptr;
+  size_t len;
+} str_t;
+
+typedef struct http_header {
+  str_t name;
+  str_t value;
+} http_header_t;
+
+typedef struct http_request {
+  str_t method;
+  str_t target;
+  str_t version;
+
+  http_header_t *headers;
+  size_t header_count;
+} http_request_t;
+
+#define HTTP_INITIAL_HEADERS 16
+
+static inline bool str_eq(str_t s, char const *cstr) {
+  size_t len = strlen(cstr);
+  return s.len == len && memcmp(s.ptr, cstr, len) == 0;
+}
+
+// Find the first `a` or `b` in `[p, end)`, or `end` if there is none.
+static inline char const *http_scan_scalar(char const *p, char const *end,
+                                           char a, char b) {
+  while (p < end && *p != a && *p != b)
+    p++;
+
+  return p;
+}
+
+#ifdef __SSE2__
+static inline char const *http_scan(char const *p, char const *end, char a,
+                                    char b) {
+  __m128i va = _mm_set1_epi8(a);
+  __m128i vb = _mm_set1_epi8(b);
+
+  // 16 bytes at a time while we can, the tail is done one by one
+  for (; p + 16 <= end; p += 16) {
+    __m128i chunk = _mm_loadu_si128((__m128i const *)p);
+    __m128i hits =
+        _mm_or_si128(_mm_cmpeq_epi8(chunk, va), _mm_cmpeq_epi8(chunk, vb));
+    int mask = _mm_movemask_epi8(hits);
+    if (mask)
+      return p + __builtin_ctz(mask);
+  }
+
+  return http_scan_scalar(p, end, a, b);
+}
+#else
+#define http_scan http_scan_scalar
+#endif
+
+// Parse the request head in `buf`. Returns the size of the head (up to and
+// including the empty line), 0 if more data is needed, or -1 if the request is
+// malformed or the header table could not be allocated.
+static ptrdiff_t http_parse_request(arena_t *a, char const *buf, size_t len,
+                                    http_request_t *req) {
+  char const *p = buf;
+  char const *end = buf + len;
+
+  // request line: METHOD SP TARGET SP VERSION CRLF
+  char const *sp = http_scan(p, end, ' ', '\r');
+  if (sp == end)
+    return 0;
+  if (*sp != ' ')
+    return -1;
+  req->method = (str_t){p, sp - p};
+
+  p = sp + 1;
+  sp = http_scan(p, end, ' ', '\r');
+  if (sp == end)
+    return 0;
+  if (*sp != ' ')
+    return -1;
+  req->target = (str_t){p, sp - p};
+
+  p = sp + 1;
+  char const *cr = http_scan(p, end, '\r', '\n');
+  if (cr + 1 >= end)
+    return 0;
+  if (*cr != '\r' || cr[1] != '\n')
+    return -1;
+  req->version = (str_t){p, cr - p};
+  p = cr + 2;
+
+  size_t capacity = HTTP_INITIAL_HEADERS;
+  req->headers = arena_alloc(a, capacity * sizeof(http_header_t),
+                             _Alignof(http_header_t));
+  req->header_count = 0;
+  if (!req->headers)
+    return -1;
+
+  // headers: NAME ':' OWS VALUE OWS CRLF, until an empty line
+  for (;;) {
+    if (p + 1 >= end)
+      return 0;
+    if (p[0] == '\r' && p[1] == '\n')
+      return p + 2 - buf;
+
+    char const *colon = http_scan(p, end, ':', '\r');
+    if (colon == end)
+      return 0;
+    if (*colon != ':' || colon == p)
+      return -1;
+
+    char const *value = colon + 1;
+    cr = http_scan(value, end, '\r', '\n');
+    if (cr + 1 >= end)
+      return 0;
+    if (*cr != '\r' || cr[1] != '\n')
+      return -1;
+
+    char const *value_end = cr;
+    while (value < value_end && (*value == ' ' || *value == '\t'))
+      value++;
+    while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t'))
+      value_end--;
+
+    // the old table is left behind in the arena, it goes away with the rest
+    if (req->header_count == capacity) {
+      http_header_t *headers = arena_alloc(
+          a, capacity * 2 * sizeof(http_header_t), _Alignof(http_header_t));
+      if (!headers)
+        return -1;
+
+      memcpy(headers, req->headers, capacity * sizeof(http_header_t));
+      req->headers = headers;
+      capacity *= 2;
+    }
+
+    req->headers[req->header_count++] = (http_header_t){
+        .name = {p, colon - p},
+        .value = {value, value_end - value},
+    };
+
+    p = cr + 2;
+  }
+}
+
+// Find a header by name (case-insensitive), or `NULL`.
+static inline str_t const *http_find_header(http_request_t const *req,
+                                            char const *name) {
+  size_t len = strlen(name);
+  for (size_t i = 0; i < req->header_count; i++) {
+    str_t n = req->headers[i].name;
+    if (n.len == len && strncasecmp(n.ptr, name, len) == 0)
+      return &req->headers[i].value;
+  }
+
+  return NULL;
+}
@@ -0,0 +1,593 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "block_allocator.h"
+#include "site_alloc.h"
+
+// The HTTP server from the blog post: every request gets a control struct from
+// a block allocator, with the socket and an arena for temporary allocations.
+// A load generator runs in the same process and measures latency, the whole
+// thing is repeated for each allocator configuration, each in a process of its
+// own so the resident set size is only its own.
+//
+// In the "sites" configuration every allocation site goes where a profile of
+// this same workload says (see `site_alloc.h`). To redo the profile:
+//
+//     gcc -DSITE_PROFILE http_server.c -o profile && ./profile
+//     ./site_gen < http_server.profile > http_server_sites.h
+
+#define CLIENTS 4
+#define REQUESTS_PER_CLIENT 20000
+#define MAX_REQUESTS 256
+#define MAX_HEADERS 32
+// read buffer, method, path, header array, body and response, and a name and
+// a value per header
+#define MAX_TEMP_ALLOCS (6 + 2 * MAX_HEADERS)
+#define READ_BUFFER_SIZE 2048
+
+typedef enum alloc_mode {
+  MODE_MALLOC,
+  MODE_ARENA,
+  MODE_ARENA_RETAIN,
+  MODE_SITES,
+} alloc_mode_t;
+
+static char const *mode_names[] = {
+    [MODE_MALLOC] = "malloc",
+    [MODE_ARENA] = "arena",
+    [MODE_ARENA_RETAIN] = "arena+retain",
+    [MODE_SITES] = "sites",
+};
+
+#define HTTP_SITES(X)                                                          \
+  X(read_buffer)                                                               \
+  X(method)                                                                    \
+  X(path)                                                                      \
+  X(headers)                                                                   \
+  X(header_name)                                                               \
+  X(header_value)                                                              \
+  X(body)                                                                      \
+  X(response)
+
+#define SITE_ENUM(_name) SITE_##_name,
+#define SITE_NAME(_name) #_name,
+
+enum { HTTP_SITES(SITE_ENUM) SITE_COUNT };
+#ifdef SITE_PROFILE
+static char const *const site_names[] = {HTTP_SITES(SITE_NAME)};
+#endif
+
+#if !defined(SITE_PROFILE) && __has_include("http_server_sites.h")
+#include "http_server_sites.h"
+#else
+// no profile yet, everything on the heap
+static const site_route_t site_routes[SITE_COUNT] = {};
+#define SITE_POOL_COUNT 0
+static const size_t site_pool_sizes[SITE_MAX_POOLS] = {};
+#endif
+
+// The control struct for a request.
+typedef struct request {
+  int socket;
+  arena_t arena;
+
+  char *buffer;
+  size_t buffer_len;
+
+  // in `MODE_MALLOC` and `MODE_SITES` each temporary allocation is freed on
+  // its own
+  void *allocs[MAX_TEMP_ALLOCS];
+  unsigned alloc_sites[MAX_TEMP_ALLOCS];
+  size_t alloc_count;
+
+  uint64_t id;
+} request_t;
+
+typedef struct server {
+  alloc_mode_t mode;
+  int listener;
+  int epoll;
+  block_allocator_t requests;
+  site_ctx_t sites;
+  uint64_t request_ids;
+  size_t open;
+  atomic_int done;
+} server_t;
+
+// --- Per request memory:
+
+// `site` only matters in `MODE_SITES`. Inlined with a constant site, its
+// route is a constant too.
+static inline void *request_alloc(server_t *s, request_t *r, unsigned site,
+                                  size_t size) {
+  if (s->mode == MODE_ARENA || s->mode == MODE_ARENA_RETAIN)
+    return arena_alloc(&r->arena, size, _Alignof(max_align_t));
+
+  // arena routed sites are not freed one by one, don't track them
+  bool tracked = s->mode == MODE_MALLOC || site_routes[site].kind != SITE_ARENA;
+  if (tracked && r->alloc_count == MAX_TEMP_ALLOCS)
+    return NULL;
+
+  void *ptr = s->mode == MODE_MALLOC
+                  ? malloc(size)
+                  : site_alloc(&s->sites, site_routes[site], site, size);
+  if (tracked) {
+    r->allocs[r->alloc_count] = ptr;
+    r->alloc_sites[r->alloc_count++] = site;
+  }
+  return ptr;
+}
+
+// Give back a temporary before the request is done.
+static inline void request_release(server_t *s, request_t *r, unsigned site,
+                                   void *ptr) {
+  if (s->mode == MODE_ARENA || s->mode == MODE_ARENA_RETAIN)
+    return;
+
+  // most likely one of the last ones
+  for (size_t i = r->alloc_count; i-- > 0;) {
+    if (r->allocs[i] != ptr)
+      continue;
+
+    r->alloc_count--;
+    r->allocs[i] = r->allocs[r->alloc_count];
+    r->alloc_sites[i] = r->alloc_sites[r->alloc_count];
+    break;
+  }
+
+  if (s->mode == MODE_MALLOC)
+    free(ptr);
+  else
+    site_free(&s->sites, site_routes[site], ptr);
+}
+
+static char *request_strndup(server_t *s, request_t *r, unsigned site,
+                             char const *str, size_t len) {
+  char *dup = request_alloc(s, r, site, len + 1);
+  if (dup) {
+    memcpy(dup, str, len);
+    dup[len] = 0;
+  }
+
+  return dup;
+}
+
+static void request_free(server_t *s, request_t *r) {
+  switch (s->mode) {
+  case MODE_MALLOC:
+    for (size_t i = 0; i < r->alloc_count; i++)
+      free(r->allocs[i]);
+    free(r);
+    return;
+  case MODE_ARENA:
+    arena_clear(&r->arena);
+    break;
+  case MODE_ARENA_RETAIN:
+    // the blocks stay in the arena, that stays in the pooled struct
+    arena_reset(&r->arena);
+    break;
+  case MODE_SITES:
+    site_request_begin(&s->sites, r->id, &r->arena);
+    site_request_closing(&s->sites);
+    for (size_t i = 0; i < r->alloc_count; i++) {
+      unsigned site = r->alloc_sites[i];
+      site_free(&s->sites, site_routes[site], r->allocs[i]);
+    }
+    arena_reset(&r->arena);
+    break;
+  }
+
+  ba_free(&s->requests, r);
+}
+
+static request_t *request_new(server_t *s, int socket) {
+  request_t *r;
+  if (s->mode == MODE_MALLOC)
+    r = calloc(1, sizeof(*r));
+  else
+    r = ba_alloc(&s->requests);
+
+  if (!r)
+    return NULL;
+
+  r->socket = socket;
+  r->buffer_len = 0;
+  r->alloc_count = 0;
+  r->id = ++s->request_ids;
+  site_request_begin(&s->sites, r->id, &r->arena);
+  r->buffer = request_alloc(s, r, SITE_read_buffer, READ_BUFFER_SIZE);
+  if (!r->buffer) {
+    request_free(s, r);
+    return NULL;
+  }
+
+  return r;
+}
+
+// --- Request handling:
+
+typedef struct header {
+  char *name;
+  char *value;
+} header_t;
+
+// Parse the request in the buffer, copying out the interesting parts, and
+// write the response. Returns -1 if the connection should be closed.
+static int request_handle(server_t *s, request_t *r) {
+  char *line = r->buffer;
+  char *end = strstr(line, "\r\n");
+  char *sp0 = memchr(line, ' ', end - line);
+  char *sp1 = sp0 ? memchr(sp0 + 1, ' ', end - sp0 - 1) : NULL;
+  if (!sp1)
+    return -1;
+
+  site_request_begin(&s->sites, r->id, &r->arena);
+
+  // anything that doesn't fit in the temporaries fails the request, the
+  // connection is closed and `request_free` takes what was allocated
+  char *method = request_strndup(s, r, SITE_method, line, sp0 - line);
+  char *path = request_strndup(s, r, SITE_path, sp0 + 1, sp1 - sp0 - 1);
+  header_t *headers =
+      request_alloc(s, r, SITE_headers, sizeof(header_t) * MAX_HEADERS);
+  if (!method || !path || !headers)
+    return -1;
+
+  size_t header_count = 0;
+  line = end + 2;
+  while (header_count < MAX_HEADERS && (end = strstr(line, "\r\n")) &&
+         end != line) {
+    char *colon = memchr(line, ':', end - line);
+    if (!colon)
+      return -1;
+
+    char *value = colon + 1;
+    while (*value == ' ')
+      value++;
+
+    headers[header_count].name =
+        request_strndup(s, r, SITE_header_name, line, colon - line);
+    headers[header_count].value =
+        request_strndup(s, r, SITE_header_value, value, end - value);
+    if (!headers[header_count].name || !headers[header_count].value)
+      return -1;
+
+    header_count++;
+    line = end + 2;
+  }
+
+  char *body = request_alloc(s, r, SITE_body, 256);
+  if (!body)
+    return -1;
+
+  int body_len = snprintf(body, 256, "%s %s with %zu headers, last=%s\n",
+                          method, path, header_count,
+                          header_count ? headers[header_count - 1].value : "");
+
+  char *response = request_alloc(s, r, SITE_response, 512);
+  if (!response)
+    return -1;
+
+  int len = snprintf(response, 512,
+                     "HTTP/1.1 200 OK\r\n"
+                     "Content-Type: text/plain\r\n"
+                     "Content-Length: %d\r\n"
+                     "\r\n"
+                     "%s",
+                     body_len, body);
+  request_release(s, r, SITE_body, body);
+
+  for (int written = 0; written < len;) {
+    ssize_t n = write(r->socket, response + written, len - written);
+    if (n < 0 && errno != EAGAIN)
+      return -1;
+    if (n > 0)
+      written += n;
+  }
+
+  request_release(s, r, SITE_response, response);
+  return 0;
+}
+
+static void server_close(server_t *s, request_t *r) {
+  epoll_ctl(s->epoll, EPOLL_CTL_DEL, r->socket, NULL);
+  close(r->socket);
+  request_free(s, r);
+  s->open--;
+}
+
+static void server_accept(server_t *s) {
+  int socket = accept4(s->listener, NULL, NULL, SOCK_NONBLOCK);
+  if (socket < 0)
+    return;
+
+  int one = 1;
+  setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  request_t *r = request_new(s, socket);
+  if (!r) {
+    close(socket);
+    return;
+  }
+
+  struct epoll_event ev = {.events = EPOLLIN, .data.ptr = r};
+  epoll_ctl(s->epoll, EPOLL_CTL_ADD, socket, &ev);
+  s->open++;
+}
+
+static void server_read(server_t *s, request_t *r) {
+  ssize_t n = read(r->socket, r->buffer + r->buffer_len,
+                   READ_BUFFER_SIZE - 1 - r->buffer_len);
+  if (n <= 0) {
+    if (n < 0 && errno == EAGAIN)
+      return;
+
+    server_close(s, r);
+    return;
+  }
+
+  r->buffer_len += n;
+  r->buffer[r->buffer_len] = 0;
+  if (!strstr(r->buffer, "\r\n\r\n")) {
+    if (r->buffer_len == READ_BUFFER_SIZE - 1)
+      server_close(s, r);
+    return;
+  }
+
+  if (request_handle(s, r) < 0) {
+    server_close(s, r);
+    return;
+  }
+
+  // the request is done, the next one on this socket gets a fresh struct
+  int socket = r->socket;
+  request_free(s, r);
+
+  r = request_new(s, socket);
+  if (!r) {
+    epoll_ctl(s->epoll, EPOLL_CTL_DEL, socket, NULL);
+    close(socket);
+    s->open--;
+    return;
+  }
+
+  struct epoll_event ev = {.events = EPOLLIN, .data.ptr = r};
+  epoll_ctl(s->epoll, EPOLL_CTL_MOD, socket, &ev);
+}
+
+static void *server_run(void *arg) {
+  server_t *s = arg;
+
+  struct epoll_event events[64];
+  // keep going until every client has hung up
+  while (!atomic_load_explicit(&s->done, memory_order_acquire) ||
+         s->open > 0) {
+    int n = epoll_wait(s->epoll, events, 64, 10);
+    for (int i = 0; i < n; i++) {
+      if (events[i].data.ptr == NULL)
+        server_accept(s);
+      else
+        server_read(s, events[i].data.ptr);
+    }
+  }
+
+  return NULL;
+}
+
+// --- Load generator:
+
+typedef struct client {
+  int port;
+  double latencies[REQUESTS_PER_CLIENT];
+} client_t;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *client_run(void *arg) {
+  client_t *c = arg;
+
+  int sock = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr = {.sin_family = AF_INET,
+                             .sin_port = htons(c->port),
+                             .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+  if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    perror("connect");
+    exit(EXIT_FAILURE);
+  }
+
+  int one = 1;
+  setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  static char const request[] = "GET /index.html HTTP/1.1\r\n"
+                                "Host: localhost\r\n"
+                                "User-Agent: allocators-bench/1.0\r\n"
+                                "Accept: */*\r\n"
+                                "Accept-Encoding: gzip, deflate\r\n"
+                                "Connection: keep-alive\r\n"
+                                "\r\n";
+
+  char buffer[1024];
+  for (size_t i = 0; i < REQUESTS_PER_CLIENT; i++) {
+    double start = now();
+    if (write(sock, request, sizeof(request) - 1) < 0) {
+      perror("write");
+      exit(EXIT_FAILURE);
+    }
+
+    // read until the end of the headers, then the rest of the body
+    size_t len = 0;
+    char *body = NULL;
+    size_t content_length = 0;
+    while (!body || len < (size_t)(body - buffer) + content_length) {
+      ssize_t n = read(sock, buffer + len, sizeof(buffer) - 1 - len);
+      if (n <= 0) {
+        perror("read");
+        exit(EXIT_FAILURE);
+      }
+
+      len += n;
+      buffer[len] = 0;
+      if (!body && (body = strstr(buffer, "\r\n\r\n"))) {
+        body += 4;
+        char *cl = strstr(buffer, "Content-Length: ");
+        content_length = cl ? strtoul(cl + 16, NULL, 10) : 0;
+      }
+    }
+
+    c->latencies[i] = now() - start;
+  }
+
+  close(sock);
+  return NULL;
+}
+
+static int compare_double(void const *a, void const *b) {
+  double x = *(double const *)a, y = *(double const *)b;
+  return (x > y) - (x < y);
+}
+
+// Resident set size in KiB.
+static long rss_kib(void) {
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (!f)
+    return -1;
+
+  long size, resident;
+  if (fscanf(f, "%ld %ld", &size, &resident) != 2)
+    resident = -1;
+  fclose(f);
+
+  return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static site_stats_t site_stats[SITE_COUNT];
+
+static void bench(alloc_mode_t mode) {
+  // the arenas live inside the pooled structs, so they must start out empty
+  static request_t request_buffer[MAX_REQUESTS];
+  memset(request_buffer, 0, sizeof(request_buffer));
+
+  server_t s = {.mode = mode};
+  ba_init(&s.requests, (uint8_t *)request_buffer, sizeof(request_buffer),
+          sizeof(request_t));
+
+  // a block per site per request in flight, the pools never run out
+  size_t pool_total = 0;
+  for (size_t i = 0; i < SITE_POOL_COUNT; i++)
+    pool_total += site_pool_sizes[i] * MAX_REQUESTS;
+  uint8_t *pool_memory = pool_total ? malloc(pool_total) : NULL;
+  site_ctx_init(&s.sites, site_pool_sizes, SITE_POOL_COUNT, MAX_REQUESTS,
+                pool_memory);
+  s.sites.stats = site_stats;
+
+  s.listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  struct sockaddr_in addr = {.sin_family = AF_INET,
+                             .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+  socklen_t addr_len = sizeof(addr);
+  if (bind(s.listener, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(s.listener, CLIENTS) < 0 ||
+      getsockname(s.listener, (struct sockaddr *)&addr, &addr_len) < 0) {
+    perror("listen");
+    exit(EXIT_FAILURE);
+  }
+
+  s.epoll = epoll_create1(0);
+  struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL};
+  epoll_ctl(s.epoll, EPOLL_CTL_ADD, s.listener, &ev);
+
+  pthread_t server_thread;
+  pthread_create(&server_thread, NULL, server_run, &s);
+
+  static client_t clients[CLIENTS];
+  pthread_t client_threads[CLIENTS];
+
+  double start = now();
+  for (size_t i = 0; i < CLIENTS; i++) {
+    clients[i].port = ntohs(addr.sin_port);
+    pthread_create(&client_threads[i], NULL, client_run, &clients[i]);
+  }
+
+  for (size_t i = 0; i < CLIENTS; i++)
+    pthread_join(client_threads[i], NULL);
+  double elapsed = now() - start;
+  long rss = rss_kib();
+
+  atomic_store_explicit(&s.done, 1, memory_order_release);
+  pthread_join(server_thread, NULL);
+  close(s.epoll);
+  close(s.listener);
+
+  // give back the blocks retained by the pooled structs
+  for (size_t i = 0; i < MAX_REQUESTS; i++)
+    arena_clear(&request_buffer[i].arena);
+  free(pool_memory);
+
+  size_t total = CLIENTS * REQUESTS_PER_CLIENT;
+  static double latencies[CLIENTS * REQUESTS_PER_CLIENT];
+  for (size_t i = 0; i < CLIENTS; i++) {
+    memcpy(latencies + i * REQUESTS_PER_CLIENT, clients[i].latencies,
+           sizeof(clients[i].latencies));
+  }
+  qsort(latencies, total, sizeof(double), compare_double);
+
+  printf("%-13s %9.0f req/s  p50=%6.1fus p90=%6.1fus p99=%6.1fus "
+         "p99.9=%7.1fus  rss=%ldKiB\n",
+         mode_names[mode], total / elapsed, latencies[total / 2] * 1e6,
+         latencies[total * 90 / 100] * 1e6, latencies[total * 99 / 100] * 1e6,
+         latencies[total * 999 / 1000] * 1e6, rss);
+}
+
+int main(void) {
+#ifdef SITE_PROFILE
+  // everything goes to malloc, the numbers are only for comparison
+  bench(MODE_SITES);
+
+  FILE *f = fopen("http_server.profile", "w");
+  if (!f) {
+    perror("http_server.profile");
+    return EXIT_FAILURE;
+  }
+
+  site_ctx_t c = {.stats = site_stats};
+  site_profile_write(&c, site_names, SITE_COUNT, f);
+  fclose(f);
+#else
+  for (alloc_mode_t mode = MODE_MALLOC; mode <= MODE_SITES; mode++) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+      perror("fork");
+      return EXIT_FAILURE;
+    }
+
+    if (pid == 0) {
+      bench(mode);
+      exit(EXIT_SUCCESS);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != EXIT_SUCCESS)
+      return EXIT_FAILURE;
+  }
+#endif
+
+  return EXIT_SUCCESS;
+}
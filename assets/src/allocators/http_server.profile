@@ -0,0 +1,8 @@
+read_buffer 80004 2048 2048 0 80004 0
+method 80000 4 4 0 80000 0
+path 80000 12 12 0 80000 0
+headers 80000 512 512 0 80000 0
+header_name 400000 5 16 0 400000 0
+header_value 400000 4 21 0 400000 0
+body 80000 256 256 80000 0 0
+response 80000 512 512 80000 0 0
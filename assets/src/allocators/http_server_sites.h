@@ -0,0 +1,17 @@
+// Generated by site_gen from a profile, do not edit.
+
+static const site_route_t site_routes[SITE_COUNT] = {
+    [SITE_read_buffer] = {SITE_ARENA, 0, 0},
+    [SITE_method] = {SITE_ARENA, 0, 0},
+    [SITE_path] = {SITE_ARENA, 0, 0},
+    [SITE_headers] = {SITE_ARENA, 0, 0},
+    [SITE_header_name] = {SITE_ARENA, 0, 0},
+    [SITE_header_value] = {SITE_ARENA, 0, 0},
+    [SITE_body] = {SITE_POOL, 0, 256},
+    [SITE_response] = {SITE_POOL, 1, 512},
+};
+
+#define SITE_POOL_COUNT 2
+_Static_assert(SITE_POOL_COUNT <= SITE_MAX_POOLS,
+               "more pools than site_alloc.h has");
+static const size_t site_pool_sizes[SITE_MAX_POOLS] = {256, 512};
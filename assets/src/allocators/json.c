@@ -0,0 +1,302 @@
+#include "json.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Parse request-sized JSON bodies over and over, comparing the arena DOM with
+// a classic parser that mallocs every node, array and string.
+
+#define SCRATCH_SIZE (1 << 20)
+#define BODY_OBJECTS 16
+#define ROUNDS 20000
+
+// --- The malloc version, for comparison:
+
+typedef struct mjson_parser {
+  char const *s;
+  char const *end;
+} mjson_parser_t;
+
+static void mjson_skip_space(mjson_parser_t *p) {
+  while (p->s < p->end && json_is_space(*p->s))
+    p->s++;
+}
+
+static bool mjson_parse_value(mjson_parser_t *p, json_value_t *v);
+
+static bool mjson_parse_string(mjson_parser_t *p, char const **str,
+                               size_t *len) {
+  if (p->s == p->end || *p->s != '"')
+    return false;
+
+  char const *start = ++p->s;
+  while (p->s < p->end && *p->s != '"')
+    p->s += *p->s == '\\' ? 2 : 1;
+  if (p->s >= p->end)
+    return false;
+
+  // always a copy, unescaped in place
+  char *out = malloc(p->s - start + 1);
+  size_t n = 0;
+  for (char const *c = start; c < p->s; c++) {
+    if (*c == '\\') {
+      c++;
+      switch (*c) {
+      case 'n':
+        out[n++] = '\n';
+        break;
+      case 't':
+        out[n++] = '\t';
+        break;
+      default:
+        out[n++] = *c;
+        break;
+      }
+    } else {
+      out[n++] = *c;
+    }
+  }
+  out[n] = 0;
+
+  p->s++;
+  *str = out;
+  *len = n;
+  return true;
+}
+
+static bool mjson_parse_value(mjson_parser_t *p, json_value_t *v) {
+  mjson_skip_space(p);
+  if (p->s == p->end)
+    return false;
+
+  switch (*p->s) {
+  case '[': {
+    p->s++;
+    size_t cap = 0;
+    *v = (json_value_t){.type = JSON_ARRAY};
+    mjson_skip_space(p);
+    if (p->s < p->end && *p->s == ']') {
+      p->s++;
+      return true;
+    }
+    for (;;) {
+      if (v->array.count == cap) {
+        cap = cap ? cap * 2 : 4;
+        v->array.items = realloc(v->array.items, cap * sizeof(json_value_t));
+      }
+      if (!mjson_parse_value(p, &v->array.items[v->array.count++]))
+        return false;
+      mjson_skip_space(p);
+      if (p->s < p->end && *p->s == ',') {
+        p->s++;
+        continue;
+      }
+      if (p->s < p->end && *p->s == ']') {
+        p->s++;
+        return true;
+      }
+      return false;
+    }
+  }
+  case '{': {
+    p->s++;
+    size_t cap = 0;
+    *v = (json_value_t){.type = JSON_OBJECT};
+    mjson_skip_space(p);
+    if (p->s < p->end && *p->s == '}') {
+      p->s++;
+      return true;
+    }
+    for (;;) {
+      if (v->object.count == cap) {
+        cap = cap ? cap * 2 : 4;
+        v->object.members =
+            realloc(v->object.members, cap * sizeof(json_member_t));
+      }
+      json_member_t *m = &v->object.members[v->object.count++];
+      *m = (json_member_t){};
+      mjson_skip_space(p);
+      if (!mjson_parse_string(p, &m->key, &m->key_len))
+        return false;
+      mjson_skip_space(p);
+      if (p->s == p->end || *p->s++ != ':')
+        return false;
+      if (!mjson_parse_value(p, &m->value))
+        return false;
+      mjson_skip_space(p);
+      if (p->s < p->end && *p->s == ',') {
+        p->s++;
+        continue;
+      }
+      if (p->s < p->end && *p->s == '}') {
+        p->s++;
+        return true;
+      }
+      return false;
+    }
+  }
+  case '"':
+    v->type = JSON_STRING;
+    return mjson_parse_string(p, &v->string.ptr, &v->string.len);
+  default: {
+    if (p->end - p->s >= 4 && memcmp(p->s, "null", 4) == 0) {
+      v->type = JSON_NULL;
+      p->s += 4;
+      return true;
+    }
+    if (p->end - p->s >= 4 && memcmp(p->s, "true", 4) == 0) {
+      v->type = JSON_TRUE;
+      p->s += 4;
+      return true;
+    }
+    if (p->end - p->s >= 5 && memcmp(p->s, "false", 5) == 0) {
+      v->type = JSON_FALSE;
+      p->s += 5;
+      return true;
+    }
+
+    char *num_end;
+    v->type = JSON_NUMBER;
+    v->number = strtod(p->s, &num_end);
+    if (num_end == p->s)
+      return false;
+    p->s = num_end;
+    return true;
+  }
+  }
+}
+
+static void mjson_free(json_value_t *v) {
+  switch (v->type) {
+  case JSON_STRING:
+    free((char *)v->string.ptr);
+    break;
+  case JSON_ARRAY:
+    for (size_t i = 0; i < v->array.count; i++)
+      mjson_free(&v->array.items[i]);
+    free(v->array.items);
+    break;
+  case JSON_OBJECT:
+    for (size_t i = 0; i < v->object.count; i++) {
+      free((char *)v->object.members[i].key);
+      mjson_free(&v->object.members[i].value);
+    }
+    free(v->object.members);
+    break;
+  default:
+    break;
+  }
+}
+
+// --- Example and benchmark:
+
+static void print_value(json_value_t const *v) {
+  switch (v->type) {
+  case JSON_NULL:
+    printf("null");
+    break;
+  case JSON_FALSE:
+    printf("false");
+    break;
+  case JSON_TRUE:
+    printf("true");
+    break;
+  case JSON_NUMBER:
+    printf("%g", v->number);
+    break;
+  case JSON_STRING:
+    printf("\"%.*s\"", (int)v->string.len, v->string.ptr);
+    break;
+  case JSON_ARRAY:
+    printf("[");
+    for (size_t i = 0; i < v->array.count; i++) {
+      printf(i ? "," : "");
+      print_value(&v->array.items[i]);
+    }
+    printf("]");
+    break;
+  case JSON_OBJECT:
+    printf("{");
+    for (size_t i = 0; i < v->object.count; i++) {
+      json_member_t const *m = &v->object.members[i];
+      printf("%s\"%.*s\":", i ? "," : "", (int)m->key_len, m->key);
+      print_value(&m->value);
+    }
+    printf("}");
+    break;
+  }
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(void) {
+  static uint8_t scratch_buffer[SCRATCH_SIZE];
+  fba_t scratch;
+  fba_init(&scratch, scratch_buffer, sizeof(scratch_buffer));
+
+  arena_t arena = {};
+
+  static char const *examples[] = {
+      "{\"a\": [1, 2.5e3, -0.25, true, false, null], \"b\": {}}",
+      "[\"plain\", \"esc\\\"aped \\\\\", \"\\u00e9\\ud83d\\ude00\", []]",
+      "  42  ",
+      "{\"unterminated\": [1, 2}",
+      "[1 2]",
+  };
+
+  for (size_t i = 0; i < sizeof(examples) / sizeof(*examples); i++) {
+    json_value_t *v =
+        json_parse(&arena, &scratch, examples[i], strlen(examples[i]));
+    if (v)
+      print_value(v);
+    else
+      printf("invalid");
+    printf("\n");
+  }
+  arena_reset(&arena);
+
+  // a request body: an array of small records
+  static char body[BODY_OBJECTS * 256];
+  size_t len = snprintf(body, sizeof(body), "[");
+  for (int i = 0; i < BODY_OBJECTS; i++) {
+    len += snprintf(body + len, sizeof(body) - len,
+                    "%s{\"id\": %d, \"name\": \"user%d\", \"email\": "
+                    "\"user%d@example.com\", \"tags\": [\"a\", \"b\", \"c\"], "
+                    "\"score\": %d.5, \"active\": %s, "
+                    "\"bio\": \"line\\nbreak\"}",
+                    i ? ", " : "", i, i, i, i, i % 2 ? "true" : "false");
+  }
+  len += snprintf(body + len, sizeof(body) - len, "]");
+
+  double start = now();
+  for (int i = 0; i < ROUNDS; i++) {
+    json_value_t *v = json_parse(&arena, &scratch, body, len);
+    if (!v || v->array.count != BODY_OBJECTS)
+      return EXIT_FAILURE;
+    arena_reset(&arena);
+  }
+  double elapsed = now() - start;
+  printf("arena:  %7.1f MB/s, %7.0f ns/body\n",
+         len * (double)ROUNDS / elapsed / 1e6, elapsed * 1e9 / ROUNDS);
+
+  start = now();
+  for (int i = 0; i < ROUNDS; i++) {
+    json_value_t v;
+    mjson_parser_t p = {.s = body, .end = body + len};
+    if (!mjson_parse_value(&p, &v) || v.array.count != BODY_OBJECTS)
+      return EXIT_FAILURE;
+    mjson_free(&v);
+  }
+  elapsed = now() - start;
+  printf("malloc: %7.1f MB/s, %7.0f ns/body\n",
+         len * (double)ROUNDS / elapsed / 1e6, elapsed * 1e9 / ROUNDS);
+
+  arena_clear(&arena);
+
+  return EXIT_SUCCESS;
+}
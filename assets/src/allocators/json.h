@@ -0,0 +1,571 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "arena.h"
+#include "fba.h"
+
+// A JSON parser that puts the whole DOM in an arena.
+//
+// Parsing is done in two passes. The first one finds every structural
+// character (`{}[]:,` outside of strings, and the quotes themselves) 64 bytes
+// at a time and writes their positions to an index. The second one walks the
+// index and builds the values.
+//
+// Arrays and objects are collected in a scratch `fba_t` and copied to the
+// arena once their size is known, so the arena only ever gets the final
+// copy. Strings without escapes point straight into the input, which must
+// outlive the DOM.
+
+typedef enum json_type {
+  JSON_NULL,
+  JSON_FALSE,
+  JSON_TRUE,
+  JSON_NUMBER,
+  JSON_STRING,
+  JSON_ARRAY,
+  JSON_OBJECT,
+} json_type_t;
+
+typedef struct json_member json_member_t;
+
+typedef struct json_value {
+  json_type_t type;
+  union {
+    double number;
+    struct {
+      char const *ptr;
+      size_t len;
+    } string;
+    struct {
+      struct json_value *items;
+      size_t count;
+    } array;
+    struct {
+      json_member_t *members;
+      size_t count;
+    } object;
+  };
+} json_value_t;
+
+struct json_member {
+  char const *key;
+  size_t key_len;
+  json_value_t value;
+};
+
+#define JSON_MAX_DEPTH 512
+
+typedef struct json_parser {
+  arena_t *arena;
+  fba_t *scratch;
+
+  char const *buf;
+  size_t len;
+
+  // positions of the structural characters, with `len` at the end
+  uint32_t *index;
+  size_t cursor;
+  size_t pos;
+
+  int depth;
+} json_parser_t;
+
+// --- Pass 1: structural index
+
+#define JSON_ODD_BITS 0xaaaaaaaaaaaaaaaaull
+
+// State carried from one 64 byte chunk to the next.
+typedef struct json_scan_state {
+  uint64_t next_is_escaped;
+  uint64_t in_string;
+} json_scan_state_t;
+
+// Bit `i` is set for every byte `i` of the chunk equal to `c`.
+static inline uint64_t json_eq_mask(uint8_t const *chunk, uint8_t c) {
+#ifdef __SSE2__
+  __m128i vc = _mm_set1_epi8((char)c);
+  uint64_t mask = 0;
+  for (int i = 0; i < 4; i++) {
+    __m128i v = _mm_loadu_si128((__m128i const *)(chunk + i * 16));
+    mask |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, vc))
+            << (i * 16);
+  }
+
+  return mask;
+#else
+  uint64_t mask = 0;
+  for (int i = 0; i < 64; i++)
+    mask |= (uint64_t)(chunk[i] == c) << i;
+
+  return mask;
+#endif
+}
+
+// Bytes that are escaped by an odd run of backslashes before them.
+static inline uint64_t json_escaped(json_scan_state_t *s, uint64_t backslash) {
+  if (!backslash) {
+    uint64_t escaped = s->next_is_escaped;
+    s->next_is_escaped = 0;
+    return escaped;
+  }
+
+  // a run of backslashes starting on an even bit carries into the odd bit
+  // after it when its length is odd, and the other way around
+  uint64_t potential = backslash & ~s->next_is_escaped;
+  uint64_t maybe_escaped = (potential << 1) | JSON_ODD_BITS;
+  uint64_t codes = (maybe_escaped - potential) ^ JSON_ODD_BITS;
+
+  uint64_t escaped = codes ^ (backslash | s->next_is_escaped);
+  s->next_is_escaped = (codes & backslash) >> 63;
+  return escaped;
+}
+
+// Each bit is the xor of itself and all bits below it.
+static inline uint64_t json_prefix_xor(uint64_t x) {
+  x ^= x << 1;
+  x ^= x << 2;
+  x ^= x << 4;
+  x ^= x << 8;
+  x ^= x << 16;
+  x ^= x << 32;
+  return x;
+}
+
+static inline uint64_t json_structurals(json_scan_state_t *s,
+                                        uint8_t const *chunk) {
+  uint64_t backslash = json_eq_mask(chunk, '\\');
+  uint64_t quotes = json_eq_mask(chunk, '"') & ~json_escaped(s, backslash);
+
+  uint64_t in_string = json_prefix_xor(quotes) ^ s->in_string;
+  s->in_string = (uint64_t)((int64_t)in_string >> 63);
+
+  uint64_t ops = json_eq_mask(chunk, '{') | json_eq_mask(chunk, '}') |
+                 json_eq_mask(chunk, '[') | json_eq_mask(chunk, ']') |
+                 json_eq_mask(chunk, ':') | json_eq_mask(chunk, ',');
+
+  return (ops & ~in_string) | quotes;
+}
+
+// Build the index in the scratch buffer. Returns false if it doesn't fit.
+static bool json_build_index(json_parser_t *p) {
+  if (p->len >= UINT32_MAX)
+    return false;
+
+  p->index = (uint32_t *)fba_alloc_opt(
+      p->scratch, (p->len + 1) * sizeof(uint32_t), _Alignof(uint32_t));
+  if (!p->index)
+    return false;
+
+  json_scan_state_t s = {};
+  uint8_t const *buf = (uint8_t const *)p->buf;
+  size_t n = 0;
+
+  for (size_t base = 0; base < p->len; base += 64) {
+    uint8_t const *chunk = buf + base;
+
+    // the last chunk is padded with spaces
+    uint8_t tail[64];
+    if (p->len - base < 64) {
+      memset(tail, ' ', sizeof(tail));
+      memcpy(tail, chunk, p->len - base);
+      chunk = tail;
+    }
+
+    uint64_t mask = json_structurals(&s, chunk);
+    while (mask) {
+      p->index[n++] = (uint32_t)(base + __builtin_ctzll(mask));
+      mask &= mask - 1;
+    }
+  }
+
+  p->index[n] = (uint32_t)p->len;
+  return true;
+}
+
+// --- Pass 2: building the DOM
+
+static inline bool json_is_space(char c) {
+  return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+static inline void json_skip_space(json_parser_t *p) {
+  while (p->pos < p->len && json_is_space(p->buf[p->pos]))
+    p->pos++;
+}
+
+// Consume the next structural character if it is `c` and there is only
+// whitespace before it.
+static inline bool json_expect(json_parser_t *p, char c) {
+  json_skip_space(p);
+
+  size_t at = p->index[p->cursor];
+  if (at != p->pos || at == p->len || p->buf[at] != c)
+    return false;
+
+  p->cursor++;
+  p->pos = at + 1;
+  return true;
+}
+
+static inline int json_hex(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+
+  return -1;
+}
+
+static inline int32_t json_hex4(char const *s) {
+  int32_t v = 0;
+  for (int i = 0; i < 4; i++) {
+    int h = json_hex(s[i]);
+    if (h < 0)
+      return -1;
+    v = v << 4 | h;
+  }
+
+  return v;
+}
+
+static inline size_t json_utf8(char *out, uint32_t cp) {
+  if (cp < 0x80) {
+    out[0] = (char)cp;
+    return 1;
+  }
+  if (cp < 0x800) {
+    out[0] = (char)(0xc0 | cp >> 6);
+    out[1] = (char)(0x80 | (cp & 0x3f));
+    return 2;
+  }
+  if (cp < 0x10000) {
+    out[0] = (char)(0xe0 | cp >> 12);
+    out[1] = (char)(0x80 | (cp >> 6 & 0x3f));
+    out[2] = (char)(0x80 | (cp & 0x3f));
+    return 3;
+  }
+
+  out[0] = (char)(0xf0 | cp >> 18);
+  out[1] = (char)(0x80 | (cp >> 12 & 0x3f));
+  out[2] = (char)(0x80 | (cp >> 6 & 0x3f));
+  out[3] = (char)(0x80 | (cp & 0x3f));
+  return 4;
+}
+
+// Unescape `[s, end)` into the arena. The result is never longer than the
+// input, so that is all we allocate.
+static char const *json_unescape(json_parser_t *p, char const *s,
+                                 char const *end, size_t *len) {
+  char *out = (char *)arena_alloc(p->arena, end - s, 1);
+  if (!out)
+    return NULL;
+
+  size_t n = 0;
+  while (s < end) {
+    if (*s != '\\') {
+      out[n++] = *s++;
+      continue;
+    }
+
+    if (s + 1 >= end)
+      return NULL;
+
+    char c = s[1];
+    s += 2;
+    switch (c) {
+    case '"':
+    case '\\':
+    case '/':
+      out[n++] = c;
+      break;
+    case 'b':
+      out[n++] = '\b';
+      break;
+    case 'f':
+      out[n++] = '\f';
+      break;
+    case 'n':
+      out[n++] = '\n';
+      break;
+    case 'r':
+      out[n++] = '\r';
+      break;
+    case 't':
+      out[n++] = '\t';
+      break;
+    case 'u': {
+      if (end - s < 4)
+        return NULL;
+      int32_t cp = json_hex4(s);
+      if (cp < 0)
+        return NULL;
+      s += 4;
+
+      // surrogate pair
+      if (cp >= 0xd800 && cp < 0xdc00) {
+        if (end - s < 6 || s[0] != '\\' || s[1] != 'u')
+          return NULL;
+        int32_t lo = json_hex4(s + 2);
+        if (lo < 0xdc00 || lo >= 0xe000)
+          return NULL;
+        cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+        s += 6;
+      }
+
+      n += json_utf8(out + n, (uint32_t)cp);
+      break;
+    }
+    default:
+      return NULL;
+    }
+  }
+
+  *len = n;
+  return out;
+}
+
+// Parse a string, the opening quote is the current structural.
+static bool json_parse_string(json_parser_t *p, char const **str,
+                              size_t *len) {
+  if (!json_expect(p, '"'))
+    return false;
+
+  // the closing quote is always the next structural
+  size_t close = p->index[p->cursor];
+  if (close == p->len)
+    return false;
+
+  char const *s = p->buf + p->pos;
+  char const *end = p->buf + close;
+  p->cursor++;
+  p->pos = close + 1;
+
+  for (char const *c = s; c < end; c++) {
+    if ((unsigned char)*c < 0x20)
+      return false;
+  }
+
+  if (!memchr(s, '\\', end - s)) {
+    *str = s;
+    *len = end - s;
+    return true;
+  }
+
+  *str = json_unescape(p, s, end, len);
+  return *str != NULL;
+}
+
+// Parse a number or literal, they run until the next structural character.
+static bool json_parse_atom(json_parser_t *p, json_value_t *v) {
+  char const *s = p->buf + p->pos;
+  char const *end = p->buf + p->index[p->cursor];
+  while (end > s && json_is_space(end[-1]))
+    end--;
+
+  size_t len = end - s;
+  p->pos = end - p->buf;
+
+  if (len == 4 && memcmp(s, "null", 4) == 0) {
+    v->type = JSON_NULL;
+    return true;
+  }
+  if (len == 4 && memcmp(s, "true", 4) == 0) {
+    v->type = JSON_TRUE;
+    return true;
+  }
+  if (len == 5 && memcmp(s, "false", 5) == 0) {
+    v->type = JSON_FALSE;
+    return true;
+  }
+
+  // validate the grammar: -? int frac? exp?
+  char const *c = s;
+  if (c < end && *c == '-')
+    c++;
+  if (c < end && *c == '0') {
+    c++;
+  } else {
+    if (c == end || *c < '1' || *c > '9')
+      return false;
+    while (c < end && *c >= '0' && *c <= '9')
+      c++;
+  }
+  if (c < end && *c == '.') {
+    c++;
+    if (c == end || *c < '0' || *c > '9')
+      return false;
+    while (c < end && *c >= '0' && *c <= '9')
+      c++;
+  }
+  if (c < end && (*c == 'e' || *c == 'E')) {
+    c++;
+    if (c < end && (*c == '+' || *c == '-'))
+      c++;
+    if (c == end || *c < '0' || *c > '9')
+      return false;
+    while (c < end && *c >= '0' && *c <= '9')
+      c++;
+  }
+  if (c != end)
+    return false;
+
+  // the input is not nul terminated, so give strtod a copy
+  char tmp[64];
+  char *num = tmp;
+  if (len >= sizeof(tmp)) {
+    num = (char *)arena_alloc(p->arena, len + 1, 1);
+    if (!num)
+      return false;
+  }
+  memcpy(num, s, len);
+  num[len] = 0;
+
+  v->type = JSON_NUMBER;
+  v->number = strtod(num, NULL);
+  return true;
+}
+
+static bool json_parse_value(json_parser_t *p, json_value_t *v);
+
+static bool json_parse_array(json_parser_t *p, json_value_t *v) {
+  p->cursor++;
+  p->pos++;
+
+  // the items go to the scratch buffer first, nested values push their own
+  // items after ours and pop them before we continue
+  json_value_t *items = (json_value_t *)ALIGN_TO(
+      (uintptr_t)p->scratch->head, _Alignof(json_value_t));
+  size_t count = 0;
+
+  if (!json_expect(p, ']')) {
+    do {
+      json_value_t *item = (json_value_t *)fba_alloc_opt(
+          p->scratch, sizeof(json_value_t), _Alignof(json_value_t));
+      if (!item || !json_parse_value(p, item))
+        return false;
+      count++;
+    } while (json_expect(p, ','));
+
+    if (!json_expect(p, ']'))
+      return false;
+  }
+
+  v->type = JSON_ARRAY;
+  v->array.count = count;
+  v->array.items = NULL;
+  if (count) {
+    v->array.items = (json_value_t *)arena_alloc(
+        p->arena, count * sizeof(json_value_t), _Alignof(json_value_t));
+    if (!v->array.items)
+      return false;
+    memcpy(v->array.items, items, count * sizeof(json_value_t));
+  }
+
+  p->scratch->head = (uint8_t *)items;
+  return true;
+}
+
+static bool json_parse_object(json_parser_t *p, json_value_t *v) {
+  p->cursor++;
+  p->pos++;
+
+  json_member_t *members = (json_member_t *)ALIGN_TO(
+      (uintptr_t)p->scratch->head, _Alignof(json_member_t));
+  size_t count = 0;
+
+  if (!json_expect(p, '}')) {
+    do {
+      json_member_t *m = (json_member_t *)fba_alloc_opt(
+          p->scratch, sizeof(json_member_t), _Alignof(json_member_t));
+      if (!m || !json_parse_string(p, &m->key, &m->key_len) ||
+          !json_expect(p, ':') || !json_parse_value(p, &m->value))
+        return false;
+      count++;
+    } while (json_expect(p, ','));
+
+    if (!json_expect(p, '}'))
+      return false;
+  }
+
+  v->type = JSON_OBJECT;
+  v->object.count = count;
+  v->object.members = NULL;
+  if (count) {
+    v->object.members = (json_member_t *)arena_alloc(
+        p->arena, count * sizeof(json_member_t), _Alignof(json_member_t));
+    if (!v->object.members)
+      return false;
+    memcpy(v->object.members, members, count * sizeof(json_member_t));
+  }
+
+  p->scratch->head = (uint8_t *)members;
+  return true;
+}
+
+static bool json_parse_value(json_parser_t *p, json_value_t *v) {
+  json_skip_space(p);
+  if (p->pos == p->len)
+    return false;
+
+  // anything that is not at a structural position is an atom
+  if (p->index[p->cursor] != p->pos)
+    return json_parse_atom(p, v);
+
+  if (++p->depth > JSON_MAX_DEPTH)
+    return false;
+
+  bool ok;
+  switch (p->buf[p->pos]) {
+  case '[':
+    ok = json_parse_array(p, v);
+    break;
+  case '{':
+    ok = json_parse_object(p, v);
+    break;
+  case '"':
+    v->type = JSON_STRING;
+    ok = json_parse_string(p, &v->string.ptr, &v->string.len);
+    break;
+  default:
+    ok = false;
+    break;
+  }
+
+  p->depth--;
+  return ok;
+}
+
+// Parse `buf` into a DOM allocated in `arena`. `scratch` holds the index and
+// the values of unfinished arrays and objects, it needs about 4 bytes per
+// input byte plus the widest array in flight, and is left as it was on
+// return. Returns `NULL` if the input is invalid or anything runs out of
+// memory.
+static json_value_t *json_parse(arena_t *arena, fba_t *scratch,
+                                char const *buf, size_t len) {
+  uint8_t *scratch_head = scratch->head;
+  json_parser_t p = {
+      .arena = arena, .scratch = scratch, .buf = buf, .len = len};
+
+  json_value_t *root = NULL;
+  if (json_build_index(&p)) {
+    root = (json_value_t *)arena_alloc(arena, sizeof(json_value_t),
+                                       _Alignof(json_value_t));
+    if (root && (!json_parse_value(&p, root) ||
+                 (json_skip_space(&p), p.pos != len)))
+      root = NULL;
+  }
+
+  scratch->head = scratch_head;
+  return root;
+}
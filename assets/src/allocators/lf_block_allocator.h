@@ -0,0 +1,95 @@
+#pragma once
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// A lock-free block allocator.
+//
+// The same idea as `block_allocator_t`, a list of free blocks carved out of a
+// buffer, but any thread may alloc and free at the same time. The list head
+// is swapped with compare-and-swap. To avoid the ABA problem (a block popped
+// and pushed back between our read of the head and our CAS) the head is not
+// a pointer but a 32 bit block index and a 32 bit tag that changes on every
+// update, packed in a single 64 bit word.
+
+#define LFBA_NIL UINT32_MAX
+
+typedef struct lf_block_allocator_block {
+  _Atomic uint32_t next;
+} lf_block_allocator_block_t;
+
+typedef struct lf_block_allocator {
+  uint8_t *buffer;
+  uint8_t *buffer_end;
+  size_t item_size;
+  // tag in the high half, index of the first free block in the low half
+  _Atomic uint64_t head;
+} lf_block_allocator_t;
+
+static inline lf_block_allocator_block_t *lfba_block(lf_block_allocator_t *ba,
+                                                     uint32_t i) {
+  return (lf_block_allocator_block_t *)(ba->buffer + (size_t)i * ba->item_size);
+}
+
+static void lfba_init(lf_block_allocator_t *ba, uint8_t *buffer,
+                      size_t buffer_size, size_t item_size) {
+  assert(item_size >= sizeof(lf_block_allocator_block_t));
+  size_t item_count = buffer_size / item_size;
+  assert(item_count < LFBA_NIL);
+
+  ba->buffer = buffer;
+  ba->buffer_end = buffer + buffer_size;
+  ba->item_size = item_size;
+
+  // initialize all of the blocks, this creates a linked list of free blocks
+  for (size_t i = 0; i < item_count; i++) {
+    uint32_t next = i + 1 < item_count ? (uint32_t)(i + 1) : LFBA_NIL;
+    atomic_init(&lfba_block(ba, (uint32_t)i)->next, next);
+  }
+
+  atomic_init(&ba->head, item_count ? 0 : LFBA_NIL);
+}
+
+static void *lfba_alloc(lf_block_allocator_t *ba) {
+  uint64_t head = atomic_load_explicit(&ba->head, memory_order_acquire);
+  for (;;) {
+    uint32_t i = (uint32_t)head;
+    if (i == LFBA_NIL)
+      return NULL;
+
+    // this may read a block that someone else just took, the tag makes the
+    // CAS fail in that case
+    uint32_t next = atomic_load_explicit(&lfba_block(ba, i)->next,
+                                         memory_order_relaxed);
+    uint64_t new_head = ((head >> 32) + 1) << 32 | next;
+    if (atomic_compare_exchange_weak_explicit(&ba->head, &head, new_head,
+                                              memory_order_acquire,
+                                              memory_order_acquire))
+      return lfba_block(ba, i);
+  }
+}
+
+static void lfba_free(lf_block_allocator_t *ba, void *ptr) {
+  uint8_t *p = (uint8_t *)ptr;
+
+  // don't put in our list pointers that are not in our buffer
+  if (p < ba->buffer || p >= ba->buffer_end)
+    return;
+
+  uint32_t i = (uint32_t)((size_t)(p - ba->buffer) / ba->item_size);
+  lf_block_allocator_block_t *blk = lfba_block(ba, i);
+
+  uint64_t head = atomic_load_explicit(&ba->head, memory_order_relaxed);
+  for (;;) {
+    atomic_store_explicit(&blk->next, (uint32_t)head, memory_order_relaxed);
+
+    uint64_t new_head = ((head >> 32) + 1) << 32 | i;
+    if (atomic_compare_exchange_weak_explicit(&ba->head, &head, new_head,
+                                              memory_order_release,
+                                              memory_order_relaxed))
+      return;
+  }
+}
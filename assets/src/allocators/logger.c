@@ -0,0 +1,126 @@
+#define _GNU_SOURCE
+
+#include "logger.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Several threads logging request lines, each with a few numbers and a
+// string. The per-thread chunks with a flusher thread, against the usual
+// logger: format into a malloc'd string and `write` it under a global mutex.
+//
+// Logs to `/dev/null` by default, so that we measure the logging and not the
+// disk. Pass a path to log to a file, it ends up with every line twice, once
+// from each logger.
+
+#define THREADS 4
+#define LINES 500000
+#define CHUNKS 64
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static const char *paths[] = {"/", "/search", "/users/42/profile",
+                              "/static/app.js"};
+
+typedef struct thread_args {
+  unsigned id;
+  int fd;
+  logger_t *l;
+  pthread_mutex_t *lock;
+} thread_args_t;
+
+// --- The usual logger:
+
+static void *malloc_thread(void *arg) {
+  thread_args_t *a = (thread_args_t *)arg;
+
+  for (size_t i = 0; i < LINES; i++) {
+    char *line;
+    int n = asprintf(&line, "thread=%u req=%zu path=%s status=%d bytes=%zu",
+                     a->id, i, paths[i % 4], i % 7 ? 200 : 404, i * 31 % 9000);
+    line[n] = '\n';
+
+    pthread_mutex_lock(a->lock);
+    ssize_t written = write(a->fd, line, n + 1);
+    pthread_mutex_unlock(a->lock);
+    (void)written;
+
+    free(line);
+  }
+
+  return NULL;
+}
+
+// --- Per-thread chunks:
+
+static void *chunk_thread(void *arg) {
+  thread_args_t *a = (thread_args_t *)arg;
+  log_thread_t t;
+  log_thread_init(&t, a->l);
+
+  for (size_t i = 0; i < LINES; i++)
+    log_printf(&t, "thread=%u req=%zu path=%s status=%d bytes=%zu", a->id, i,
+               paths[i % 4], i % 7 ? 200 : 404, i * 31 % 9000);
+
+  log_thread_deinit(&t);
+  return NULL;
+}
+
+static double run(void *(*fn)(void *), thread_args_t *args, unsigned threads) {
+  pthread_t tids[threads];
+  double start = now();
+  for (unsigned i = 0; i < threads; i++)
+    pthread_create(&tids[i], NULL, fn, &args[i]);
+  for (unsigned i = 0; i < threads; i++)
+    pthread_join(tids[i], NULL);
+
+  return now() - start;
+}
+
+int main(int argc, char **argv) {
+  const char *path = argc > 1 ? argv[1] : "/dev/null";
+  unsigned threads = argc > 2 ? (unsigned)atoi(argv[2]) : THREADS;
+
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    perror(path);
+    return EXIT_FAILURE;
+  }
+
+  pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+  logger_t l;
+  if (!logger_init(&l, fd, CHUNKS, NULL)) {
+    perror("logger_init");
+    return EXIT_FAILURE;
+  }
+
+  thread_args_t args[threads];
+  for (unsigned i = 0; i < threads; i++)
+    args[i] = (thread_args_t){.id = i, .fd = fd, .l = &l, .lock = &lock};
+
+  size_t total = (size_t)threads * LINES;
+  printf("%u threads, %zu lines to %s\n", threads, total, path);
+
+  double elapsed = run(malloc_thread, args, threads);
+  printf("malloc + mutex: %7.1f ms, %5.1f M lines/s, %zu writes\n",
+         elapsed * 1e3, total / elapsed / 1e6, total);
+
+  // the flusher is part of the cost, wait for it too
+  elapsed = run(chunk_thread, args, threads);
+  double start = now();
+  logger_deinit(&l);
+  elapsed += now() - start;
+  printf("chunks:         %7.1f ms, %5.1f M lines/s, %zu writes "
+         "(%.1f MiB, %zu bytes dropped), %zu stalls\n",
+         elapsed * 1e3, total / elapsed / 1e6, l.writes, l.bytes / 1048576.0,
+         l.dropped, atomic_load(&l.stalls));
+
+  close(fd);
+  return EXIT_SUCCESS;
+}
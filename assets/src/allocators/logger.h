@@ -0,0 +1,279 @@
+#pragma once
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdalign.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <time.h>
+
+#include "arena_budget.h"
+#include "fba.h"
+#include "lf_block_allocator.h"
+
+// A logger where the threads that log never lock, allocate or make a syscall.
+//
+// Every thread formats its lines straight into a chunk of its own, with an
+// `fba_t` over the free part of it. When a line doesn't fit, the chunk is
+// pushed to a lock-free list and the thread takes a fresh one from a pool
+// (`lf_block_allocator_t`). A flusher thread takes the whole list at once,
+// writes every chunk with a single `writev`, and gives them back to the pool.
+//
+// Unlike `fba_sprintf`, a line is formatted once: `vsnprintf` writes to the
+// free space directly and we only format again into a new chunk when it
+// didn't fit. Lines stay in order per thread. A thread that logs little
+// should call `log_flush` now and then, or its lines wait for the chunk to
+// fill up.
+//
+// If the flusher falls behind and the pool runs dry, threads wait for it
+// (`stalls` counts how often).
+
+#define LOG_CHUNK_SIZE (64 << 10)
+// How long the flusher sleeps when there is nothing to write.
+#define LOG_FLUSH_INTERVAL_NS 1000000
+#define LOG_MAX_IOV 1024
+
+typedef struct log_chunk {
+  // the pool's free list link, a thread that lost the race for this chunk may
+  // still read it after we took it, so we never write over it
+  uint64_t pool_link;
+  struct log_chunk *next;
+  size_t len;
+  uint8_t data[];
+} log_chunk_t;
+
+typedef struct logger {
+  int fd;
+  lf_block_allocator_t pool;
+  uint8_t *pool_memory;
+  size_t pool_size;
+  arena_budget_t *budget;
+
+  // full chunks, newest first
+  alignas(64) _Atomic(log_chunk_t *) pending;
+
+  pthread_t flusher;
+  atomic_bool stop;
+
+  _Atomic size_t stalls;
+  size_t writes;
+  size_t bytes;
+  // lost to write errors
+  size_t dropped;
+} logger_t;
+
+// A thread's handle.
+typedef struct log_thread {
+  logger_t *l;
+  log_chunk_t *chunk;
+  fba_t fba;
+} log_thread_t;
+
+// Write all of `iov`, picking up after short writes. On an error the rest is
+// dropped and counted, there is nowhere to log it to.
+static void logger_writev(logger_t *l, struct iovec *iov, int count) {
+  while (count > 0) {
+    ssize_t n = writev(l->fd, iov, count);
+    l->writes++;
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+
+      for (int i = 0; i < count; i++)
+        l->dropped += iov[i].iov_len;
+      return;
+    }
+
+    l->bytes += n;
+    for (; count > 0 && (size_t)n >= iov->iov_len; iov++, count--)
+      n -= iov->iov_len;
+    if (count > 0) {
+      iov->iov_base = (uint8_t *)iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+}
+
+static void logger_write(logger_t *l, log_chunk_t *list) {
+  // oldest first
+  log_chunk_t *prev = NULL;
+  while (list) {
+    log_chunk_t *next = list->next;
+    list->next = prev;
+    prev = list;
+    list = next;
+  }
+
+  while (prev) {
+    struct iovec iov[LOG_MAX_IOV];
+    log_chunk_t *first = prev;
+    int count = 0;
+    for (; prev && count < LOG_MAX_IOV; prev = prev->next, count++)
+      iov[count] = (struct iovec){.iov_base = prev->data,
+                                  .iov_len = prev->len};
+
+    logger_writev(l, iov, count);
+
+    while (first != prev) {
+      log_chunk_t *next = first->next;
+      lfba_free(&l->pool, first);
+      first = next;
+    }
+  }
+}
+
+static void *logger_flusher(void *arg) {
+  logger_t *l = (logger_t *)arg;
+
+  for (;;) {
+    // check before taking the list, so that nothing pushed before `stop` is
+    // left behind
+    bool stop = atomic_load_explicit(&l->stop, memory_order_acquire);
+    log_chunk_t *list =
+        atomic_exchange_explicit(&l->pending, NULL, memory_order_acquire);
+
+    if (list)
+      logger_write(l, list);
+    else if (stop)
+      break;
+    else
+      nanosleep(&(struct timespec){.tv_nsec = LOG_FLUSH_INTERVAL_NS}, NULL);
+  }
+
+  return NULL;
+}
+
+// Log to `fd` with `chunks` chunks shared by all threads. The pool doesn't
+// grow, it is charged to `budget` (or NULL) all at once.
+static bool logger_init(logger_t *l, int fd, size_t chunks,
+                        arena_budget_t *budget) {
+  *l = (logger_t){
+      .fd = fd, .pool_size = chunks * LOG_CHUNK_SIZE, .budget = budget};
+  if (!arena_budget_charge(budget, l->pool_size))
+    return false;
+
+  l->pool_memory = (uint8_t *)mmap(NULL, l->pool_size, PROT_READ | PROT_WRITE,
+                                   MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  if (l->pool_memory == MAP_FAILED) {
+    arena_budget_uncharge(budget, l->pool_size);
+    return false;
+  }
+
+  lfba_init(&l->pool, l->pool_memory, l->pool_size, LOG_CHUNK_SIZE);
+  atomic_init(&l->pending, NULL);
+  atomic_init(&l->stop, false);
+  atomic_init(&l->stalls, 0);
+
+  if (pthread_create(&l->flusher, NULL, logger_flusher, l) != 0) {
+    munmap(l->pool_memory, l->pool_size);
+    arena_budget_uncharge(budget, l->pool_size);
+    return false;
+  }
+
+  return true;
+}
+
+// Every thread must have called `log_thread_deinit`.
+static void logger_deinit(logger_t *l) {
+  atomic_store_explicit(&l->stop, true, memory_order_release);
+  pthread_join(l->flusher, NULL);
+  munmap(l->pool_memory, l->pool_size);
+  arena_budget_uncharge(l->budget, l->pool_size);
+}
+
+static log_chunk_t *log_chunk_get(logger_t *l) {
+  log_chunk_t *c;
+  while (!(c = (log_chunk_t *)lfba_alloc(&l->pool))) {
+    atomic_fetch_add_explicit(&l->stalls, 1, memory_order_relaxed);
+    sched_yield();
+  }
+
+  return c;
+}
+
+static void log_submit(log_thread_t *t) {
+  log_chunk_t *c = t->chunk;
+  c->len = t->fba.head - t->fba.buffer;
+  t->chunk = NULL;
+
+  if (c->len == 0) {
+    lfba_free(&t->l->pool, c);
+    return;
+  }
+
+  c->next = atomic_load_explicit(&t->l->pending, memory_order_relaxed);
+  while (!atomic_compare_exchange_weak_explicit(&t->l->pending, &c->next, c,
+                                                memory_order_release,
+                                                memory_order_relaxed))
+    ;
+}
+
+static void log_take_chunk(log_thread_t *t) {
+  t->chunk = log_chunk_get(t->l);
+  fba_init(&t->fba, t->chunk->data, LOG_CHUNK_SIZE - sizeof(log_chunk_t));
+}
+
+static inline void log_thread_init(log_thread_t *t, logger_t *l) {
+  *t = (log_thread_t){.l = l};
+  log_take_chunk(t);
+}
+
+// Hand what was logged so far to the flusher.
+static inline void log_flush(log_thread_t *t) {
+  if (t->fba.head == t->fba.buffer)
+    return;
+
+  log_submit(t);
+  log_take_chunk(t);
+}
+
+static inline void log_thread_deinit(log_thread_t *t) {
+  log_submit(t);
+  *t = (log_thread_t){};
+}
+
+// Format one line, the newline is added. Lines longer than a chunk are cut.
+static void log_vprintf(log_thread_t *t, const char *format, va_list args) {
+  for (int attempt = 0; attempt < 2; attempt++) {
+    va_list args2;
+    va_copy(args2, args);
+    size_t avail = t->fba.buffer_end - t->fba.head;
+    int n = vsnprintf((char *)t->fba.head, avail, format, args2);
+    va_end(args2);
+
+    // room for the newline in place of the nul
+    if (n >= 0 && (size_t)n < avail) {
+      t->fba.head[n] = '\n';
+      t->fba.head += n + 1;
+      return;
+    }
+
+    // an encoding error, drop the line
+    if (n < 0)
+      return;
+
+    if (t->fba.head == t->fba.buffer) {
+      // too long for a whole chunk
+      t->fba.head = t->fba.buffer_end;
+      t->fba.head[-1] = '\n';
+      break;
+    }
+
+    log_submit(t);
+    log_take_chunk(t);
+  }
+}
+
+static void log_printf(log_thread_t *t, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  log_vprintf(t, format, args);
+  va_end(args);
+}
@@ -0,0 +1,245 @@
+#define _GNU_SOURCE
+
+#include "mpmc_queue.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+
+// Hand items from producer threads to consumer threads through the bounded
+// ring, the Michael-Scott queue and a linked list behind a mutex that mallocs
+// every node, which is what the work dispatch used to do. Half the threads
+// produce and half consume, with a single thread doing both.
+
+#define ITEMS (1 << 20)
+#define RING_SIZE 1024
+#define MS_NODES (1 << 20)
+
+typedef enum { QUEUE_RING, QUEUE_MS, QUEUE_LOCKED } queue_kind_t;
+
+static const char *queue_names[] = {"ring", "ms", "mutex"};
+
+typedef struct locked_node {
+  struct locked_node *next;
+  void *value;
+} locked_node_t;
+
+typedef struct locked_queue {
+  pthread_mutex_t lock;
+  locked_node_t *head;
+  locked_node_t *tail;
+} locked_queue_t;
+
+static bool locked_push(locked_queue_t *q, void *value) {
+  locked_node_t *n = malloc(sizeof(*n));
+  if (!n)
+    return false;
+  *n = (locked_node_t){.value = value};
+
+  pthread_mutex_lock(&q->lock);
+  if (q->tail)
+    q->tail->next = n;
+  else
+    q->head = n;
+  q->tail = n;
+  pthread_mutex_unlock(&q->lock);
+
+  return true;
+}
+
+static bool locked_pop(locked_queue_t *q, void **value) {
+  pthread_mutex_lock(&q->lock);
+  locked_node_t *n = q->head;
+  if (n) {
+    q->head = n->next;
+    if (!q->head)
+      q->tail = NULL;
+  }
+  pthread_mutex_unlock(&q->lock);
+
+  if (!n)
+    return false;
+
+  *value = n->value;
+  free(n);
+  return true;
+}
+
+typedef struct bench {
+  queue_kind_t kind;
+  mpmc_ring_t ring;
+  ms_queue_t ms;
+  locked_queue_t locked;
+
+  size_t producers;
+  size_t consumers;
+  _Atomic size_t consumed;
+  _Atomic uint64_t checksum;
+} bench_t;
+
+typedef struct worker {
+  bench_t *b;
+  size_t id;
+  bool produce;
+  bool consume;
+} worker_t;
+
+static bool push(bench_t *b, ms_thread_t *t, void *value) {
+  switch (b->kind) {
+  case QUEUE_RING:
+    return mpmc_ring_push(&b->ring, value);
+  case QUEUE_MS:
+    return ms_queue_push(&b->ms, t, value);
+  case QUEUE_LOCKED:
+    return locked_push(&b->locked, value);
+  }
+
+  return false;
+}
+
+static bool pop(bench_t *b, ms_thread_t *t, void **value) {
+  switch (b->kind) {
+  case QUEUE_RING:
+    return mpmc_ring_pop(&b->ring, value);
+  case QUEUE_MS:
+    return ms_queue_pop(&b->ms, t, value);
+  case QUEUE_LOCKED:
+    return locked_pop(&b->locked, value);
+  }
+
+  return false;
+}
+
+static void *worker(void *arg) {
+  worker_t *w = arg;
+  bench_t *b = w->b;
+
+  ms_thread_t t = {};
+  if (b->kind == QUEUE_MS && !ms_thread_init(&b->ms, &t)) {
+    fprintf(stderr, "out of epoch slots\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // producer `id` pushes every item `i` with `i % producers == id`, values
+  // start at 1 so that the checksum catches lost items
+  size_t next = w->id;
+  uint64_t sum = 0;
+
+  for (;;) {
+    bool busy = false;
+
+    if (w->produce && next < ITEMS) {
+      if (push(b, &t, (void *)(uintptr_t)(next + 1))) {
+        next += b->producers;
+        busy = true;
+      }
+    }
+
+    if (w->consume) {
+      if (atomic_load_explicit(&b->consumed, memory_order_relaxed) >= ITEMS)
+        break;
+
+      void *value;
+      if (pop(b, &t, &value)) {
+        sum += (uintptr_t)value;
+        atomic_fetch_add_explicit(&b->consumed, 1, memory_order_relaxed);
+        continue;
+      }
+    } else if (next >= ITEMS) {
+      break;
+    }
+
+    if (!busy)
+      sched_yield();
+  }
+
+  atomic_fetch_add(&b->checksum, sum);
+
+  if (b->kind == QUEUE_MS)
+    ms_thread_deinit(&b->ms, &t);
+
+  return NULL;
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double run(bench_t *b, size_t threads) {
+  b->producers = threads > 1 ? threads / 2 : 1;
+  b->consumers = threads > 1 ? threads - b->producers : 1;
+  atomic_store(&b->consumed, 0);
+  atomic_store(&b->checksum, 0);
+
+  worker_t workers[64];
+  pthread_t ids[64];
+  for (size_t i = 0; i < threads; i++) {
+    bool produce = threads == 1 || i < b->producers;
+    workers[i] = (worker_t){
+        .b = b,
+        .id = produce ? i : 0,
+        .produce = produce,
+        .consume = threads == 1 || !produce,
+    };
+  }
+
+  double start = now();
+  for (size_t i = 0; i < threads; i++)
+    pthread_create(&ids[i], NULL, worker, &workers[i]);
+  for (size_t i = 0; i < threads; i++)
+    pthread_join(ids[i], NULL);
+  double elapsed = now() - start;
+
+  uint64_t expected = (uint64_t)ITEMS * (ITEMS + 1) / 2;
+  if (atomic_load(&b->checksum) != expected) {
+    fprintf(stderr, "%s with %zu threads: lost or duplicated items\n",
+            queue_names[b->kind], threads);
+    exit(EXIT_FAILURE);
+  }
+
+  return ITEMS / elapsed / 1e6;
+}
+
+int main(void) {
+  static bench_t b;
+  static epoch_domain_t domain;
+  static mpmc_cell_t ring_buffer[RING_SIZE];
+
+  epoch_init(&domain);
+
+  size_t nodes_size = MS_NODES * sizeof(ms_node_t);
+  uint8_t *nodes = mmap(NULL, nodes_size, PROT_READ | PROT_WRITE,
+                        MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  if (nodes == MAP_FAILED) {
+    perror("mmap");
+    return EXIT_FAILURE;
+  }
+
+  pthread_mutex_init(&b.locked.lock, NULL);
+
+  printf("%8s %10s %10s %10s   (M items/s)\n", "threads", queue_names[0],
+         queue_names[1], queue_names[2]);
+
+  for (size_t threads = 1; threads <= 64; threads *= 2) {
+    double rates[3];
+    for (int k = QUEUE_RING; k <= QUEUE_LOCKED; k++) {
+      b.kind = (queue_kind_t)k;
+
+      // start every run from a fresh ring and node pool
+      mpmc_ring_init(&b.ring, (uint8_t *)ring_buffer, sizeof(ring_buffer));
+      ms_queue_init(&b.ms, &domain, nodes, nodes_size);
+
+      rates[k] = run(&b, threads);
+    }
+
+    printf("%8zu %10.2f %10.2f %10.2f\n", threads, rates[0], rates[1],
+           rates[2]);
+  }
+
+  munmap(nodes, nodes_size);
+  return EXIT_SUCCESS;
+}
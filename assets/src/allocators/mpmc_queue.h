@@ -0,0 +1,300 @@
+#pragma once
+
+#include <sched.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "epoch.h"
+#include "lf_block_allocator.h"
+
+// Align up the given integer to the given alignment.
+#define ALIGN_TO(_value, _alignment)                                           \
+  ((_value) + ((_alignment) - 1) & -(_alignment))
+
+// Multi-producer multi-consumer queues without locks.
+//
+// `mpmc_ring_t` is bounded: a power of two array of cells, each with a
+// sequence number that says whose turn it is. A producer claims a position
+// with a CAS on the enqueue counter, writes the value and then bumps the
+// sequence of the cell, which hands it to the consumer of that position. No
+// allocation at all.
+//
+// `ms_queue_t` is the Michael-Scott linked queue, unbounded as long as the
+// node pool lasts. Nodes come from a `lf_block_allocator_t`. A dequeued node
+// can't go back to the pool right away, another thread may still be reading
+// its `next`, so it goes to a limbo list of the dequeuing thread tagged with
+// the epoch (see `epoch.h`) and is freed two epochs later.
+
+#define MPMC_CACHE_LINE 64
+
+typedef struct mpmc_cell {
+  _Atomic size_t seq;
+  void *value;
+} mpmc_cell_t;
+
+typedef struct mpmc_ring {
+  mpmc_cell_t *cells;
+  size_t mask;
+
+  // producers and consumers each have their own cache line
+  alignas(MPMC_CACHE_LINE) _Atomic size_t enqueue_pos;
+  alignas(MPMC_CACHE_LINE) _Atomic size_t dequeue_pos;
+} mpmc_ring_t;
+
+// Use the largest power of two number of cells that fits in `buffer`.
+static bool mpmc_ring_init(mpmc_ring_t *r, uint8_t *buffer,
+                           size_t buffer_size) {
+  uint8_t *start =
+      (uint8_t *)ALIGN_TO((uintptr_t)buffer, alignof(mpmc_cell_t));
+  size_t count = (buffer_size - (size_t)(start - buffer)) / sizeof(mpmc_cell_t);
+  if (start > buffer + buffer_size || count < 2)
+    return false;
+
+  count = (size_t)1 << (63 - __builtin_clzll(count));
+  r->cells = (mpmc_cell_t *)start;
+  r->mask = count - 1;
+  for (size_t i = 0; i < count; i++)
+    atomic_init(&r->cells[i].seq, i);
+
+  atomic_init(&r->enqueue_pos, 0);
+  atomic_init(&r->dequeue_pos, 0);
+  return true;
+}
+
+// Returns false when the ring is full.
+static bool mpmc_ring_push(mpmc_ring_t *r, void *value) {
+  size_t pos = atomic_load_explicit(&r->enqueue_pos, memory_order_relaxed);
+  mpmc_cell_t *cell;
+  for (;;) {
+    cell = &r->cells[pos & r->mask];
+    size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+    intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&r->enqueue_pos, &pos, pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed))
+        break;
+    } else if (diff < 0) {
+      // the consumer of the previous lap has not taken it yet
+      return false;
+    } else {
+      pos = atomic_load_explicit(&r->enqueue_pos, memory_order_relaxed);
+    }
+  }
+
+  cell->value = value;
+  atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+  return true;
+}
+
+// Returns false when the ring is empty.
+static bool mpmc_ring_pop(mpmc_ring_t *r, void **value) {
+  size_t pos = atomic_load_explicit(&r->dequeue_pos, memory_order_relaxed);
+  mpmc_cell_t *cell;
+  for (;;) {
+    cell = &r->cells[pos & r->mask];
+    size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+    intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&r->dequeue_pos, &pos, pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed))
+        break;
+    } else if (diff < 0) {
+      return false;
+    } else {
+      pos = atomic_load_explicit(&r->dequeue_pos, memory_order_relaxed);
+    }
+  }
+
+  *value = cell->value;
+  // free for the producer of the next lap
+  atomic_store_explicit(&cell->seq, pos + r->mask + 1, memory_order_release);
+  return true;
+}
+
+typedef struct ms_node {
+  // the pool's free list link, `lf_block_allocator_t` keeps its own 32 bit
+  // index here while the node is free, so our `next` must not overlap it
+  _Atomic uint32_t pool_link;
+  _Atomic(struct ms_node *) next;
+  void *value;
+  // only used while in limbo
+  struct ms_node *limbo;
+} ms_node_t;
+
+typedef struct ms_queue {
+  alignas(MPMC_CACHE_LINE) _Atomic(ms_node_t *) head;
+  alignas(MPMC_CACHE_LINE) _Atomic(ms_node_t *) tail;
+
+  alignas(MPMC_CACHE_LINE) lf_block_allocator_t nodes;
+  epoch_domain_t *domain;
+} ms_queue_t;
+
+// Every thread using the queue needs one of these. Nodes it dequeued wait in
+// one of three lists, by epoch modulo 3.
+typedef struct ms_thread {
+  epoch_thread_t *epoch;
+  ms_node_t *limbo[3];
+  uint64_t limbo_epoch[3];
+  size_t retired;
+} ms_thread_t;
+
+// Try to advance the epoch every this many retired nodes.
+#define MS_ADVANCE_EVERY 64
+
+// Nodes are carved out of `buffer`. Returns false if it doesn't even fit the
+// dummy node.
+static inline bool ms_queue_init(ms_queue_t *q, epoch_domain_t *domain,
+                          uint8_t *buffer, size_t buffer_size) {
+  lfba_init(&q->nodes, buffer, buffer_size, sizeof(ms_node_t));
+  q->domain = domain;
+
+  ms_node_t *dummy = (ms_node_t *)lfba_alloc(&q->nodes);
+  if (!dummy)
+    return false;
+
+  atomic_init(&dummy->next, NULL);
+  atomic_init(&q->head, dummy);
+  atomic_init(&q->tail, dummy);
+  return true;
+}
+
+static inline bool ms_thread_init(ms_queue_t *q, ms_thread_t *t) {
+  *t = (ms_thread_t){.epoch = epoch_register(q->domain)};
+  return t->epoch != NULL;
+}
+
+static inline void ms_free_list(ms_queue_t *q, ms_node_t *n) {
+  while (n) {
+    ms_node_t *next = n->limbo;
+    lfba_free(&q->nodes, n);
+    n = next;
+  }
+}
+
+// Wait until every node in limbo is safe to free, then free them and give up
+// the epoch slot. Must not be called inside a critical section.
+static inline void ms_thread_deinit(ms_queue_t *q, ms_thread_t *t) {
+  uint64_t target = atomic_load(&q->domain->epoch) + 2;
+  while (atomic_load(&q->domain->epoch) < target) {
+    if (!epoch_try_advance(q->domain))
+      sched_yield();
+  }
+
+  for (int i = 0; i < 3; i++)
+    ms_free_list(q, t->limbo[i]);
+
+  epoch_unregister(t->epoch);
+  *t = (ms_thread_t){};
+}
+
+// Free the limbo lists that no reader can see anymore.
+static inline void ms_collect(ms_queue_t *q, ms_thread_t *t) {
+  epoch_try_advance(q->domain);
+  uint64_t e = atomic_load(&q->domain->epoch);
+
+  for (int i = 0; i < 3; i++) {
+    if (t->limbo[i] && t->limbo_epoch[i] + 2 <= e) {
+      ms_free_list(q, t->limbo[i]);
+      t->limbo[i] = NULL;
+    }
+  }
+}
+
+static inline void ms_retire(ms_queue_t *q, ms_thread_t *t, ms_node_t *n) {
+  uint64_t e = atomic_load(&q->domain->epoch);
+  unsigned slot = e % 3;
+
+  // the list in this slot is from at least three epochs ago
+  if (t->limbo_epoch[slot] != e) {
+    ms_free_list(q, t->limbo[slot]);
+    t->limbo[slot] = NULL;
+    t->limbo_epoch[slot] = e;
+  }
+
+  n->limbo = t->limbo[slot];
+  t->limbo[slot] = n;
+
+  if (++t->retired % MS_ADVANCE_EVERY == 0)
+    ms_collect(q, t);
+}
+
+// Returns false when the node pool is empty.
+static inline bool ms_queue_push(ms_queue_t *q, ms_thread_t *t, void *value) {
+  ms_node_t *n = (ms_node_t *)lfba_alloc(&q->nodes);
+  if (!n) {
+    ms_collect(q, t);
+    return false;
+  }
+
+  n->value = value;
+  atomic_store_explicit(&n->next, NULL, memory_order_relaxed);
+
+  epoch_enter(q->domain, t->epoch);
+  for (;;) {
+    ms_node_t *tail = atomic_load(&q->tail);
+    ms_node_t *next = atomic_load(&tail->next);
+    if (tail != atomic_load(&q->tail))
+      continue;
+
+    if (next) {
+      // someone linked a node but did not swing the tail yet, help them
+      atomic_compare_exchange_weak(&q->tail, &tail, next);
+      continue;
+    }
+
+    if (atomic_compare_exchange_weak(&tail->next, &next, n)) {
+      atomic_compare_exchange_strong(&q->tail, &tail, n);
+      break;
+    }
+  }
+  epoch_exit(t->epoch);
+
+  return true;
+}
+
+// Returns false when the queue is empty.
+static inline bool ms_queue_pop(ms_queue_t *q, ms_thread_t *t, void **value) {
+  ms_node_t *head;
+
+  epoch_enter(q->domain, t->epoch);
+  for (;;) {
+    head = atomic_load(&q->head);
+    ms_node_t *tail = atomic_load(&q->tail);
+    ms_node_t *next = atomic_load(&head->next);
+    if (head != atomic_load(&q->head))
+      continue;
+
+    if (!next) {
+      epoch_exit(t->epoch);
+
+      // nothing will be retired until something is pushed, and that may be
+      // waiting on the nodes we hold
+      ms_collect(q, t);
+      return false;
+    }
+
+    if (head == tail) {
+      atomic_compare_exchange_weak(&q->tail, &tail, next);
+      continue;
+    }
+
+    // read before the CAS, after it the node may be retired by someone else
+    void *v = next->value;
+    if (atomic_compare_exchange_weak(&q->head, &head, next)) {
+      *value = v;
+      break;
+    }
+  }
+  epoch_exit(t->epoch);
+
+  // the old dummy, `next` is the new one
+  ms_retire(q, t, head);
+  return true;
+}
@@ -0,0 +1,184 @@
+#define _GNU_SOURCE
+
+#include "rcbuf.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Broadcast messages to many subscribers. Each message has an envelope the
+// subscribers don't see, then the payload. Every subscriber has a write
+// queue, drained by a few writer threads.
+//
+// With copies every subscriber gets its own malloc'd payload. With refcounted
+// buffers every subscriber gets a slice of the same one, and the last writer
+// to finish with it gives it back to the pool.
+
+#define SUBSCRIBERS 4096
+#define MESSAGES 64
+#define WRITERS 4
+#define ENVELOPE 16
+
+typedef enum { MODE_COPY, MODE_SHARED } fanout_mode_t;
+
+typedef struct subscriber {
+  // one message in flight per subscriber, that is enough to compare
+  rcslice_t slice;
+  uint8_t *copy;
+  size_t copy_len;
+  uint64_t written;
+} subscriber_t;
+
+typedef struct bench {
+  fanout_mode_t mode;
+  rcpool_t pool;
+  subscriber_t subscribers[SUBSCRIBERS];
+  pthread_barrier_t published;
+  pthread_barrier_t drained;
+  size_t peak;
+} bench_t;
+
+typedef struct writer {
+  bench_t *b;
+  size_t id;
+} writer_t;
+
+// Stand in for the socket write: look at every cache line of the payload.
+static uint64_t write_out(const uint8_t *p, size_t len) {
+  uint64_t sum = 0;
+  for (size_t i = 0; i < len; i += 64)
+    sum += p[i];
+  return sum + len;
+}
+
+static void *writer(void *arg) {
+  writer_t *w = arg;
+  bench_t *b = w->b;
+
+  for (size_t m = 0; m < MESSAGES; m++) {
+    pthread_barrier_wait(&b->published);
+
+    for (size_t i = w->id; i < SUBSCRIBERS; i += WRITERS) {
+      subscriber_t *s = &b->subscribers[i];
+      if (b->mode == MODE_SHARED) {
+        s->written += write_out(s->slice.ptr, s->slice.len);
+        rcslice_release(&s->slice);
+      } else {
+        s->written += write_out(s->copy, s->copy_len);
+        free(s->copy);
+        s->copy = NULL;
+      }
+    }
+
+    pthread_barrier_wait(&b->drained);
+  }
+
+  return NULL;
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double run(bench_t *b, fanout_mode_t mode, size_t payload) {
+  b->mode = mode;
+  b->peak = 0;
+  for (size_t i = 0; i < SUBSCRIBERS; i++)
+    b->subscribers[i].written = 0;
+
+  pthread_t threads[WRITERS];
+  writer_t writers[WRITERS];
+  for (size_t i = 0; i < WRITERS; i++) {
+    writers[i] = (writer_t){.b = b, .id = i};
+    pthread_create(&threads[i], NULL, writer, &writers[i]);
+  }
+
+  double start = now();
+  for (size_t m = 0; m < MESSAGES; m++) {
+    rcbuf_t *msg = rcbuf_alloc(&b->pool, ENVELOPE + payload);
+    if (!msg) {
+      fprintf(stderr, "pool exhausted\n");
+      exit(EXIT_FAILURE);
+    }
+    memset(msg->data, 0xee, ENVELOPE);
+    memset(msg->data + ENVELOPE, (int)m, payload);
+
+    size_t in_use = msg->size + sizeof(rcbuf_t);
+    for (size_t i = 0; i < SUBSCRIBERS; i++) {
+      subscriber_t *s = &b->subscribers[i];
+      if (mode == MODE_SHARED) {
+        s->slice = rcbuf_slice(msg, ENVELOPE, payload);
+      } else {
+        s->copy = malloc(payload);
+        memcpy(s->copy, msg->data + ENVELOPE, payload);
+        s->copy_len = payload;
+        in_use += payload;
+      }
+    }
+
+    // the writers hold the references now
+    rcbuf_release(msg);
+    if (in_use > b->peak)
+      b->peak = in_use;
+
+    pthread_barrier_wait(&b->published);
+    pthread_barrier_wait(&b->drained);
+  }
+  double elapsed = now() - start;
+
+  for (size_t i = 0; i < WRITERS; i++)
+    pthread_join(threads[i], NULL);
+
+  uint64_t expected = 0;
+  for (size_t m = 0; m < MESSAGES; m++)
+    expected += (uint8_t)m * ((payload + 63) / 64) + payload;
+  for (size_t i = 0; i < SUBSCRIBERS; i++) {
+    if (b->subscribers[i].written != expected) {
+      fprintf(stderr, "subscriber %zu got the wrong bytes\n", i);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  return elapsed;
+}
+
+int main(void) {
+  static bench_t b;
+  if (!rcpool_init(&b.pool, 64)) {
+    perror("mmap");
+    return EXIT_FAILURE;
+  }
+  pthread_barrier_init(&b.published, NULL, WRITERS + 1);
+  pthread_barrier_init(&b.drained, NULL, WRITERS + 1);
+
+  size_t payloads[] = {200, 1000, 16000};
+  for (size_t i = 0; i < sizeof(payloads) / sizeof(payloads[0]); i++) {
+    double copy = run(&b, MODE_COPY, payloads[i]);
+    size_t copy_peak = b.peak;
+    double shared = run(&b, MODE_SHARED, payloads[i]);
+    size_t shared_peak = b.peak;
+
+    printf("%5zu byte payload to %d subscribers: copy %6.1f ms (%7.1f KiB), "
+           "shared %6.1f ms (%4.1f KiB)\n",
+           payloads[i], SUBSCRIBERS, copy * 1e3, copy_peak / 1024.0,
+           shared * 1e3, shared_peak / 1024.0);
+  }
+
+  // every reference was released, so every block is back in its pool
+  for (size_t i = 0; i < RCPOOL_CLASSES; i++) {
+    size_t free_blocks = 0;
+    for (block_allocator_block_t *blk = b.pool.classes[i].ba.blocks; blk;
+         blk = blk->next)
+      free_blocks++;
+    if (free_blocks != 64) {
+      fprintf(stderr, "class %zu leaked %zu blocks\n", i, 64 - free_blocks);
+      return EXIT_FAILURE;
+    }
+  }
+
+  rcpool_deinit(&b.pool);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include "block_allocator.h"
+
+// Reference counted buffers from a set of pools.
+//
+// Each size class is a `block_allocator_t` over its own mapping, and every
+// block starts with a small header: the reference count and the class it
+// goes back to. A buffer can be referenced from anywhere (many write queues,
+// many threads), and the last release puts it back in its pool.
+//
+// A slice is a view of part of a buffer that holds one reference. Slicing a
+// slice is just another retain, nothing is copied.
+
+#define RCPOOL_CLASSES 5
+
+// Block size of class `i`, header included: 256 bytes to 64 KiB.
+#define RCPOOL_CLASS_SIZE(_i) ((size_t)256 << (2 * (_i)))
+
+typedef struct rcpool_class {
+  pthread_mutex_t lock;
+  block_allocator_t ba;
+  uint8_t *buffer;
+  size_t buffer_size;
+} rcpool_class_t;
+
+typedef struct rcpool {
+  rcpool_class_t classes[RCPOOL_CLASSES];
+} rcpool_t;
+
+typedef struct rcbuf {
+  _Atomic uint32_t refs;
+  // usable bytes after the header
+  uint32_t size;
+  rcpool_class_t *cls;
+  alignas(16) uint8_t data[];
+} rcbuf_t;
+
+typedef struct rcslice {
+  rcbuf_t *buf;
+  uint8_t *ptr;
+  size_t len;
+} rcslice_t;
+
+// Map `blocks` blocks for every class. Pages are only backed once used.
+static bool rcpool_init(rcpool_t *p, size_t blocks) {
+  for (size_t i = 0; i < RCPOOL_CLASSES; i++) {
+    rcpool_class_t *c = &p->classes[i];
+    size_t size = RCPOOL_CLASS_SIZE(i) * blocks;
+    uint8_t *buffer = (uint8_t *)mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                      MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (buffer == MAP_FAILED) {
+      while (i--)
+        munmap(p->classes[i].buffer, p->classes[i].buffer_size);
+      return false;
+    }
+
+    pthread_mutex_init(&c->lock, NULL);
+    ba_init(&c->ba, buffer, size, RCPOOL_CLASS_SIZE(i));
+    c->buffer = buffer;
+    c->buffer_size = size;
+  }
+
+  return true;
+}
+
+// Every buffer must have been released.
+static void rcpool_deinit(rcpool_t *p) {
+  for (size_t i = 0; i < RCPOOL_CLASSES; i++) {
+    munmap(p->classes[i].buffer, p->classes[i].buffer_size);
+    pthread_mutex_destroy(&p->classes[i].lock);
+  }
+}
+
+// A buffer of at least `size` bytes with one reference, or `NULL` if it is
+// too big or its class is exhausted.
+static rcbuf_t *rcbuf_alloc(rcpool_t *p, size_t size) {
+  size_t i = 0;
+  while (i < RCPOOL_CLASSES && RCPOOL_CLASS_SIZE(i) - sizeof(rcbuf_t) < size)
+    i++;
+  if (i == RCPOOL_CLASSES)
+    return NULL;
+
+  rcpool_class_t *c = &p->classes[i];
+  pthread_mutex_lock(&c->lock);
+  rcbuf_t *b = (rcbuf_t *)ba_alloc(&c->ba);
+  pthread_mutex_unlock(&c->lock);
+
+  if (!b)
+    return NULL;
+
+  atomic_init(&b->refs, 1);
+  b->size = (uint32_t)(RCPOOL_CLASS_SIZE(i) - sizeof(rcbuf_t));
+  b->cls = c;
+  return b;
+}
+
+static inline void rcbuf_retain(rcbuf_t *b) {
+  // we already hold a reference, nobody can be freeing it
+  atomic_fetch_add_explicit(&b->refs, 1, memory_order_relaxed);
+}
+
+static inline void rcbuf_release(rcbuf_t *b) {
+  // acquire too, the last one must see every write made through the other
+  // references before the block is reused
+  if (atomic_fetch_sub_explicit(&b->refs, 1, memory_order_acq_rel) != 1)
+    return;
+
+  rcpool_class_t *c = b->cls;
+  pthread_mutex_lock(&c->lock);
+  ba_free(&c->ba, b);
+  pthread_mutex_unlock(&c->lock);
+}
+
+// A view of `len` bytes at `offset`, holding its own reference.
+static inline rcslice_t rcbuf_slice(rcbuf_t *b, size_t offset, size_t len) {
+  rcbuf_retain(b);
+  return (rcslice_t){.buf = b, .ptr = b->data + offset, .len = len};
+}
+
+static inline rcslice_t rcslice_sub(rcslice_t s, size_t offset, size_t len) {
+  rcbuf_retain(s.buf);
+  return (rcslice_t){.buf = s.buf, .ptr = s.ptr + offset, .len = len};
+}
+
+static inline void rcslice_release(rcslice_t *s) {
+  rcbuf_release(s->buf);
+  *s = (rcslice_t){};
+}
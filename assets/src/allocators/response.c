@@ -0,0 +1,137 @@
+#define _GNU_SOURCE
+
+#include "response.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+// Build an HTTP response out of static fragments and a few dynamic ones,
+// once with the segment builder and once by concatenating into a single
+// buffer, and write both to /dev/null.
+
+#define ROUNDS 200000
+#define ROWS 32
+
+static char const page_header[] =
+    "<!DOCTYPE html>\n<html>\n<head>\n<meta charset=\"utf-8\">\n"
+    "<title>Allocators</title>\n<link rel=\"stylesheet\" "
+    "href=\"/assets/css/main.css\">\n</head>\n<body>\n<table>\n";
+static char const page_footer[] =
+    "</table>\n<footer>Powered by arenas, pools and a lot of "
+    "pointer arithmetic.</footer>\n</body>\n</html>\n";
+
+static void build(response_t *r, int round) {
+  // the body is built first so that we know its length
+  response_t body;
+  response_init(&body, r->arena);
+  response_ref(&body, page_header, sizeof(page_header) - 1);
+  for (int i = 0; i < ROWS; i++) {
+    response_str(&body, "<tr><td>");
+    response_printf(&body, "%d", round + i);
+    response_str(&body, "</td><td>");
+    response_str(&body, i % 2 ? "odd" : "even");
+    response_str(&body, "</td></tr>\n");
+  }
+  response_ref(&body, page_footer, sizeof(page_footer) - 1);
+
+  response_str(r, "HTTP/1.1 200 OK\r\n"
+                  "Content-Type: text/html; charset=utf-8\r\n");
+  response_printf(r, "Content-Length: %zu\r\n\r\n", body.total);
+  for (size_t i = 0; i < body.count; i++)
+    response_ref(r, body.iov[i].iov_base, body.iov[i].iov_len);
+}
+
+// The same response, concatenated into a buffer.
+static size_t build_contiguous(char *buf, size_t cap, int round) {
+  char body[8192];
+  size_t len = snprintf(body, sizeof(body), "%s", page_header);
+  for (int i = 0; i < ROWS; i++) {
+    len += snprintf(body + len, sizeof(body) - len,
+                    "<tr><td>%d</td><td>%s</td></tr>\n", round + i,
+                    i % 2 ? "odd" : "even");
+  }
+  len += snprintf(body + len, sizeof(body) - len, "%s", page_footer);
+
+  return snprintf(buf, cap,
+                  "HTTP/1.1 200 OK\r\n"
+                  "Content-Type: text/html; charset=utf-8\r\n"
+                  "Content-Length: %zu\r\n\r\n%s",
+                  len, body);
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(void) {
+  arena_t arena = {};
+
+  // check that both write the same bytes, including a response with more
+  // segments than a single `writev` accepts
+  FILE *a = tmpfile();
+  FILE *b = tmpfile();
+
+  response_t r;
+  response_init(&r, &arena);
+  build(&r, 0);
+  printf("%zu bytes in %zu segments\n", r.total, r.count);
+  response_flush(&r, fileno(a));
+
+  char contiguous[8192];
+  size_t len = build_contiguous(contiguous, sizeof(contiguous), 0);
+  fwrite(contiguous, 1, len, b);
+
+  response_init(&r, &arena);
+  for (int i = 0; i < 3 * IOV_MAX; i++)
+    response_ref(&r, page_footer, sizeof(page_footer) - 1);
+  printf("%zu bytes in %zu segments\n", r.total, r.count);
+  response_flush(&r, fileno(a));
+
+  for (int i = 0; i < 3 * IOV_MAX; i++)
+    fwrite(page_footer, 1, sizeof(page_footer) - 1, b);
+  fflush(b);
+
+  long size_a = lseek(fileno(a), 0, SEEK_END);
+  long size_b = ftell(b);
+  char *da = malloc(size_a), *db = malloc(size_b);
+  pread(fileno(a), da, size_a, 0);
+  pread(fileno(b), db, size_b, 0);
+  printf("same output: %s\n",
+         size_a == size_b && memcmp(da, db, size_a) == 0 ? "yes" : "no");
+  free(da);
+  free(db);
+  fclose(a);
+  fclose(b);
+  arena_reset(&arena);
+
+  int devnull = open("/dev/null", O_WRONLY);
+
+  double start = now();
+  for (int i = 0; i < ROUNDS; i++) {
+    response_init(&r, &arena);
+    build(&r, i);
+    response_flush(&r, devnull);
+    arena_reset(&arena);
+  }
+  printf("writev:     %6.0f ns/response\n", (now() - start) * 1e9 / ROUNDS);
+
+  start = now();
+  for (int i = 0; i < ROUNDS; i++) {
+    char *buf = malloc(8192);
+    len = build_contiguous(buf, 8192, i);
+    if (write(devnull, buf, len) < 0)
+      return EXIT_FAILURE;
+    free(buf);
+  }
+  printf("contiguous: %6.0f ns/response\n", (now() - start) * 1e9 / ROUNDS);
+
+  close(devnull);
+  arena_clear(&arena);
+
+  return EXIT_SUCCESS;
+}
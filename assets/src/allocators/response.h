@@ -0,0 +1,199 @@
+#pragma once
+
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "arena.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+// A response builder that never concatenates.
+//
+// The response is a list of segments (an iovec array in the request arena).
+// Big segments are referenced where they are (static data, or a buffer the
+// caller allocated in the arena), small ones are copied next to each other in
+// a shared arena buffer so they take a single iovec. The whole thing is
+// written with `writev`.
+
+#define RESPONSE_INITIAL_SEGMENTS 16
+// Segments up to this size are copied instead of referenced.
+#define RESPONSE_SMALL_SEGMENT 64
+#define RESPONSE_COALESCE_SIZE 512
+
+typedef struct response {
+  arena_t *arena;
+
+  struct iovec *iov;
+  size_t count;
+  size_t capacity;
+  // first segment not yet written by `response_flush`
+  size_t flushed;
+  size_t total;
+
+  // where small segments are copied to, the last iovec when not `NULL`
+  char *coalesce;
+  size_t coalesce_cap;
+} response_t;
+
+static inline void response_init(response_t *r, arena_t *arena) {
+  *r = (response_t){.arena = arena};
+}
+
+static inline bool response_push(response_t *r, void const *ptr, size_t len) {
+  // the old array is left behind in the arena
+  if (r->count == r->capacity) {
+    size_t capacity = r->capacity ? r->capacity * 2 : RESPONSE_INITIAL_SEGMENTS;
+    struct iovec *iov = (struct iovec *)arena_alloc(
+        r->arena, capacity * sizeof(struct iovec), alignof(struct iovec));
+    if (!iov)
+      return false;
+
+    if (r->count)
+      memcpy(iov, r->iov, r->count * sizeof(struct iovec));
+    r->iov = iov;
+    r->capacity = capacity;
+  }
+
+  r->iov[r->count++] = (struct iovec){.iov_base = (void *)ptr, .iov_len = len};
+  r->total += len;
+  return true;
+}
+
+// Reserve `len` bytes at the end of the coalescing buffer, starting a new one
+// if needed.
+static inline char *response_reserve(response_t *r, size_t len) {
+  struct iovec *last = r->count ? &r->iov[r->count - 1] : NULL;
+  if (!r->coalesce || last->iov_len + len > r->coalesce_cap) {
+    size_t cap = len > RESPONSE_COALESCE_SIZE ? len : RESPONSE_COALESCE_SIZE;
+    char *buf = (char *)arena_alloc(r->arena, cap, 1);
+    if (!buf || !response_push(r, buf, 0))
+      return NULL;
+
+    r->coalesce = buf;
+    r->coalesce_cap = cap;
+    last = &r->iov[r->count - 1];
+  }
+
+  char *dst = (char *)last->iov_base + last->iov_len;
+  last->iov_len += len;
+  r->total += len;
+  return dst;
+}
+
+// Add `len` bytes that stay valid until the response is written (string
+// literals, or memory in the arena).
+static inline bool response_ref(response_t *r, void const *ptr, size_t len) {
+  if (len <= RESPONSE_SMALL_SEGMENT) {
+    char *dst = response_reserve(r, len);
+    if (!dst)
+      return false;
+
+    memcpy(dst, ptr, len);
+    return true;
+  }
+
+  r->coalesce = NULL;
+  return response_push(r, ptr, len);
+}
+
+// Add `len` bytes that must be copied, they may not outlive this call.
+static inline bool response_copy(response_t *r, void const *ptr, size_t len) {
+  if (len <= RESPONSE_SMALL_SEGMENT)
+    return response_ref(r, ptr, len);
+
+  void *dup = arena_alloc(r->arena, len, 1);
+  if (!dup)
+    return false;
+
+  memcpy(dup, ptr, len);
+  r->coalesce = NULL;
+  return response_push(r, dup, len);
+}
+
+static inline bool response_str(response_t *r, char const *str) {
+  return response_ref(r, str, strlen(str));
+}
+
+// Format into the coalescing buffer. Most of the time the result fits in what
+// is left of it, so it is formatted once, in place.
+static inline bool response_printf(response_t *r, char const *format, ...) {
+  va_list args;
+  va_start(args, format);
+
+  if (r->coalesce) {
+    struct iovec *last = &r->iov[r->count - 1];
+    size_t avail = r->coalesce_cap - last->iov_len;
+
+    va_list args2;
+    va_copy(args2, args);
+    int n = vsnprintf((char *)last->iov_base + last->iov_len, avail, format,
+                      args2);
+    va_end(args2);
+
+    if (n >= 0 && (size_t)n < avail) {
+      last->iov_len += n;
+      r->total += n;
+      va_end(args);
+      return true;
+    }
+  }
+
+  va_list args2;
+  va_copy(args2, args);
+
+  int n = vsnprintf(NULL, 0, format, args);
+  char *dst = n >= 0 ? response_reserve(r, n + 1) : NULL;
+  if (dst) {
+    vsnprintf(dst, n + 1, format, args2);
+
+    // don't send the nul
+    r->iov[r->count - 1].iov_len--;
+    r->total--;
+  }
+
+  va_end(args2);
+  va_end(args);
+
+  return dst != NULL;
+}
+
+// Write everything with as few `writev` calls as possible. Returns 0 when
+// done, or -1 with `errno` set. On `EAGAIN` it can be called again once the
+// socket is writable, it continues where it stopped.
+static inline int response_flush(response_t *r, int fd) {
+  while (r->flushed < r->count) {
+    size_t batch = r->count - r->flushed;
+    if (batch > IOV_MAX)
+      batch = IOV_MAX;
+
+    ssize_t n = writev(fd, r->iov + r->flushed, (int)batch);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+
+    // skip what was written, the last segment may be partial
+    size_t written = n;
+    while (r->flushed < r->count && written >= r->iov[r->flushed].iov_len) {
+      written -= r->iov[r->flushed].iov_len;
+      r->flushed++;
+    }
+
+    if (written) {
+      struct iovec *iov = &r->iov[r->flushed];
+      iov->iov_base = (char *)iov->iov_base + written;
+      iov->iov_len -= written;
+    }
+  }
+
+  return 0;
+}
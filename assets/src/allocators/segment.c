@@ -0,0 +1,137 @@
+#define _GNU_SOURCE
+
+#include "segment.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Many pools, objects freed in random order. With plain block allocators the
+// free has to find the pool that owns the pointer by comparing it against
+// every buffer. With segments the owner is in the header at `ptr & ~(2 MiB -
+// 1)`. Then objects are freed from another thread, and ownership is checked
+// across a pool and an arena.
+
+#define POOLS 64
+#define OBJECTS 4096
+#define OBJECT_SIZE 64
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15;
+
+static uint64_t rng(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return rng_state;
+}
+
+static void shuffle(void **ptrs, size_t n) {
+  for (size_t i = n - 1; i > 0; i--) {
+    size_t j = rng() % (i + 1);
+    void *tmp = ptrs[i];
+    ptrs[i] = ptrs[j];
+    ptrs[j] = tmp;
+  }
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// what freeing looks like without segments
+static void search_free(block_allocator_t *pools, void *ptr) {
+  uint8_t *p = ptr;
+  for (size_t i = 0; i < POOLS; i++) {
+    if (p >= pools[i].buffer && p < pools[i].buffer_end) {
+      ba_free(&pools[i], ptr);
+      return;
+    }
+  }
+}
+
+static void *remote_free(void *arg) {
+  void **ptrs = arg;
+  for (size_t i = 0; i < OBJECTS / 2; i++)
+    seg_free(ptrs[i]);
+  return NULL;
+}
+
+int main(void) {
+  static void *ptrs[POOLS * OBJECTS];
+  size_t count = POOLS * OBJECTS;
+
+  // the old way, pools found by search
+  static block_allocator_t pools[POOLS];
+  for (size_t i = 0; i < POOLS; i++) {
+    size_t size = OBJECTS * OBJECT_SIZE;
+    ba_init(&pools[i], malloc(size), size, OBJECT_SIZE);
+    for (size_t j = 0; j < OBJECTS; j++)
+      ptrs[i * OBJECTS + j] = ba_alloc(&pools[i]);
+  }
+
+  shuffle(ptrs, count);
+  double start = now();
+  for (size_t i = 0; i < count; i++)
+    search_free(pools, ptrs[i]);
+  double searched = now() - start;
+
+  for (size_t i = 0; i < POOLS; i++)
+    free(pools[i].buffer);
+
+  // the same with one segment pool each
+  static seg_pool_t seg_pools[POOLS];
+  for (size_t i = 0; i < POOLS; i++) {
+    seg_pool_init(&seg_pools[i]);
+    for (size_t j = 0; j < OBJECTS; j++)
+      ptrs[i * OBJECTS + j] = seg_pool_alloc(&seg_pools[i], OBJECT_SIZE);
+  }
+
+  shuffle(ptrs, count);
+  start = now();
+  for (size_t i = 0; i < count; i++)
+    seg_free(ptrs[i]);
+  double masked = now() - start;
+
+  printf("free among %d pools: search %.1f ns, mask %.1f ns\n", POOLS,
+         searched / count * 1e9, masked / count * 1e9);
+
+  // objects freed by another thread go to the segment's remote list, and
+  // come back when the owner runs out
+  seg_pool_t *pool = &seg_pools[0];
+  size_t per_segment = (SEGMENT_SIZE - sizeof(segment_t)) / OBJECT_SIZE;
+  for (size_t i = 0; i < per_segment; i++)
+    ptrs[i] = seg_pool_alloc(pool, OBJECT_SIZE);
+
+  pthread_t t;
+  pthread_create(&t, NULL, remote_free, ptrs);
+  pthread_join(t, NULL);
+
+  size_t reused = 0;
+  segment_t *first = segment_of(ptrs[0]);
+  for (size_t i = 0; i < OBJECTS / 2; i++)
+    reused += segment_of(seg_pool_alloc(pool, OBJECT_SIZE)) == first;
+  printf("remote frees: %zu of %d blocks reused from the same segment\n",
+         reused, OBJECTS / 2);
+
+  // ownership across allocators
+  seg_arena_t arena = {};
+  void *from_arena = seg_arena_alloc(&arena, 100, 16);
+  void *from_pool = seg_pool_alloc(pool, 100);
+  printf("ownership: pool owns pool ptr %d, arena ptr %d; arena owns arena "
+         "ptr %d; usable size %zu and %zu\n",
+         seg_owns(pool, from_pool), seg_owns(pool, from_arena),
+         seg_owns(&arena, from_arena), seg_usable_size(from_pool),
+         seg_usable_size(from_arena));
+
+  // unsized free works for both, the arena one is a no-op
+  seg_free(from_pool);
+  seg_free(from_arena);
+
+  seg_arena_clear(&arena);
+  for (size_t i = 0; i < POOLS; i++)
+    seg_pool_deinit(&seg_pools[i]);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,234 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include "block_allocator.h"
+
+// Align up the given integer to the given alignment.
+#define ALIGN_TO(_value, _alignment)                                           \
+  ((_value) + ((_alignment) - 1) & -(_alignment))
+
+// Segments: 2 MiB aligned regions that start with a header saying who owns
+// them. Every allocation lives inside a segment, so the metadata for any
+// pointer is one mask away, no searching through pools. That gives free
+// without a size or an allocator, ownership checks, and regions the kernel
+// can back with huge pages.
+//
+// Two owners are built on top: `seg_pool_t`, size classes of blocks in
+// per-class segments, and `seg_arena_t`, a bump allocator over segments.
+// `seg_free` works for pointers from either.
+//
+// Only pointers that came from a segment may be passed to `segment_of`.
+
+#define SEGMENT_SHIFT 21
+#define SEGMENT_SIZE ((size_t)1 << SEGMENT_SHIFT)
+
+typedef enum segment_kind {
+  SEGMENT_POOL = 1,
+  SEGMENT_ARENA,
+} segment_kind_t;
+
+typedef struct segment {
+  segment_kind_t kind;
+  unsigned size_class;
+  void *owner;
+  pthread_t thread;
+  struct segment *next;
+
+  // pool segments: free blocks, and blocks freed by other threads that the
+  // owner thread takes back when it runs out
+  block_allocator_t ba;
+  _Atomic(block_allocator_block_t *) remote;
+
+  // arena segments
+  uint8_t *head;
+
+  alignas(64) uint8_t data[];
+} segment_t;
+
+static inline segment_t *segment_of(const void *ptr) {
+  return (segment_t *)((uintptr_t)ptr & ~(uintptr_t)(SEGMENT_SIZE - 1));
+}
+
+static inline uint8_t *segment_end(segment_t *s) {
+  return (uint8_t *)s + SEGMENT_SIZE;
+}
+
+// Map a fresh segment. `mmap` only promises page alignment, so map twice the
+// size and cut off what is outside the aligned part.
+static segment_t *segment_alloc(segment_kind_t kind, void *owner) {
+  uint8_t *p = (uint8_t *)mmap(NULL, 2 * SEGMENT_SIZE, PROT_READ | PROT_WRITE,
+                               MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  if (p == MAP_FAILED)
+    return NULL;
+
+  uint8_t *start = (uint8_t *)ALIGN_TO((uintptr_t)p, SEGMENT_SIZE);
+  if (start > p)
+    munmap(p, start - p);
+  munmap(start + SEGMENT_SIZE, p + SEGMENT_SIZE - start);
+
+  madvise(start, SEGMENT_SIZE, MADV_HUGEPAGE);
+
+  segment_t *s = (segment_t *)start;
+  s->kind = kind;
+  s->owner = owner;
+  s->thread = pthread_self();
+  atomic_init(&s->remote, NULL);
+  return s;
+}
+
+static void segment_free(segment_t *s) { munmap(s, SEGMENT_SIZE); }
+
+// Segments of blocks by size class, 16 bytes to 32 KiB. A pool allocates from
+// the thread that created it, any thread may free.
+#define SEG_POOL_CLASSES 12
+#define SEG_POOL_CLASS_SIZE(_i) ((size_t)16 << (_i))
+
+typedef struct seg_pool {
+  segment_t *segments[SEG_POOL_CLASSES];
+} seg_pool_t;
+
+static inline void seg_pool_init(seg_pool_t *p) { *p = (seg_pool_t){}; }
+
+static void seg_pool_deinit(seg_pool_t *p) {
+  for (size_t i = 0; i < SEG_POOL_CLASSES; i++) {
+    segment_t *s = p->segments[i];
+    while (s) {
+      segment_t *next = s->next;
+      segment_free(s);
+      s = next;
+    }
+  }
+
+  *p = (seg_pool_t){};
+}
+
+// Take back everything other threads freed into `s`.
+static void seg_pool_collect(segment_t *s) {
+  block_allocator_block_t *b =
+      atomic_exchange_explicit(&s->remote, NULL, memory_order_acquire);
+  while (b) {
+    block_allocator_block_t *next = b->next;
+    ba_free(&s->ba, b);
+    b = next;
+  }
+}
+
+static void *seg_pool_alloc(seg_pool_t *p, size_t size) {
+  unsigned cls = 0;
+  while (cls < SEG_POOL_CLASSES && SEG_POOL_CLASS_SIZE(cls) < size)
+    cls++;
+  if (cls == SEG_POOL_CLASSES)
+    return NULL;
+
+  // the first segment is the one we allocate from, move to the front any
+  // other that still has room
+  segment_t **link = &p->segments[cls];
+  for (segment_t *s = *link; s; link = &s->next, s = s->next) {
+    if (!s->ba.blocks)
+      seg_pool_collect(s);
+    if (!s->ba.blocks)
+      continue;
+
+    if (s != p->segments[cls]) {
+      *link = s->next;
+      s->next = p->segments[cls];
+      p->segments[cls] = s;
+    }
+    return ba_alloc(&s->ba);
+  }
+
+  segment_t *s = segment_alloc(SEGMENT_POOL, p);
+  if (!s)
+    return NULL;
+
+  s->size_class = cls;
+  ba_init(&s->ba, s->data, segment_end(s) - s->data, SEG_POOL_CLASS_SIZE(cls));
+  s->next = p->segments[cls];
+  p->segments[cls] = s;
+
+  return ba_alloc(&s->ba);
+}
+
+static void seg_pool_free(segment_t *s, void *ptr) {
+  if (pthread_equal(s->thread, pthread_self())) {
+    ba_free(&s->ba, ptr);
+    return;
+  }
+
+  // not ours to touch, leave it for the owner thread
+  block_allocator_block_t *b = (block_allocator_block_t *)ptr;
+  b->next = atomic_load_explicit(&s->remote, memory_order_relaxed);
+  while (!atomic_compare_exchange_weak_explicit(
+      &s->remote, &b->next, b, memory_order_release, memory_order_relaxed))
+    ;
+}
+
+// A bump allocator over segments, freed all at once.
+typedef struct seg_arena {
+  segment_t *segments;
+} seg_arena_t;
+
+static void *seg_arena_alloc(seg_arena_t *a, size_t size, size_t align) {
+  segment_t *s = a->segments;
+  if (s) {
+    uint8_t *head = (uint8_t *)ALIGN_TO((uintptr_t)s->head, align);
+    if (head + size <= segment_end(s)) {
+      s->head = head + size;
+      return head;
+    }
+  }
+
+  if (size + align > SEGMENT_SIZE - sizeof(segment_t))
+    return NULL;
+
+  s = segment_alloc(SEGMENT_ARENA, a);
+  if (!s)
+    return NULL;
+
+  s->next = a->segments;
+  a->segments = s;
+
+  uint8_t *head = (uint8_t *)ALIGN_TO((uintptr_t)s->data, align);
+  s->head = head + size;
+  return head;
+}
+
+static void seg_arena_clear(seg_arena_t *a) {
+  segment_t *s = a->segments;
+  while (s) {
+    segment_t *next = s->next;
+    segment_free(s);
+    s = next;
+  }
+
+  a->segments = NULL;
+}
+
+// Free a pointer from any segment owner without knowing its size or owner.
+// Arena memory is only given back by `seg_arena_clear`.
+static void seg_free(void *ptr) {
+  if (!ptr)
+    return;
+
+  segment_t *s = segment_of(ptr);
+  if (s->kind == SEGMENT_POOL)
+    seg_pool_free(s, ptr);
+}
+
+// Whether `ptr` was allocated by `owner`.
+static inline bool seg_owns(const void *owner, const void *ptr) {
+  return segment_of(ptr)->owner == owner;
+}
+
+// The usable size of a pointer's block, or 0 for arena memory.
+static inline size_t seg_usable_size(const void *ptr) {
+  segment_t *s = segment_of(ptr);
+  return s->kind == SEGMENT_POOL ? SEG_POOL_CLASS_SIZE(s->size_class) : 0;
+}
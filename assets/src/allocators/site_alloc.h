@@ -0,0 +1,189 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "arena.h"
+#include "block_allocator.h"
+
+// Allocator selection per call site, guided by a profile.
+//
+// Every allocation site gets a name (an enum, usually from an X-macro list)
+// and goes through `site_alloc`/`site_free`. The program tells us where
+// requests begin and end, and which request it is working on.
+//
+// Built with `SITE_PROFILE`, every allocation goes to malloc with a small
+// header, and we record per site the sizes seen and when each allocation died
+// relative to its request: before the request was done, in the cleanup at its
+// end, or later (or never). `site_profile_write` dumps that, and `site_gen`
+// turns the dump into a header of routes:
+//
+// - always the same size and freed during the request: a `block_allocator_t`
+// - freed by the end of the request: the request `arena_t`
+// - anything else: malloc
+//
+// In the normal build the route of each site is a constant from that header,
+// so the switch in `site_alloc` folds away.
+
+typedef enum site_kind {
+  SITE_HEAP,
+  SITE_POOL,
+  SITE_ARENA,
+} site_kind_t;
+
+typedef struct site_route {
+  site_kind_t kind;
+  // pool routes: which pool, and the block size
+  unsigned pool;
+  size_t size;
+} site_route_t;
+
+#define SITE_MAX_POOLS 16
+
+typedef struct site_stats {
+  uint64_t count;
+  size_t min_size;
+  size_t max_size;
+  uint64_t freed_early;
+  uint64_t freed_at_end;
+} site_stats_t;
+
+typedef struct site_ctx {
+  // routed build
+  arena_t *arena;
+  block_allocator_t pools[SITE_MAX_POOLS];
+
+  // profiling build
+  uint64_t request;
+  bool closing;
+  site_stats_t *stats;
+} site_ctx_t;
+
+// In front of every allocation when profiling.
+typedef struct site_header {
+  uint32_t site;
+  uint64_t request;
+  max_align_t _align[];
+} site_header_t;
+
+static inline void *site_alloc(site_ctx_t *c, site_route_t route,
+                               unsigned site, size_t size) {
+#ifdef SITE_PROFILE
+  (void)route;
+
+  site_stats_t *st = &c->stats[site];
+  if (st->count == 0 || size < st->min_size)
+    st->min_size = size;
+  if (size > st->max_size)
+    st->max_size = size;
+  st->count++;
+
+  site_header_t *h = (site_header_t *)malloc(sizeof(*h) + size);
+  if (!h)
+    return NULL;
+
+  *h = (site_header_t){.site = site, .request = c->request};
+  return h + 1;
+#else
+  (void)site;
+
+  switch (route.kind) {
+  case SITE_POOL:
+    if (size <= route.size) {
+      void *p = ba_alloc(&c->pools[route.pool]);
+      if (p)
+        return p;
+    }
+    // too big or the pool is empty, `site_free` can tell
+    return malloc(size);
+  case SITE_ARENA:
+    return arena_alloc(c->arena, size, alignof(max_align_t));
+  case SITE_HEAP:
+    break;
+  }
+
+  return malloc(size);
+#endif
+}
+
+static inline void site_free(site_ctx_t *c, site_route_t route, void *ptr) {
+  if (!ptr)
+    return;
+
+#ifdef SITE_PROFILE
+  (void)route;
+
+  site_header_t *h = (site_header_t *)ptr - 1;
+  site_stats_t *st = &c->stats[h->site];
+  // anything freed in a later request counts as outliving it
+  if (h->request == c->request && c->closing)
+    st->freed_at_end++;
+  else if (h->request == c->request)
+    st->freed_early++;
+
+  free(h);
+#else
+  switch (route.kind) {
+  case SITE_POOL: {
+    block_allocator_t *ba = &c->pools[route.pool];
+    if ((uint8_t *)ptr >= ba->buffer && (uint8_t *)ptr < ba->buffer_end) {
+      ba_free(ba, ptr);
+      return;
+    }
+    break;
+  }
+  case SITE_ARENA:
+    // goes with the arena at the end of the request
+    return;
+  case SITE_HEAP:
+    break;
+  }
+
+  free(ptr);
+#endif
+}
+
+#define SITE_ALLOC(_ctx, _site, _size)                                         \
+  site_alloc((_ctx), site_routes[SITE_##_site], SITE_##_site, (_size))
+#define SITE_FREE(_ctx, _site, _ptr)                                           \
+  site_free((_ctx), site_routes[SITE_##_site], (_ptr))
+
+// Set up the pools of the routed build, `count` blocks each, in memory from
+// `mem` (at least `count` times the sum of `sizes`).
+static inline void site_ctx_init(site_ctx_t *c, const size_t *sizes,
+                                 unsigned pool_count, size_t count,
+                                 uint8_t *mem) {
+  for (unsigned i = 0; i < pool_count && i < SITE_MAX_POOLS; i++) {
+    ba_init(&c->pools[i], mem, sizes[i] * count, sizes[i]);
+    mem += sizes[i] * count;
+  }
+}
+
+// Start or resume work on request `id`, whose temporaries go in `arena`.
+// Ids must be unique among the requests in flight.
+static inline void site_request_begin(site_ctx_t *c, uint64_t id,
+                                      arena_t *arena) {
+  c->arena = arena;
+  c->request = id;
+  c->closing = false;
+}
+
+// From here on frees are part of the request's cleanup.
+static inline void site_request_closing(site_ctx_t *c) { c->closing = true; }
+
+// One line per site: name, count, min and max size, and how many were freed
+// early, at the end, or outlived the request.
+static inline void site_profile_write(site_ctx_t *c,
+                                      const char *const *names,
+                                      unsigned site_count, FILE *f) {
+  for (unsigned i = 0; i < site_count; i++) {
+    site_stats_t *st = &c->stats[i];
+    fprintf(f, "%s %lu %zu %zu %lu %lu %lu\n", names[i],
+            (unsigned long)st->count, st->min_size, st->max_size,
+            (unsigned long)st->freed_early, (unsigned long)st->freed_at_end,
+            (unsigned long)(st->count - st->freed_early - st->freed_at_end));
+  }
+}
@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Turn a profile written by `site_profile_write` into the routes header for
+// `site_alloc.h`:
+//
+//     ./site_gen < http_server.profile > http_server_sites.h
+
+#define MAX_SITES 256
+#define POOL_ALIGN 16
+// `SITE_MAX_POOLS` in site_alloc.h, the generated header checks they agree
+#define MAX_POOLS 16
+
+// The pool for `size`, shared with the other sites of the same size. Returns
+// `MAX_POOLS` when there is none and no room for another.
+static unsigned find_pool(size_t *pool_sizes, unsigned *pool_count,
+                          size_t size) {
+  size = (size + POOL_ALIGN - 1) & -POOL_ALIGN;
+  for (unsigned i = 0; i < *pool_count; i++) {
+    if (pool_sizes[i] == size)
+      return i;
+  }
+
+  if (*pool_count == MAX_POOLS)
+    return MAX_POOLS;
+
+  pool_sizes[*pool_count] = size;
+  return (*pool_count)++;
+}
+
+int main(void) {
+  static char names[MAX_SITES][64];
+  static char const *kinds[MAX_SITES];
+  static unsigned pools[MAX_SITES];
+  static size_t pool_sizes[MAX_POOLS];
+  unsigned site_count = 0, pool_count = 0;
+
+  char name[64];
+  unsigned long count, early, at_end, outlived;
+  size_t min_size, max_size;
+  while (site_count < MAX_SITES &&
+         scanf("%63s %lu %zu %zu %lu %lu %lu", name, &count, &min_size,
+               &max_size, &early, &at_end, &outlived) == 7) {
+    unsigned i = site_count++;
+    strcpy(names[i], name);
+
+    if (count == 0 || outlived > 0) {
+      // never seen, or lives past the request
+      kinds[i] = "SITE_HEAP";
+    } else if (early == count && min_size == max_size &&
+               (pools[i] = find_pool(pool_sizes, &pool_count, max_size)) <
+                   MAX_POOLS) {
+      kinds[i] = "SITE_POOL";
+    } else {
+      // varied sizes, or out of pools
+      kinds[i] = "SITE_ARENA";
+    }
+
+    fprintf(stderr, "%-16s %8lu allocs %5zu-%-5zu bytes -> %s\n", name, count,
+            min_size, max_size, kinds[i]);
+  }
+
+  printf("// Generated by site_gen from a profile, do not edit.\n\n");
+  printf("static const site_route_t site_routes[SITE_COUNT] = {\n");
+  for (unsigned i = 0; i < site_count; i++) {
+    if (strcmp(kinds[i], "SITE_POOL") == 0) {
+      printf("    [SITE_%s] = {SITE_POOL, %u, %zu},\n", names[i], pools[i],
+             pool_sizes[pools[i]]);
+    } else {
+      printf("    [SITE_%s] = {%s, 0, 0},\n", names[i], kinds[i]);
+    }
+  }
+  printf("};\n\n");
+
+  printf("#define SITE_POOL_COUNT %u\n", pool_count);
+  printf("_Static_assert(SITE_POOL_COUNT <= SITE_MAX_POOLS,\n"
+         "               \"more pools than site_alloc.h has\");\n");
+  printf("static const size_t site_pool_sizes[SITE_MAX_POOLS] = {");
+  for (unsigned i = 0; i < pool_count; i++)
+    printf("%s%zu", i ? ", " : "", pool_sizes[i]);
+  printf("};\n");
+
+  return EXIT_SUCCESS;
+}
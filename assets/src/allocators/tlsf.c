@@ -0,0 +1,151 @@
+#include "tlsf.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Random allocations and frees, timing every single operation. What matters
+// here is not the average, but how bad the worst case gets.
+
+#define POOL_SIZE (8 << 20)
+#define LIVE_SLOTS 4096
+#define ITERATIONS 2000000
+#define MAX_SIZE 8192
+#define HISTOGRAM_BUCKETS 24
+
+typedef struct histogram {
+  size_t counts[HISTOGRAM_BUCKETS];
+  long max;
+  size_t total;
+} histogram_t;
+
+static long now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000l + ts.tv_nsec;
+}
+
+// Bucket `i` counts operations that took less than `2^i` ns.
+static void histogram_add(histogram_t *h, long ns) {
+  unsigned i = ns <= 1 ? 0 : 64 - __builtin_clzll(ns - 1);
+  if (i >= HISTOGRAM_BUCKETS)
+    i = HISTOGRAM_BUCKETS - 1;
+
+  h->counts[i]++;
+  h->total++;
+  if (ns > h->max)
+    h->max = ns;
+}
+
+// Upper bound of the bucket where the `p` percentile falls.
+static long histogram_percentile(histogram_t *h, double p) {
+  size_t target = (size_t)(h->total * p), seen = 0;
+  for (unsigned i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    seen += h->counts[i];
+    if (seen > target)
+      return 1l << i;
+  }
+
+  return h->max;
+}
+
+static void histogram_print(char const *name, histogram_t *h) {
+  printf("%-7s p50<=%4ldns p99<=%5ldns p99.99<=%6ldns max=%8ldns\n", name,
+         histogram_percentile(h, 0.5), histogram_percentile(h, 0.99),
+         histogram_percentile(h, 0.9999), h->max);
+}
+
+static void *slots[LIVE_SLOTS];
+static size_t sizes[LIVE_SLOTS];
+
+int main(void) {
+  static uint8_t pool0[POOL_SIZE];
+  static uint8_t pool1[POOL_SIZE];
+
+  // fault the pages in up front, a real-time system would lock them too
+  memset(pool0, 0, sizeof(pool0));
+  memset(pool1, 0, sizeof(pool1));
+
+  tlsf_t t;
+  tlsf_init(&t);
+  tlsf_add_pool(&t, pool0, sizeof(pool0));
+
+  void *a = tlsf_alloc(&t, 100);
+  void *b = tlsf_alloc(&t, 100);
+  tlsf_free(&t, a);
+  void *c = tlsf_alloc(&t, 60);
+  printf("a=%p, b=%p, c=%p (reused a)\n", a, b, c);
+  tlsf_free(&t, b);
+  tlsf_free(&t, c);
+
+  histogram_t th = {}, mh = {};
+
+  srand(1);
+  for (size_t i = 0; i < ITERATIONS; i++) {
+    size_t s = rand() % LIVE_SLOTS;
+    if (slots[s]) {
+      // every byte must still be ours
+      uint8_t *p = slots[s];
+      if (p[0] != (uint8_t)s || p[sizes[s] - 1] != (uint8_t)s) {
+        fprintf(stderr, "corrupted block %zu\n", s);
+        return EXIT_FAILURE;
+      }
+
+      long start = now_ns();
+      tlsf_free(&t, slots[s]);
+      histogram_add(&th, now_ns() - start);
+      slots[s] = NULL;
+    } else {
+      sizes[s] = 1 + rand() % MAX_SIZE;
+
+      long start = now_ns();
+      slots[s] = tlsf_alloc(&t, sizes[s]);
+      histogram_add(&th, now_ns() - start);
+
+      // grow when the first pool runs out
+      if (!slots[s] && tlsf_add_pool(&t, pool1, sizeof(pool1))) {
+        printf("added a second pool after %zu operations\n", i);
+        slots[s] = tlsf_alloc(&t, sizes[s]);
+      }
+      if (!slots[s]) {
+        fprintf(stderr, "out of memory\n");
+        return EXIT_FAILURE;
+      }
+
+      memset(slots[s], (uint8_t)s, sizes[s]);
+    }
+  }
+
+  for (size_t s = 0; s < LIVE_SLOTS; s++) {
+    tlsf_free(&t, slots[s]);
+    slots[s] = NULL;
+  }
+
+  srand(1);
+  for (size_t i = 0; i < ITERATIONS; i++) {
+    size_t s = rand() % LIVE_SLOTS;
+    if (slots[s]) {
+      long start = now_ns();
+      free(slots[s]);
+      histogram_add(&mh, now_ns() - start);
+      slots[s] = NULL;
+    } else {
+      sizes[s] = 1 + rand() % MAX_SIZE;
+
+      long start = now_ns();
+      slots[s] = malloc(sizes[s]);
+      histogram_add(&mh, now_ns() - start);
+
+      memset(slots[s], (uint8_t)s, sizes[s]);
+    }
+  }
+
+  for (size_t s = 0; s < LIVE_SLOTS; s++)
+    free(slots[s]);
+
+  histogram_print("tlsf", &th);
+  histogram_print("malloc", &mh);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,251 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Align up the given integer to the given alignment.
+#define ALIGN_TO(_value, _alignment)                                           \
+  ((_value) + ((_alignment) - 1) & -(_alignment))
+
+// A Two-Level Segregated Fit allocator.
+//
+// Free blocks are kept in lists by size class: the first level is the power
+// of two of the size, the second level splits each power of two into
+// `TLSF_SL_COUNT` linear steps. Two bitmaps say which lists have blocks, so
+// finding a fitting block is two bit scans. Every block has a header with its
+// size and a pointer to the block before it (the boundary tag), so freeing
+// merges with both neighbours without searching. No loops anywhere: alloc and
+// free are O(1).
+//
+// The memory comes from buffers given by the user, just like `fba_init`, and
+// more of them can be added at any time with `tlsf_add_pool`.
+
+#define TLSF_SL_LOG2 5
+#define TLSF_SL_COUNT (1 << TLSF_SL_LOG2)
+#define TLSF_FL_MAX 32
+#define TLSF_ALIGN 16
+
+// Sizes below this all go to the first level, in linear steps of
+// `TLSF_ALIGN`.
+#define TLSF_SMALL_LOG2 (TLSF_SL_LOG2 + 4)
+#define TLSF_SMALL (1 << TLSF_SMALL_LOG2)
+#define TLSF_FL_COUNT (TLSF_FL_MAX - TLSF_SMALL_LOG2 + 1)
+
+// The biggest block, a pool bigger than this is cut down to it.
+#define TLSF_MAX_BLOCK (((size_t)1 << TLSF_FL_MAX) - TLSF_ALIGN)
+
+// The low bits of the size are flags, sizes are multiples of `TLSF_ALIGN`.
+#define TLSF_FREE 1
+#define TLSF_PREV_FREE 2
+#define TLSF_SIZE_MASK (~(size_t)(TLSF_ALIGN - 1))
+
+typedef struct tlsf_block {
+  // only valid when `TLSF_PREV_FREE` is set
+  struct tlsf_block *prev_phys;
+  // size of the user data, with the flags in the low bits
+  size_t size;
+
+  // only used when the block is free
+  struct tlsf_block *next_free;
+  struct tlsf_block *prev_free;
+} tlsf_block_t;
+
+// User data starts after `prev_phys` and `size`, the next block starts right
+// after the user data.
+#define TLSF_HEADER offsetof(tlsf_block_t, next_free)
+#define TLSF_MIN_BLOCK (sizeof(tlsf_block_t) - TLSF_HEADER)
+
+typedef struct tlsf {
+  uint32_t fl_bitmap;
+  uint32_t sl_bitmap[TLSF_FL_COUNT];
+  tlsf_block_t *free_lists[TLSF_FL_COUNT][TLSF_SL_COUNT];
+} tlsf_t;
+
+static inline size_t tlsf_block_size(tlsf_block_t *b) {
+  return b->size & TLSF_SIZE_MASK;
+}
+
+static inline void *tlsf_block_data(tlsf_block_t *b) {
+  return (uint8_t *)b + TLSF_HEADER;
+}
+
+static inline tlsf_block_t *tlsf_block_from_data(void *ptr) {
+  return (tlsf_block_t *)((uint8_t *)ptr - TLSF_HEADER);
+}
+
+static inline tlsf_block_t *tlsf_block_next(tlsf_block_t *b) {
+  return (tlsf_block_t *)((uint8_t *)tlsf_block_data(b) + tlsf_block_size(b));
+}
+
+// First and second level of a size.
+static inline void tlsf_mapping(size_t size, unsigned *fl, unsigned *sl) {
+  if (size < TLSF_SMALL) {
+    *fl = 0;
+    *sl = (unsigned)(size / (TLSF_SMALL / TLSF_SL_COUNT));
+    return;
+  }
+
+  unsigned log2 = 63 - __builtin_clzll(size);
+  *sl = (unsigned)(size >> (log2 - TLSF_SL_LOG2)) ^ TLSF_SL_COUNT;
+  *fl = log2 - TLSF_SMALL_LOG2 + 1;
+}
+
+// Round the size up to the next list boundary, so that any block in the list
+// found for it is big enough.
+static inline size_t tlsf_round_up(size_t size) {
+  if (size < TLSF_SMALL)
+    return size;
+
+  unsigned log2 = 63 - __builtin_clzll(size);
+  size_t step = ((size_t)1 << (log2 - TLSF_SL_LOG2)) - 1;
+  return size + step;
+}
+
+static inline void tlsf_insert(tlsf_t *t, tlsf_block_t *b) {
+  unsigned fl, sl;
+  tlsf_mapping(tlsf_block_size(b), &fl, &sl);
+
+  b->prev_free = NULL;
+  b->next_free = t->free_lists[fl][sl];
+  if (b->next_free)
+    b->next_free->prev_free = b;
+
+  t->free_lists[fl][sl] = b;
+  t->fl_bitmap |= 1u << fl;
+  t->sl_bitmap[fl] |= 1u << sl;
+}
+
+static inline void tlsf_remove(tlsf_t *t, tlsf_block_t *b) {
+  unsigned fl, sl;
+  tlsf_mapping(tlsf_block_size(b), &fl, &sl);
+
+  if (b->prev_free)
+    b->prev_free->next_free = b->next_free;
+  else
+    t->free_lists[fl][sl] = b->next_free;
+  if (b->next_free)
+    b->next_free->prev_free = b->prev_free;
+
+  if (!t->free_lists[fl][sl]) {
+    t->sl_bitmap[fl] &= ~(1u << sl);
+    if (!t->sl_bitmap[fl])
+      t->fl_bitmap &= ~(1u << fl);
+  }
+}
+
+// Mark `b` as free, and tell the block after it.
+static inline void tlsf_mark_free(tlsf_block_t *b) {
+  b->size |= TLSF_FREE;
+
+  tlsf_block_t *next = tlsf_block_next(b);
+  next->prev_phys = b;
+  next->size |= TLSF_PREV_FREE;
+}
+
+static inline void tlsf_mark_used(tlsf_block_t *b) {
+  b->size &= ~(size_t)TLSF_FREE;
+  tlsf_block_next(b)->size &= ~(size_t)TLSF_PREV_FREE;
+}
+
+static inline void tlsf_init(tlsf_t *t) { *t = (tlsf_t){}; }
+
+// Add a buffer to the allocator. It ends with a zero sized sentinel block
+// that is never free, so merging stops there.
+static bool tlsf_add_pool(tlsf_t *t, uint8_t *buffer, size_t buffer_size) {
+  uint8_t *start = (uint8_t *)ALIGN_TO((uintptr_t)buffer, TLSF_ALIGN);
+  uint8_t *end = (uint8_t *)(((uintptr_t)buffer + buffer_size) &
+                             ~(uintptr_t)(TLSF_ALIGN - 1));
+  if (end - start < (ptrdiff_t)(2 * sizeof(tlsf_block_t)))
+    return false;
+
+  // one block for everything, and the header of the sentinel
+  tlsf_block_t *b = (tlsf_block_t *)start;
+  size_t size = end - start - 2 * TLSF_HEADER;
+  if (size > TLSF_MAX_BLOCK)
+    size = TLSF_MAX_BLOCK;
+  b->size = size;
+
+  tlsf_block_t *sentinel = tlsf_block_next(b);
+  sentinel->size = 0;
+
+  tlsf_mark_free(b);
+  tlsf_insert(t, b);
+  return true;
+}
+
+// Find a free block of at least `size` bytes and take it off its list.
+static tlsf_block_t *tlsf_find(tlsf_t *t, size_t size) {
+  unsigned fl, sl;
+  tlsf_mapping(tlsf_round_up(size), &fl, &sl);
+  if (fl >= TLSF_FL_COUNT)
+    return NULL;
+
+  // a list in the same first level, or the first list of a bigger one
+  uint32_t sl_map = t->sl_bitmap[fl] & (~0u << sl);
+  if (!sl_map) {
+    uint32_t fl_map = fl + 1 < 32 ? t->fl_bitmap & (~0u << (fl + 1)) : 0;
+    if (!fl_map)
+      return NULL;
+
+    fl = __builtin_ctz(fl_map);
+    sl_map = t->sl_bitmap[fl];
+  }
+
+  sl = __builtin_ctz(sl_map);
+  tlsf_block_t *b = t->free_lists[fl][sl];
+  tlsf_remove(t, b);
+  return b;
+}
+
+static void *tlsf_alloc(tlsf_t *t, size_t size) {
+  // no block is that big, and rounding up near `SIZE_MAX` would wrap to 0
+  if (size > TLSF_MAX_BLOCK)
+    return NULL;
+  if (size < TLSF_MIN_BLOCK)
+    size = TLSF_MIN_BLOCK;
+  size = ALIGN_TO(size, TLSF_ALIGN);
+
+  tlsf_block_t *b = tlsf_find(t, size);
+  if (!b)
+    return NULL;
+
+  // give back what we don't need, if it is big enough to be a block
+  size_t remaining = tlsf_block_size(b) - size;
+  if (remaining >= sizeof(tlsf_block_t)) {
+    b->size = size | (b->size & ~TLSF_SIZE_MASK);
+
+    tlsf_block_t *rest = tlsf_block_next(b);
+    rest->size = remaining - TLSF_HEADER;
+    tlsf_mark_free(rest);
+    tlsf_insert(t, rest);
+  }
+
+  tlsf_mark_used(b);
+  return tlsf_block_data(b);
+}
+
+static void tlsf_free(tlsf_t *t, void *ptr) {
+  if (!ptr)
+    return;
+
+  tlsf_block_t *b = tlsf_block_from_data(ptr);
+
+  // merge with the block before
+  if (b->size & TLSF_PREV_FREE) {
+    tlsf_block_t *prev = b->prev_phys;
+    tlsf_remove(t, prev);
+    prev->size += tlsf_block_size(b) + TLSF_HEADER;
+    b = prev;
+  }
+
+  // and with the one after
+  tlsf_block_t *next = tlsf_block_next(b);
+  if (next->size & TLSF_FREE) {
+    tlsf_remove(t, next);
+    b->size += tlsf_block_size(next) + TLSF_HEADER;
+  }
+
+  tlsf_mark_free(b);
+  tlsf_insert(t, b);
+}
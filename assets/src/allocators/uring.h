@@ -0,0 +1,153 @@
+#pragma once
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Just enough of io_uring to submit and reap, straight on top of the system
+// calls (no liburing). One submission queue and one completion queue, shared
+// with the kernel through a single mapping.
+
+typedef struct uring {
+  int fd;
+
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned sq_mask;
+  unsigned *sq_array;
+  struct io_uring_sqe *sqes;
+  // sqes handed out but not yet submitted
+  unsigned sq_pending;
+
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned cq_mask;
+  struct io_uring_cqe *cqes;
+
+  void *ring;
+  size_t ring_size;
+  size_t sqes_size;
+} uring_t;
+
+static bool uring_init(uring_t *r, unsigned entries) {
+  struct io_uring_params p = {};
+  int fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+  if (fd < 0)
+    return false;
+
+  // we rely on the kernel putting both queues in one mapping
+  if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+    close(fd);
+    return false;
+  }
+
+  size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  size_t ring_size = sq_size > cq_size ? sq_size : cq_size;
+
+  uint8_t *ring =
+      (uint8_t *)mmap(NULL, ring_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (ring == MAP_FAILED) {
+    close(fd);
+    return false;
+  }
+
+  size_t sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  void *sqes = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    munmap(ring, ring_size);
+    close(fd);
+    return false;
+  }
+
+  *r = (uring_t){
+      .fd = fd,
+      .sq_head = (unsigned *)(ring + p.sq_off.head),
+      .sq_tail = (unsigned *)(ring + p.sq_off.tail),
+      .sq_mask = *(unsigned *)(ring + p.sq_off.ring_mask),
+      .sq_array = (unsigned *)(ring + p.sq_off.array),
+      .sqes = (struct io_uring_sqe *)sqes,
+      .cq_head = (unsigned *)(ring + p.cq_off.head),
+      .cq_tail = (unsigned *)(ring + p.cq_off.tail),
+      .cq_mask = *(unsigned *)(ring + p.cq_off.ring_mask),
+      .cqes = (struct io_uring_cqe *)(ring + p.cq_off.cqes),
+      .ring = ring,
+      .ring_size = ring_size,
+      .sqes_size = sqes_size,
+  };
+  return true;
+}
+
+static void uring_deinit(uring_t *r) {
+  munmap(r->sqes, r->sqes_size);
+  munmap(r->ring, r->ring_size);
+  close(r->fd);
+  *r = (uring_t){.fd = -1};
+}
+
+static int uring_register(uring_t *r, unsigned opcode, void *arg,
+                          unsigned nr_args) {
+  return (int)syscall(__NR_io_uring_register, r->fd, opcode, arg, nr_args);
+}
+
+// A zeroed sqe to fill in, or `NULL` when the submission queue is full.
+static struct io_uring_sqe *uring_get_sqe(uring_t *r) {
+  unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+  unsigned tail = *r->sq_tail + r->sq_pending;
+  if (tail - head > r->sq_mask)
+    return NULL;
+
+  unsigned i = tail & r->sq_mask;
+  r->sq_array[i] = i;
+  r->sq_pending++;
+
+  struct io_uring_sqe *sqe = &r->sqes[i];
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+// Submit everything we handed out and wait for at least `wait_nr`
+// completions. Returns the number submitted or `-errno`.
+static int uring_submit(uring_t *r, unsigned wait_nr) {
+  unsigned submit = r->sq_pending;
+  __atomic_store_n(r->sq_tail, *r->sq_tail + submit, __ATOMIC_RELEASE);
+  r->sq_pending = 0;
+
+  unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+  int ret = (int)syscall(__NR_io_uring_enter, r->fd, submit, wait_nr, flags,
+                         NULL, 0);
+  return ret < 0 ? -errno : ret;
+}
+
+// The next completion, or `NULL` if there is none yet.
+static struct io_uring_cqe *uring_peek_cqe(uring_t *r) {
+  unsigned head = *r->cq_head;
+  if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+    return NULL;
+
+  return &r->cqes[head & r->cq_mask];
+}
+
+// Wait for the next completion.
+static struct io_uring_cqe *uring_wait_cqe(uring_t *r) {
+  struct io_uring_cqe *cqe;
+  while (!(cqe = uring_peek_cqe(r))) {
+    int ret = uring_submit(r, 1);
+    if (ret < 0 && ret != -EINTR)
+      return NULL;
+  }
+
+  return cqe;
+}
+
+static void uring_cqe_seen(uring_t *r) {
+  __atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE);
+}
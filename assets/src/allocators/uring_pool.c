@@ -0,0 +1,259 @@
+#define _GNU_SOURCE
+
+#include "uring_pool.h"
+
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+
+// Exercise the buffer pool on a temp file and a loopback socket. The file is
+// written and read back with `WRITE_FIXED`/`READ_FIXED`, then read again with
+// plain `READ` from the same buffers for comparison. The socket sends with
+// `WRITE_FIXED` and receives into buffers the kernel picks from a provided
+// buffer ring.
+
+#define POOL_BUFFERS 64
+#define BUFFER_SIZE 4096
+#define FILE_BUFFERS 16
+#define READ_ROUNDS 4000
+#define RING_BUFFERS 32
+#define SOCKET_BYTES (4 << 20)
+
+enum { TAG_WRITE = 1, TAG_RECV };
+
+static uint8_t pattern(size_t offset) {
+  return (uint8_t)(offset * 7 + offset / BUFFER_SIZE);
+}
+
+static void die(const char *what, int err) {
+  fprintf(stderr, "%s: %s\n", what, strerror(err));
+  exit(EXIT_FAILURE);
+}
+
+// Submit what is queued and reap exactly `n` completions, all must have
+// transferred a whole buffer.
+static void complete(uring_t *r, unsigned n, const char *what) {
+  int ret = uring_submit(r, n);
+  if (ret < 0)
+    die("io_uring_enter", -ret);
+
+  for (unsigned i = 0; i < n; i++) {
+    struct io_uring_cqe *cqe = uring_wait_cqe(r);
+    if (!cqe)
+      die("io_uring_enter", errno);
+    if (cqe->res != BUFFER_SIZE)
+      die(what, cqe->res < 0 ? -cqe->res : EIO);
+    uring_cqe_seen(r);
+  }
+}
+
+static struct io_uring_sqe *queue_rw(uring_t *r, uint8_t opcode, int fd,
+                                     uring_pool_t *p, void *buffer, size_t len,
+                                     size_t offset) {
+  struct io_uring_sqe *sqe = uring_get_sqe(r);
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)(uintptr_t)buffer;
+  sqe->len = (uint32_t)len;
+  sqe->off = offset;
+  if (opcode == IORING_OP_READ_FIXED || opcode == IORING_OP_WRITE_FIXED)
+    sqe->buf_index = (uint16_t)uring_pool_index(p, buffer);
+
+  return sqe;
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double read_file(uring_t *r, uring_pool_t *p, int fd, uint8_t opcode) {
+  void *buffers[FILE_BUFFERS];
+  for (size_t i = 0; i < FILE_BUFFERS; i++)
+    buffers[i] = uring_pool_get(p);
+
+  double start = now();
+  for (size_t round = 0; round < READ_ROUNDS; round++) {
+    for (size_t i = 0; i < FILE_BUFFERS; i++)
+      queue_rw(r, opcode, fd, p, buffers[i], BUFFER_SIZE, i * BUFFER_SIZE);
+    complete(r, FILE_BUFFERS, "read");
+  }
+  double elapsed = now() - start;
+
+  for (size_t i = 0; i < FILE_BUFFERS; i++) {
+    uint8_t *b = buffers[i];
+    for (size_t j = 0; j < BUFFER_SIZE; j++) {
+      if (b[j] != pattern(i * BUFFER_SIZE + j))
+        die("file contents", EIO);
+    }
+    uring_pool_put(p, b);
+  }
+
+  return elapsed / (READ_ROUNDS * FILE_BUFFERS) * 1e9;
+}
+
+static void test_file(uring_t *r, uring_pool_t *p) {
+  char path[] = "/tmp/uring_pool_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0)
+    die("mkstemp", errno);
+  unlink(path);
+
+  // write the pattern from pool buffers
+  void *buffers[FILE_BUFFERS];
+  for (size_t i = 0; i < FILE_BUFFERS; i++) {
+    uint8_t *b = buffers[i] = uring_pool_get(p);
+    for (size_t j = 0; j < BUFFER_SIZE; j++)
+      b[j] = pattern(i * BUFFER_SIZE + j);
+    queue_rw(r, IORING_OP_WRITE_FIXED, fd, p, b, BUFFER_SIZE, i * BUFFER_SIZE);
+  }
+  complete(r, FILE_BUFFERS, "write");
+
+  for (size_t i = 0; i < FILE_BUFFERS; i++)
+    uring_pool_put(p, buffers[i]);
+
+  // and read it back, checking the contents
+  double fixed = read_file(r, p, fd, IORING_OP_READ_FIXED);
+  double plain = read_file(r, p, fd, IORING_OP_READ);
+
+  printf("file:   %d KiB verified, READ_FIXED %.0f ns/op, READ %.0f ns/op\n",
+         FILE_BUFFERS * BUFFER_SIZE / 1024, fixed, plain);
+  close(fd);
+}
+
+static void connect_loopback(int *client, int *server) {
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr = {
+      .sin_family = AF_INET,
+      .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+  };
+  socklen_t len = sizeof(addr);
+  if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(listener, 1) < 0 ||
+      getsockname(listener, (struct sockaddr *)&addr, &len) < 0)
+    die("listen", errno);
+
+  *client = socket(AF_INET, SOCK_STREAM, 0);
+  if (connect(*client, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    die("connect", errno);
+
+  *server = accept(listener, NULL, NULL);
+  if (*server < 0)
+    die("accept", errno);
+  close(listener);
+}
+
+static void test_socket(uring_t *r, uring_pool_t *p) {
+  int client, server;
+  connect_loopback(&client, &server);
+
+  uring_buf_ring_t ring = {};
+  int ret = uring_buf_ring_init(&ring, r, RING_BUFFERS, 1);
+  if (ret < 0)
+    die("IORING_REGISTER_PBUF_RING", -ret);
+  uring_buf_ring_fill(&ring, p, RING_BUFFERS);
+
+  uint8_t *send_buffer = uring_pool_get(p);
+  size_t sent = 0, received = 0;
+  bool writing = false, receiving = false;
+  unsigned picked = 0;
+
+  double start = now();
+  while (received < SOCKET_BYTES) {
+    // one write at a time keeps the byte stream in order
+    if (!writing && sent < SOCKET_BYTES) {
+      size_t chunk = SOCKET_BYTES - sent;
+      if (chunk > BUFFER_SIZE)
+        chunk = BUFFER_SIZE;
+      for (size_t j = 0; j < chunk; j++)
+        send_buffer[j] = pattern(sent + j);
+
+      struct io_uring_sqe *sqe = queue_rw(r, IORING_OP_WRITE_FIXED, client, p,
+                                          send_buffer, chunk, 0);
+      sqe->user_data = TAG_WRITE;
+      writing = true;
+    }
+
+    if (!receiving) {
+      struct io_uring_sqe *sqe = uring_get_sqe(r);
+      sqe->opcode = IORING_OP_RECV;
+      sqe->fd = server;
+      sqe->len = BUFFER_SIZE;
+      sqe->flags = IOSQE_BUFFER_SELECT;
+      sqe->buf_group = ring.bgid;
+      sqe->user_data = TAG_RECV;
+      receiving = true;
+    }
+
+    ret = uring_submit(r, 1);
+    if (ret < 0)
+      die("io_uring_enter", -ret);
+
+    struct io_uring_cqe *cqe;
+    while ((cqe = uring_peek_cqe(r))) {
+      if (cqe->res <= 0)
+        die(cqe->user_data == TAG_WRITE ? "send" : "recv",
+            cqe->res < 0 ? -cqe->res : EPIPE);
+
+      if (cqe->user_data == TAG_WRITE) {
+        sent += cqe->res;
+        writing = false;
+      } else {
+        uint8_t *b = uring_buf_ring_cqe_buffer(p, cqe);
+        if (!b)
+          die("recv without a buffer", EINVAL);
+
+        for (int j = 0; j < cqe->res; j++) {
+          if (b[j] != pattern(received + j))
+            die("socket contents", EIO);
+        }
+
+        received += cqe->res;
+        picked++;
+        receiving = false;
+
+        // done with it, straight back to the kernel
+        uring_buf_ring_add(&ring, p, b);
+      }
+
+      uring_cqe_seen(r);
+    }
+  }
+  double elapsed = now() - start;
+
+  printf("socket: %d MiB verified, %u receives into provided buffers, "
+         "%.0f MiB/s\n",
+         SOCKET_BYTES >> 20, picked, SOCKET_BYTES / elapsed / (1 << 20));
+
+  uring_pool_put(p, send_buffer);
+  uring_buf_ring_deinit(&ring, r);
+  close(client);
+  close(server);
+}
+
+int main(void) {
+  uring_t r;
+  if (!uring_init(&r, 64))
+    die("io_uring_setup", errno);
+
+  uring_pool_t pool;
+  if (!uring_pool_init(&pool, POOL_BUFFERS, BUFFER_SIZE))
+    die("mmap", errno);
+
+  int ret = uring_pool_register(&pool, &r);
+  if (ret < 0)
+    die("IORING_REGISTER_BUFFERS", -ret);
+
+  test_file(&r, &pool);
+  test_socket(&r, &pool);
+
+  uring_pool_unregister(&r);
+  uring_pool_deinit(&pool);
+  uring_deinit(&r);
+
+  return EXIT_SUCCESS;
+}
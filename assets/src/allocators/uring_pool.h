@@ -0,0 +1,188 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#include "arena.h"
+#include "block_allocator.h"
+#include "uring.h"
+
+// A pool of fixed size, page aligned I/O buffers for io_uring.
+//
+// All buffers are carved out of one mapping, and the free ones are kept in a
+// `block_allocator_t`. Because the mapping never moves, it can be registered
+// with the ring once, and the kernel pins the pages once instead of on every
+// operation. Buffer `i` is registered as fixed buffer `i`, so the same index
+// goes in `buf_index` of `READ_FIXED`/`WRITE_FIXED` and is the buffer id in
+// a provided buffer ring.
+
+// The kernel doesn't take more fixed buffers than this.
+#define URING_POOL_MAX_BUFFERS (1 << 14)
+
+typedef struct uring_pool {
+  uint8_t *region;
+  size_t region_size;
+  size_t buffer_size;
+  unsigned count;
+  block_allocator_t free;
+} uring_pool_t;
+
+// `count` buffers of `buffer_size` bytes, rounded up to whole pages.
+static bool uring_pool_init(uring_pool_t *p, unsigned count,
+                            size_t buffer_size) {
+  if (count == 0 || count > URING_POOL_MAX_BUFFERS)
+    return false;
+
+  buffer_size = ALIGN_TO(buffer_size, ARENA_PAGE_SIZE);
+  size_t region_size = buffer_size * count;
+  uint8_t *region =
+      (uint8_t *)mmap(NULL, region_size, PROT_READ | PROT_WRITE,
+                      MAP_ANONYMOUS | MAP_PRIVATE | MAP_POPULATE, -1, 0);
+  if (region == MAP_FAILED)
+    return false;
+
+  *p = (uring_pool_t){
+      .region = region,
+      .region_size = region_size,
+      .buffer_size = buffer_size,
+      .count = count,
+  };
+  ba_init(&p->free, region, region_size, buffer_size);
+  return true;
+}
+
+static void uring_pool_deinit(uring_pool_t *p) {
+  munmap(p->region, p->region_size);
+  *p = (uring_pool_t){};
+}
+
+// Register every buffer with the ring, buffer `i` as fixed buffer `i`.
+// Returns 0 or `-errno`.
+static int uring_pool_register(uring_pool_t *p, uring_t *r) {
+  // the iovecs are only needed for the call
+  arena_t scratch = {};
+  struct iovec *iov = (struct iovec *)arena_alloc(
+      &scratch, sizeof(*iov) * p->count, alignof(struct iovec));
+  if (!iov)
+    return -ENOMEM;
+
+  for (unsigned i = 0; i < p->count; i++) {
+    iov[i] = (struct iovec){.iov_base = p->region + (size_t)i * p->buffer_size,
+                            .iov_len = p->buffer_size};
+  }
+
+  int ret = uring_register(r, IORING_REGISTER_BUFFERS, iov, p->count);
+  arena_clear(&scratch);
+  return ret < 0 ? -errno : 0;
+}
+
+static int uring_pool_unregister(uring_t *r) {
+  int ret = uring_register(r, IORING_UNREGISTER_BUFFERS, NULL, 0);
+  return ret < 0 ? -errno : 0;
+}
+
+static inline void *uring_pool_buffer(uring_pool_t *p, unsigned index) {
+  return p->region + (size_t)index * p->buffer_size;
+}
+
+static inline unsigned uring_pool_index(uring_pool_t *p, void *buffer) {
+  return (unsigned)((size_t)((uint8_t *)buffer - p->region) / p->buffer_size);
+}
+
+// A free buffer, or `NULL` if they are all in use.
+static void *uring_pool_get(uring_pool_t *p) { return ba_alloc(&p->free); }
+
+static void uring_pool_put(uring_pool_t *p, void *buffer) {
+  ba_free(&p->free, buffer);
+}
+
+// Provided buffers: the kernel picks a buffer from the ring when data
+// arrives (`IOSQE_BUFFER_SELECT`) and says which one in the completion flags.
+// Only buffers from the pool go in it, so the buffer id is the pool index.
+typedef struct uring_buf_ring {
+  struct io_uring_buf_ring *br;
+  size_t size;
+  unsigned mask;
+  uint16_t bgid;
+} uring_buf_ring_t;
+
+// Set up a provided buffer ring of `entries` (a power of two) as buffer group
+// `bgid`. Returns 0 or `-errno`.
+static int uring_buf_ring_init(uring_buf_ring_t *b, uring_t *r,
+                               unsigned entries, uint16_t bgid) {
+  size_t size = ALIGN_TO(entries * sizeof(struct io_uring_buf),
+                         (size_t)ARENA_PAGE_SIZE);
+  void *ring = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                    MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  if (ring == MAP_FAILED)
+    return -errno;
+
+  struct io_uring_buf_reg reg = {
+      .ring_addr = (uint64_t)(uintptr_t)ring,
+      .ring_entries = entries,
+      .bgid = bgid,
+  };
+  if (uring_register(r, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+    int err = errno;
+    munmap(ring, size);
+    return -err;
+  }
+
+  *b = (uring_buf_ring_t){
+      .br = (struct io_uring_buf_ring *)ring,
+      .size = size,
+      .mask = entries - 1,
+      .bgid = bgid,
+  };
+  return 0;
+}
+
+// Buffers still in the ring are not given back to the pool, the kernel may
+// have used some of them.
+static void uring_buf_ring_deinit(uring_buf_ring_t *b, uring_t *r) {
+  struct io_uring_buf_reg reg = {.bgid = b->bgid};
+  uring_register(r, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+  munmap(b->br, b->size);
+  *b = (uring_buf_ring_t){};
+}
+
+// Hand a pool buffer to the kernel.
+static void uring_buf_ring_add(uring_buf_ring_t *b, uring_pool_t *p,
+                               void *buffer) {
+  uint16_t tail = b->br->tail;
+  struct io_uring_buf *buf = &b->br->bufs[tail & b->mask];
+  *buf = (struct io_uring_buf){
+      .addr = (uint64_t)(uintptr_t)buffer,
+      .len = (uint32_t)p->buffer_size,
+      .bid = (uint16_t)uring_pool_index(p, buffer),
+  };
+
+  // the entry must be visible before the kernel sees the new tail
+  __atomic_store_n(&b->br->tail, (uint16_t)(tail + 1), __ATOMIC_RELEASE);
+}
+
+// Move up to `n` free buffers from the pool to the ring. Returns how many.
+static unsigned uring_buf_ring_fill(uring_buf_ring_t *b, uring_pool_t *p,
+                                    unsigned n) {
+  unsigned added = 0;
+  for (; added < n && added <= b->mask; added++) {
+    void *buffer = uring_pool_get(p);
+    if (!buffer)
+      break;
+    uring_buf_ring_add(b, p, buffer);
+  }
+
+  return added;
+}
+
+// The buffer the kernel picked for a completion, or `NULL` if it didn't.
+static void *uring_buf_ring_cqe_buffer(uring_pool_t *p,
+                                       struct io_uring_cqe *cqe) {
+  if (!(cqe->flags & IORING_CQE_F_BUFFER))
+    return NULL;
+
+  return uring_pool_buffer(p, cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+}
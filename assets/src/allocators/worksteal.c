@@ -0,0 +1,194 @@
+#define _GNU_SOURCE
+
+#include "worksteal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Fork-join microbenchmarks on the work-stealing scheduler, with task frames
+// and scratch memory from the worker pools and arenas, and from malloc.
+//
+// - fib: a task per call, almost no work in each, all spawn overhead
+// - sort: merge sort, a task per half down to small runs, the merge buffer
+//   is scratch memory
+// - requests: detached tasks for a batch of small jobs, most of them freed by
+//   a worker other than the one that spawned them
+
+#define WORKERS 4
+#define FIB_N 27
+#define SORT_COUNT (4 << 20)
+#define SORT_CUTOFF 2048
+#define REQUESTS 200000
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// --- fib:
+
+typedef struct fib_args {
+  int n;
+  uint64_t *result;
+} fib_args_t;
+
+static void fib_task(ws_worker_t *w, void *arg) {
+  fib_args_t *a = arg;
+  if (a->n < 2) {
+    *a->result = a->n;
+    return;
+  }
+
+  uint64_t x, y;
+  fib_args_t left = {a->n - 1, &x};
+  ws_task_t *t = ws_spawn(w, fib_task, &left, sizeof(left));
+
+  fib_args_t right = {a->n - 2, &y};
+  fib_task(w, &right);
+
+  ws_join(w, t);
+  *a->result = x + y;
+}
+
+// --- sort:
+
+typedef struct sort_args {
+  uint32_t *items;
+  size_t count;
+} sort_args_t;
+
+static int compare_u32(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+
+static void sort_task(ws_worker_t *w, void *arg) {
+  sort_args_t *a = arg;
+  if (a->count <= SORT_CUTOFF) {
+    qsort(a->items, a->count, sizeof(uint32_t), compare_u32);
+    return;
+  }
+
+  size_t half = a->count / 2;
+  sort_args_t left = {a->items, half};
+  ws_task_t *t = ws_spawn(w, sort_task, &left, sizeof(left));
+  // its merge buffer is gone before we take ours
+  sort_args_t right = {a->items + half, a->count - half};
+  ws_run(w, sort_task, &right);
+  ws_join(w, t);
+
+  // merge the left half from a copy in scratch memory
+  bool from_malloc = w->sched->malloc_tasks;
+  uint32_t *tmp = from_malloc ? malloc(half * sizeof(uint32_t))
+                              : arena_alloc(ws_scratch(w),
+                                            half * sizeof(uint32_t),
+                                            alignof(uint32_t));
+  memcpy(tmp, a->items, half * sizeof(uint32_t));
+
+  uint32_t *out = a->items, *r = a->items + half, *r_end = a->items + a->count;
+  size_t i = 0;
+  while (i < half && r < r_end)
+    *out++ = tmp[i] <= *r ? tmp[i++] : *r++;
+  while (i < half)
+    *out++ = tmp[i++];
+
+  if (from_malloc)
+    free(tmp);
+}
+
+// --- requests:
+
+typedef struct request_args {
+  size_t id;
+  _Atomic uint64_t *sum;
+} request_args_t;
+
+static void request_task(ws_worker_t *w, void *arg) {
+  request_args_t *a = arg;
+
+  // build a small response in scratch memory
+  bool from_malloc = w->sched->malloc_tasks;
+  char *buf = from_malloc ? malloc(256) : arena_alloc(ws_scratch(w), 256, 1);
+  int len = snprintf(buf, 256, "request %zu handled by worker %u", a->id,
+                     w->id);
+  atomic_fetch_add_explicit(a->sum, len, memory_order_relaxed);
+
+  if (from_malloc)
+    free(buf);
+}
+
+static void run(ws_sched_t *s, bool malloc_tasks, uint32_t *items,
+                const uint32_t *input) {
+  s->malloc_tasks = malloc_tasks;
+  ws_worker_t *w = ws_main(s);
+  const char *name = malloc_tasks ? "malloc" : "pools";
+
+  uint64_t fib;
+  fib_args_t fa = {FIB_N, &fib};
+  double start = now();
+  ws_run(w, fib_task, &fa);
+  double elapsed = now() - start;
+  printf("%-6s fib(%d) = %lu: %7.1f ms\n", name, FIB_N, (unsigned long)fib,
+         elapsed * 1e3);
+
+  memcpy(items, input, SORT_COUNT * sizeof(uint32_t));
+  sort_args_t sa = {items, SORT_COUNT};
+  start = now();
+  ws_run(w, sort_task, &sa);
+  elapsed = now() - start;
+  for (size_t i = 1; i < SORT_COUNT; i++) {
+    if (items[i - 1] > items[i]) {
+      fprintf(stderr, "not sorted at %zu\n", i);
+      exit(EXIT_FAILURE);
+    }
+  }
+  printf("%-6s sort of %d: %7.1f ms\n", name, SORT_COUNT, elapsed * 1e3);
+
+  _Atomic uint64_t sum = 0;
+  ws_group_t g = {};
+  start = now();
+  for (size_t i = 0; i < REQUESTS; i++) {
+    request_args_t ra = {i, &sum};
+    ws_spawn_detached(w, &g, request_task, &ra, sizeof(ra));
+  }
+  ws_group_wait(w, &g);
+  elapsed = now() - start;
+  printf("%-6s %d requests: %7.1f ms\n", name, REQUESTS, elapsed * 1e3);
+}
+
+int main(int argc, char **argv) {
+  unsigned workers = argc > 1 ? (unsigned)atoi(argv[1]) : WORKERS;
+
+  static uint32_t input[SORT_COUNT], items[SORT_COUNT];
+  uint64_t x = 88172645463325252ull;
+  for (size_t i = 0; i < SORT_COUNT; i++) {
+    x ^= x << 13, x ^= x >> 7, x ^= x << 17;
+    input[i] = (uint32_t)x;
+  }
+
+  // no limit, only to see how much the pools and scratch arenas map
+  arena_budget_t budget = {};
+  ws_sched_t s;
+  if (!ws_init(&s, workers, &budget)) {
+    perror("ws_init");
+    return EXIT_FAILURE;
+  }
+
+  printf("%u workers\n", workers);
+  run(&s, true, items, input);
+  run(&s, false, items, input);
+
+  size_t spawned = 0, stolen = 0;
+  for (unsigned i = 0; i < workers; i++) {
+    spawned += s.workers[i].spawned;
+    stolen += s.workers[i].stolen;
+  }
+  printf("%zu tasks spawned, %zu stolen, peak %.1f MiB mapped\n", spawned,
+         stolen, atomic_load(&budget.peak) / 1048576.0);
+
+  ws_deinit(&s);
+  return EXIT_SUCCESS;
+}
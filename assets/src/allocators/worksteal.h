@@ -0,0 +1,378 @@
+#pragma once
+
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "arena.h"
+#include "block_allocator.h"
+
+// A small work-stealing scheduler for fork-join parallelism.
+//
+// Every worker has a Chase-Lev deque: it pushes and takes tasks at the
+// bottom, other workers steal from the top. Only a steal racing for the last
+// task needs a CAS, the owner's push and take are plain loads and stores.
+// A worker waiting for a task runs other tasks meanwhile, its own first.
+//
+// Task frames are fixed size blocks from a `block_allocator_t` of the worker
+// that spawned them, with the arguments copied inline. Tasks are freed where
+// they finish: a joined task by its joiner, which is the spawner, a detached
+// task by whoever ran it. Frees from another worker go to a lock-free list of
+// the owner, which takes them back when its pool runs dry. Scratch memory for
+// a task comes from the arena of the worker running it, rewound when the task
+// is done, so a spawn never calls malloc. Calls outside of a task, like the
+// root one, go through `ws_run` to get the same.
+//
+// Fixed sizes everywhere: when a deque is full or a pool is empty the task
+// just runs right away in the spawner.
+//
+// Worker 0 is the thread that called `ws_init`, the others are threads of
+// their own that steal until `ws_deinit`.
+
+#define WS_MAX_WORKERS 64
+#define WS_DEQUE_SIZE 1024
+#define WS_TASK_SIZE 128
+#define WS_TASKS_PER_WORKER 8192
+
+typedef struct ws_worker ws_worker_t;
+typedef void (*ws_fn)(ws_worker_t *w, void *args);
+
+typedef struct ws_task {
+  ws_fn fn;
+  ws_worker_t *owner;
+  struct ws_group *group;
+  _Atomic uint32_t done;
+  alignas(16) uint8_t args[];
+} ws_task_t;
+
+#define WS_TASK_ARGS (WS_TASK_SIZE - sizeof(ws_task_t))
+
+// Detached tasks counted together, to wait for all of them at once.
+typedef struct ws_group {
+  _Atomic size_t pending;
+} ws_group_t;
+
+typedef struct ws_deque {
+  alignas(64) _Atomic int64_t top;
+  alignas(64) _Atomic int64_t bottom;
+  _Atomic(ws_task_t *) tasks[WS_DEQUE_SIZE];
+} ws_deque_t;
+
+typedef struct ws_sched ws_sched_t;
+
+struct ws_worker {
+  ws_deque_t deque;
+  ws_sched_t *sched;
+  unsigned id;
+  uint64_t rng;
+
+  // only touched by this worker
+  block_allocator_t tasks;
+  uint8_t *task_memory;
+  arena_t scratch;
+
+  alignas(64) _Atomic(block_allocator_block_t *) remote;
+
+  size_t spawned;
+  size_t stolen;
+};
+
+struct ws_sched {
+  ws_worker_t *workers;
+  unsigned count;
+  pthread_t threads[WS_MAX_WORKERS];
+  _Atomic bool stop;
+
+  // take task frames from malloc instead, for comparison
+  bool malloc_tasks;
+  // charged for the task pools and the scratch arenas
+  arena_budget_t *budget;
+};
+
+// --- The deque:
+
+// Owner only. Returns false when full.
+static inline bool ws_deque_push(ws_deque_t *d, ws_task_t *t) {
+  int64_t b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+  int64_t top = atomic_load_explicit(&d->top, memory_order_acquire);
+  if (b - top >= WS_DEQUE_SIZE)
+    return false;
+
+  atomic_store_explicit(&d->tasks[b & (WS_DEQUE_SIZE - 1)], t,
+                        memory_order_relaxed);
+  // the task and its slot are visible to whoever sees the new bottom
+  atomic_store_explicit(&d->bottom, b + 1, memory_order_release);
+  return true;
+}
+
+// Owner only, the most recently pushed task.
+static inline ws_task_t *ws_deque_take(ws_deque_t *d) {
+  int64_t b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+  // seq_cst, the store of bottom must be ordered before the load of top, or
+  // we and a thief could both get the last task
+  atomic_store_explicit(&d->bottom, b, memory_order_seq_cst);
+  int64_t t = atomic_load_explicit(&d->top, memory_order_seq_cst);
+
+  if (t > b) {
+    // it was empty
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_release);
+    return NULL;
+  }
+
+  ws_task_t *task = atomic_load_explicit(&d->tasks[b & (WS_DEQUE_SIZE - 1)],
+                                         memory_order_relaxed);
+  if (t == b) {
+    // the last one, race the thieves for it
+    if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+                                                 memory_order_seq_cst,
+                                                 memory_order_relaxed))
+      task = NULL;
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_release);
+  }
+
+  return task;
+}
+
+// Any thread, the oldest task.
+static inline ws_task_t *ws_deque_steal(ws_deque_t *d) {
+  int64_t t = atomic_load_explicit(&d->top, memory_order_seq_cst);
+  int64_t b = atomic_load_explicit(&d->bottom, memory_order_seq_cst);
+  if (t >= b)
+    return NULL;
+
+  ws_task_t *task = atomic_load_explicit(&d->tasks[t & (WS_DEQUE_SIZE - 1)],
+                                         memory_order_relaxed);
+  if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+                                               memory_order_seq_cst,
+                                               memory_order_relaxed))
+    return NULL;
+
+  return task;
+}
+
+// --- Task frames:
+
+static ws_task_t *ws_task_alloc(ws_worker_t *w) {
+  if (w->sched->malloc_tasks)
+    return (ws_task_t *)malloc(WS_TASK_SIZE);
+
+  ws_task_t *t = (ws_task_t *)ba_alloc(&w->tasks);
+  if (t)
+    return t;
+
+  // take back what the other workers freed
+  block_allocator_block_t *b =
+      atomic_exchange_explicit(&w->remote, NULL, memory_order_acquire);
+  while (b) {
+    block_allocator_block_t *next = b->next;
+    ba_free(&w->tasks, b);
+    b = next;
+  }
+
+  return (ws_task_t *)ba_alloc(&w->tasks);
+}
+
+static void ws_task_free(ws_worker_t *w, ws_task_t *t) {
+  if (w->sched->malloc_tasks) {
+    free(t);
+    return;
+  }
+
+  ws_worker_t *owner = t->owner;
+  if (owner == w) {
+    ba_free(&w->tasks, t);
+    return;
+  }
+
+  block_allocator_block_t *b = (block_allocator_block_t *)t;
+  b->next = atomic_load_explicit(&owner->remote, memory_order_relaxed);
+  while (!atomic_compare_exchange_weak_explicit(
+      &owner->remote, &b->next, b, memory_order_release, memory_order_relaxed))
+    ;
+}
+
+// --- Running tasks:
+
+// Scratch memory for the running task, freed when it returns.
+static inline arena_t *ws_scratch(ws_worker_t *w) { return &w->scratch; }
+
+// Run `fn` right here, with the scratch memory it takes rewound when it
+// returns. For the root of a computation, and for a call made inline that
+// would otherwise keep its scratch memory until the task around it is done.
+static inline void ws_run(ws_worker_t *w, ws_fn fn, void *args) {
+  arena_mark_t mark = arena_mark(&w->scratch);
+  fn(w, args);
+  arena_rewind(&w->scratch, mark);
+}
+
+static void ws_execute(ws_worker_t *w, ws_task_t *t) {
+  ws_run(w, t->fn, t->args);
+
+  ws_group_t *g = t->group;
+  if (g) {
+    ws_task_free(w, t);
+    atomic_fetch_sub_explicit(&g->pending, 1, memory_order_release);
+  } else {
+    atomic_store_explicit(&t->done, 1, memory_order_release);
+  }
+}
+
+// Run one task from anywhere, ours first. Returns false if there was none.
+static bool ws_run_one(ws_worker_t *w) {
+  ws_task_t *t = ws_deque_take(&w->deque);
+
+  for (unsigned i = 0; !t && i < w->sched->count; i++) {
+    w->rng ^= w->rng << 13, w->rng ^= w->rng >> 7, w->rng ^= w->rng << 17;
+    ws_worker_t *victim = &w->sched->workers[w->rng % w->sched->count];
+    if (victim != w && (t = ws_deque_steal(&victim->deque)))
+      w->stolen++;
+  }
+
+  if (!t)
+    return false;
+
+  ws_execute(w, t);
+  return true;
+}
+
+static ws_task_t *ws_spawn_task(ws_worker_t *w, ws_group_t *g, ws_fn fn,
+                                const void *args, size_t size) {
+  assert(size <= WS_TASK_ARGS);
+
+  ws_task_t *t = ws_task_alloc(w);
+  if (!t)
+    return NULL;
+
+  t->fn = fn;
+  t->owner = w;
+  t->group = g;
+  atomic_init(&t->done, 0);
+  memcpy(t->args, args, size);
+
+  if (!ws_deque_push(&w->deque, t)) {
+    ws_task_free(w, t);
+    return NULL;
+  }
+
+  w->spawned++;
+  return t;
+}
+
+// Run `fn` with a copy of `size` bytes of `args`, maybe on another worker.
+// Every spawned task must be joined. Returns `NULL` if it already ran.
+static ws_task_t *ws_spawn(ws_worker_t *w, ws_fn fn, const void *args,
+                           size_t size) {
+  ws_task_t *t = ws_spawn_task(w, NULL, fn, args, size);
+  if (!t)
+    ws_run(w, fn, (void *)args);
+
+  return t;
+}
+
+// Wait for `t`, running other tasks meanwhile, and free it.
+static void ws_join(ws_worker_t *w, ws_task_t *t) {
+  if (!t)
+    return;
+
+  while (!atomic_load_explicit(&t->done, memory_order_acquire)) {
+    if (!ws_run_one(w))
+      sched_yield();
+  }
+
+  ws_task_free(w, t);
+}
+
+// A task nobody joins, `ws_group_wait` waits for all of a group.
+static void ws_spawn_detached(ws_worker_t *w, ws_group_t *g, ws_fn fn,
+                              const void *args, size_t size) {
+  atomic_fetch_add_explicit(&g->pending, 1, memory_order_relaxed);
+  if (ws_spawn_task(w, g, fn, args, size))
+    return;
+
+  ws_run(w, fn, (void *)args);
+  atomic_fetch_sub_explicit(&g->pending, 1, memory_order_release);
+}
+
+static void ws_group_wait(ws_worker_t *w, ws_group_t *g) {
+  while (atomic_load_explicit(&g->pending, memory_order_acquire)) {
+    if (!ws_run_one(w))
+      sched_yield();
+  }
+}
+
+// --- The workers:
+
+static void *ws_worker_loop(void *arg) {
+  ws_worker_t *w = (ws_worker_t *)arg;
+  while (!atomic_load_explicit(&w->sched->stop, memory_order_relaxed)) {
+    if (!ws_run_one(w))
+      sched_yield();
+  }
+
+  return NULL;
+}
+
+// Start `count` workers, the calling thread is worker 0 (see `ws_main`). With
+// a `budget` (or NULL), the task pools are charged up front and the scratch
+// arenas as they grow.
+static bool ws_init(ws_sched_t *s, unsigned count, arena_budget_t *budget) {
+  assert(count > 0 && count <= WS_MAX_WORKERS);
+
+  *s = (ws_sched_t){.count = count, .budget = budget};
+  atomic_init(&s->stop, false);
+
+  size_t pool_size = (size_t)WS_TASKS_PER_WORKER * WS_TASK_SIZE;
+  size_t size = count * (sizeof(ws_worker_t) + pool_size);
+  if (!arena_budget_charge(budget, size))
+    return false;
+
+  s->workers = (ws_worker_t *)mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                   MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  if (s->workers == MAP_FAILED) {
+    arena_budget_uncharge(budget, size);
+    return false;
+  }
+
+  uint8_t *pools = (uint8_t *)(s->workers + count);
+  for (unsigned i = 0; i < count; i++) {
+    ws_worker_t *w = &s->workers[i];
+    w->sched = s;
+    w->id = i;
+    w->rng = 0x9e3779b97f4a7c15ull * (i + 1);
+    w->task_memory = pools + i * pool_size;
+    ba_init(&w->tasks, w->task_memory, pool_size, WS_TASK_SIZE);
+    w->scratch.budget = budget;
+    atomic_init(&w->deque.top, 0);
+    atomic_init(&w->deque.bottom, 0);
+    atomic_init(&w->remote, NULL);
+  }
+
+  for (unsigned i = 1; i < count; i++)
+    pthread_create(&s->threads[i], NULL, ws_worker_loop, &s->workers[i]);
+
+  return true;
+}
+
+static inline ws_worker_t *ws_main(ws_sched_t *s) { return &s->workers[0]; }
+
+// Every task must be done.
+static void ws_deinit(ws_sched_t *s) {
+  atomic_store_explicit(&s->stop, true, memory_order_relaxed);
+  for (unsigned i = 1; i < s->count; i++)
+    pthread_join(s->threads[i], NULL);
+
+  size_t pool_size = (size_t)WS_TASKS_PER_WORKER * WS_TASK_SIZE;
+  size_t size = s->count * (sizeof(ws_worker_t) + pool_size);
+  for (unsigned i = 0; i < s->count; i++)
+    arena_clear(&s->workers[i].scratch);
+  munmap(s->workers, size);
+  arena_budget_uncharge(s->budget, size);
+}